@@ -3,16 +3,388 @@
  * Author: Joelene Hales, 2024
  */
 
+#define _GNU_SOURCE  // CPU affinity
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sched.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+
+
+/* Worker pool limits */
+#define MAX_WORKERS 64    // Maximum number of worker processes in the pool
+#define MAX_BATCH   4096  // Maximum number of operand pairs sent in one frame
+
+/* Distributed mode */
+#define MAX_REMOTES   16  // Maximum number of remote servers
+#define MAX_DEPTH     16  // Maximum number of frames in flight per connection
+#define GROUP_LOCAL   0   // Tasks computed by the local worker pool
+#define GROUP_REMOTE  1   // Tasks sent to remote servers
+
+/* Shared-memory work queues */
+#define QUEUE_CAPACITY 1024  // Slots per queue, a power of 2
+#define CACHE_LINE     64
+#define SLOW_TASK_EVERY 64   // Every 64th task of a skewed stream is slow
+#define SLOW_TASK_COST  20000  // Extra loop iterations of a slow task
+
+/* CPU placement sweep */
+#define MAX_CPUS          1024  // Highest CPU number considered by the sweep
+#define NUM_PLACEMENTS    5     // Number of placement classes
+#define PLACEMENT_SAME    0     // Parent and worker on the same logical CPU
+#define PLACEMENT_SMT     1     // SMT siblings on the same physical core
+#define PLACEMENT_LLC     2     // Different cores sharing a last level cache
+#define PLACEMENT_SOCKET  3     // Same socket, different last level caches
+#define PLACEMENT_REMOTE  4     // Different sockets
+
+/* Polynomial mode. The modulus supports number theoretic transforms of
+ * length up to 2^23, with primitive root 3. */
+#define POLY_MODULUS     998244353u
+#define POLY_ROOT        3u
+#define POLY_MAX_LENGTH  (1 << 23)
+#define SCHOOLBOOK_MAX   32    // Shorter operands are multiplied directly
+#define KARATSUBA_MAX    1024  // Shorter products use Karatsuba, longer use the NTT
+
+/* Big-number mode. Numbers are arrays of 32-bit limbs, least significant
+ * first. Products with both operands at least BIGNUM_PARALLEL_MIN limbs
+ * long are split into chunks and computed by the worker pool. */
+#define BIGNUM_PARALLEL_MIN  128  // 4096 bits
+#define BIGNUM_MAX_WINDOW    6    // Largest sliding window, in bits
+
+/* Frame types used by the worker pool protocol */
+#define FRAME_PAIRS    1  // Parent to worker: operand pairs to multiply
+#define FRAME_PRODUCTS 2  // Worker to parent: one product per operand pair, modulo 2^32
+#define FRAME_STOP     3  // Parent to worker: no more work, exit
+#define FRAME_BLOCKS   4  // Parent to worker: (block row, block column) tiles of C to compute
+#define FRAME_POLY     5  // Parent to worker: (chunk of A, chunk of B) polynomial products
+#define FRAME_BIGNUM   6  // Parent to worker: (chunk of A, chunk of B) big-number products
+#define FRAME_VARINT   0x100  // Flag: payload items are LEB128 varints instead of 4-byte words
+
+/* Largest LEB128 encoding of a 32-bit item */
+#define VARINT_MAX_BYTES 5
+
+/* I/O backends used by the parent to exchange frames with the workers */
+#define BACKEND_EPOLL 0  // One write per channel, epoll_wait + read for replies
+#define BACKEND_URING 1  // Reads and writes for every channel in one io_uring_enter
+
+/* Channel types connecting the parent to each worker */
+#define CHANNEL_PIPE   0  // Two pipes per worker
+#define CHANNEL_SOCKET 1  // One UNIX domain socket pair per worker
+
+
+/* Header preceding every frame. The payload is count items, either 4-byte
+ * words or varints if the type includes FRAME_VARINT. */
+struct frame_header {
+    uint32_t type;    // One of the FRAME_* constants
+    uint32_t count;   // Number of items in the payload
+    uint32_t length;  // Number of bytes in the payload
+};
+
+/* Parent's end of the connection to a single worker */
+struct channel {
+    int read_fd;   // Parent reads replies from the worker
+    int write_fd;  // Parent writes requests to the worker
+};
+
+/* Frame being sent or recieved, tracking partial transfers. The length of a
+ * reply is not known until its header has been recieved, so replies are read
+ * into the full capacity of the buffer. */
+struct frame_buffer {
+    char* data;       // Header followed by payload
+    size_t length;    // Total number of bytes in the frame, or 0 if not yet known
+    size_t capacity;  // Number of bytes allocated for data
+    size_t done;      // Number of bytes transferred so far
+};
+
+/* Counters used to compare the I/O backends */
+struct io_stats {
+    long syscalls;  // System calls made by the parent to move frames
+    long frames;    // Frames sent plus frames recieved
+    long rounds;    // Number of times every active worker was sent a frame
+    long bytes;     // Bytes sent plus bytes recieved, including headers
+};
+
+/* Options shared by the worker pool modes */
+struct pool_options {
+    int backend;       // BACKEND_EPOLL or BACKEND_URING
+    int channel_type;  // CHANNEL_PIPE or CHANNEL_SOCKET
+    int batch;         // Number of tasks per frame
+    int block_size;    // Side length of the square matrix tiles
+    int chunks;        // Number of chunks per polynomial, or 0 to match the workers
+    uint32_t encoding; // 0 for 4-byte words, or FRAME_VARINT
+    int depth;         // Frames in flight per connection in distributed mode
+    int local_workers; // Local workers in distributed mode
+    double remote_fraction;  // Fraction of tasks sent to remote servers, or -1 to use the model
+    int num_cpus;      // Number of CPUs given with -a, or 0 to leave placement to the scheduler
+    int cpus[MAX_WORKERS + 1];  // Parent's CPU, followed by the CPUs workers are assigned in turn
+};
+
+/* Connection to a local worker or remote server in distributed mode. Up to
+ * depth frames are pipelined, and replies arrive in the order sent. */
+struct stream_channel {
+    int fd;                     // Socket used in both directions, non-blocking
+    int group;                  // GROUP_LOCAL or GROUP_REMOTE
+    int in_flight;              // Frames sent without a reply
+    int oldest;                 // Index in first_task of the oldest frame in flight
+    int first_task[MAX_DEPTH];  // First task of each frame in flight
+    int task_count[MAX_DEPTH];  // Number of tasks in each frame in flight
+    int want_write;             // 1 while waiting for the socket to become writable
+    struct frame_buffer send;   // Frame being written. Length 0 when idle.
+    struct frame_buffer recv;   // Bytes recieved but not yet parsed
+};
+
+/* Measured cost of sending work over one connection */
+struct link_model {
+    double latency;         // Round trip of a single-task frame, in seconds
+    double per_task;        // Additional time per task in a full frame, in seconds
+    double bytes_per_task;  // Request plus reply bytes per task in a full frame
+};
+
+/* Location of a logical CPU in the cache and package hierarchy */
+struct cpu_topology {
+    int online;   // 1 if the CPU is online and allowed for this process
+    int core;     // Core ID within the package
+    int package;  // Physical package (socket) ID
+    int llc;      // Lowest numbered CPU sharing the last level cache
+};
+
+/* Matrices shared between the parent and the workers in matrix mode.
+ * C = A * B where A is rows x inner and B is inner x cols. */
+struct matrix_context {
+    int rows, inner, cols;
+    int block_size;
+    double* a;
+    double* b;
+    double* c;
+};
+
+/* Polynomials shared between the parent and the workers in polynomial mode.
+ * Both operands are split into chunks of equal length. The product of chunk
+ * i of A and chunk j of B is written to its own slot, and shifted by
+ * (i + j) * chunk coefficients when the parent accumulates the result. */
+struct poly_context {
+    uint32_t* a;
+    uint32_t* b;
+    int length_a, length_b;  // Number of coefficients (degree + 1)
+    int chunk;               // Number of coefficients per chunk
+    int chunks_a, chunks_b;  // Number of chunks in each operand
+    uint32_t* slots;         // 2 * chunk coefficients per product of chunks
+};
+
+/* Task or completion passed through a shared-memory queue */
+struct queue_item {
+    int32_t index;  // Task number, or -1 to tell a worker to exit
+    int32_t x, y;   // Operands of a task, or the result in x of a completion
+    int32_t cost;   // Extra work done by the task, to simulate big-number jobs
+};
+
+/* Slot of a queue. The sequence number tells producers and consumers
+ * whether the slot is free or full for their current position. */
+struct queue_slot {
+    atomic_size_t sequence;
+    struct queue_item item;
+};
+
+/* Bounded lock-free multi-producer/multi-consumer queue (Vyukov). Lives in
+ * shared memory, so any process can push or pop. The positions are on
+ * separate cache lines so producers and consumers do not contend. */
+struct mpmc_queue {
+    _Alignas(CACHE_LINE) atomic_size_t enqueue_position;
+    _Alignas(CACHE_LINE) atomic_size_t dequeue_position;
+    _Alignas(CACHE_LINE) struct queue_slot slots[QUEUE_CAPACITY];
+};
+
+/* Chunking of the current big-number product. Kept in shared memory, since
+ * it changes with every product after the workers have been forked. */
+struct bignum_layout {
+    int length_a, length_b;  // Number of limbs in each operand
+    int chunk;               // Number of limbs per chunk
+    int chunks_a, chunks_b;  // Number of chunks in each operand
+};
+
+/* Big-number operands shared between the parent and the workers. Each
+ * product of a chunk of A and a chunk of B is written to its own slot and
+ * added to the result at limb offset (i + j) * chunk by the parent. */
+struct bignum_context {
+    uint32_t* a;
+    uint32_t* b;
+    struct bignum_layout* layout;  // Chunking of the current product
+    uint32_t* slots;         // 2 * chunk limbs per product of chunks
+    int capacity;            // Limbs allocated for each operand
+    size_t slots_capacity;   // Limbs allocated for the slots
+    struct worker_pool* pool;  // Pool used for large products, or NULL to multiply locally
+    int backend;             // Backend used to reach the pool
+    int pieces;              // Number of chunks each operand is split into
+};
+
+/* Montgomery arithmetic modulo an odd n-limb modulus N, with R = 2^(32n) */
+struct montgomery {
+    int n;
+    uint32_t* modulus;   // N
+    uint32_t* inverse;   // -N^-1 mod R
+    uint32_t* r_squared; // R^2 mod N
+    uint32_t* scratch;   // Temporary storage for 8n + 2 limbs
+};
+
+/* Minimal io_uring instance driven through raw system calls */
+struct uring {
+    int fd;
+    unsigned entries;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    void* cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned to_submit;  // SQEs queued since the last io_uring_enter
+};
+
+/* Set of forked worker processes and the channels used to reach them. The
+ * frame buffers and io_uring instance used to dispatch tasks are set up on
+ * first use and kept until the pool is stopped. */
+struct worker_pool {
+    int num_workers;
+    int channel_type;
+    pid_t pids[MAX_WORKERS];
+    struct channel channels[MAX_WORKERS];
+    int epoll_fd;  // Watches the read end of every channel
+    struct frame_buffer requests[MAX_WORKERS];  // One request frame per worker
+    struct frame_buffer replies[MAX_WORKERS];   // One reply frame per worker
+    int buffer_batch;  // Number of tasks the frame buffers can hold, or 0 if not allocated
+    struct uring ring;
+    int ring_ready;    // Whether ring has been set up
+};
 
 void print_variable(char var);
 void send_data(int* port, int write_end, int data, int fork_pid);
 int recieve_data(int* port, int read_end, int fork_pid);
 
+int run_pool_mode(int argc, char* argv[]);
+void parse_pool_options(int argc, char* argv[], int first, struct pool_options* options);
+int parse_workers(char* arg);
+int next_worker_count(int workers, int max_workers);
+void print_pool_usage(void);
+double now_seconds(void);
+uint32_t random_next(uint32_t* state);
+void decompose(int a, int b, int32_t* tasks);
+int recombine(int32_t* products);
+int write_full(int fd, const void* data, size_t length);
+size_t varint_encode(const int32_t* values, int count, uint8_t* out);
+long varint_decode_scalar(const uint8_t* in, size_t length, int32_t* values, int count);
+long varint_decode(const uint8_t* in, size_t length, int32_t* values, int count);
+size_t encode_payload(uint32_t type, const int32_t* values, int count, char* frame);
+int decode_payload(const char* frame, int32_t* values);
+int reply_complete(struct frame_buffer* reply);
+int read_full(int fd, void* data, size_t length);
+void worker_loop(int read_fd, int write_fd, int pairs_only);
+void pool_start(struct worker_pool* pool, int num_workers, struct pool_options* options);
+int worker_cpu(struct pool_options* options, int w);
+int pin_to_cpu(int cpu);
+int parse_cpu_list(const char* text, int* cpus, int max_cpus);
+int read_sysfs(int cpu, const char* suffix, char* buffer, size_t size);
+int read_topology(struct cpu_topology* topology);
+int classify_placement(struct cpu_topology* topology, int first, int second);
+void queue_init(struct mpmc_queue* queue);
+int queue_push(struct mpmc_queue* queue, const struct queue_item* item);
+int queue_pop(struct mpmc_queue* queue, struct queue_item* item);
+int32_t compute_task(const struct queue_item* task);
+int run_queue(int num_workers, int num_pairs, int skewed, int static_partition, struct pool_options* options, double* elapsed);
+int compare_doubles(const void* first, const void* second);
+int connect_remote(char* address);
+int listen_tcp(const char* host, int port);
+void serve_tcp(int listen_fd, int max_connections);
+void set_nodelay(int fd);
+int round_trip(int fd, char* request, size_t length, char* reply, size_t capacity);
+void probe_link(int fd, int batch, uint32_t encoding, struct link_model* model);
+int plan_remote_tasks(struct link_model* local, int local_workers, struct link_model* remote, int num_remotes, int depth, int batch, int num_tasks);
+int flush_channel(struct stream_channel* channel);
+int run_distributed(struct stream_channel* channels, int num_channels, struct pool_options* options, int32_t* operands, int num_tasks, int remote_tasks, int32_t* results, double* finish);
+void distributed_mode(int num_remotes, int* remote_fds, char** names, int num_pairs, struct pool_options* options);
+void bignum_setup(int capacity, int pieces);
+void bn_random(uint32_t* a, int n, uint32_t* seed);
+int bn_compare(const uint32_t* a, const uint32_t* b, int n);
+uint32_t bn_subtract(uint32_t* a, const uint32_t* b, int n);
+void bn_add_at(uint32_t* out, int length, const uint32_t* a, int n, int offset);
+void bn_mul_schoolbook(const uint32_t* a, int length_a, const uint32_t* b, int length_b, uint32_t* out);
+void bn_mul(const uint32_t* a, int length_a, const uint32_t* b, int length_b, uint32_t* out);
+void bn_multiply_chunks(struct bignum_context* c, int chunk_a, int chunk_b);
+void mont_init(struct montgomery* m, const uint32_t* modulus, int n);
+void mont_free(struct montgomery* m);
+void mont_mul(struct montgomery* m, const uint32_t* a, const uint32_t* b, uint32_t* out);
+void mont_pow(struct montgomery* m, const uint32_t* base, const uint32_t* exponent, int exponent_limbs, uint32_t* out);
+void bn_mod_reference(const uint32_t* a, int length, const uint32_t* modulus, int n, uint32_t* out);
+int mont_self_check(void);
+uint32_t* product_tree(uint32_t** factors, int* lengths, int count, int* length);
+void print_bn_prefix(const uint32_t* a, int n);
+void run_placement_sweep(int round_trips, struct pool_options* options);
+void pool_stop(struct worker_pool* pool);
+void exchange_epoll(struct worker_pool* pool, struct frame_buffer* requests, struct frame_buffer* replies, int active, struct io_stats* stats);
+int uring_init(struct uring* ring, unsigned entries);
+void uring_free(struct uring* ring);
+void uring_queue(struct uring* ring, int opcode, int fd, void* data, size_t length, uint64_t user_data);
+void exchange_uring(struct uring* ring, struct worker_pool* pool, struct frame_buffer* requests, struct frame_buffer* replies, int active, struct io_stats* stats);
+int dispatch_tasks(struct worker_pool* pool, int backend, uint32_t type, int32_t* operands, int num_tasks, int batch, int32_t* results, struct io_stats* stats);
+int32_t worker_compute(uint32_t type, int32_t x, int32_t y);
+int run_stream(struct worker_pool* pool, int backend, uint32_t encoding, int num_pairs, int batch, struct io_stats* stats, double* elapsed);
+void print_stream_result(int backend, int channel_type, int num_workers, int batch, int num_pairs, struct io_stats* stats, double elapsed);
+void print_decode_rates(int num_pairs);
+void* shared_alloc(size_t size);
+double* read_matrix(char* filename, int* rows, int* cols);
+void write_matrix(char* filename, double* data, int rows, int cols);
+void multiply_block(struct matrix_context* m, int block_row, int block_col);
+void multiply_blocked(struct matrix_context* m);
+int run_matrix(struct worker_pool* pool, struct pool_options* options, struct io_stats* stats, double* elapsed);
+void print_matrix_result(char* label, struct matrix_context* m, double elapsed);
+uint32_t mod_pow(uint32_t base, uint64_t exponent);
+void ntt(uint32_t* a, int n, int invert);
+void poly_schoolbook(const uint32_t* a, int length_a, const uint32_t* b, int length_b, uint32_t* out);
+void poly_karatsuba(const uint32_t* a, const uint32_t* b, int n, uint32_t* out, uint32_t* scratch);
+void poly_multiply(const uint32_t* a, int length_a, const uint32_t* b, int length_b, uint32_t* out);
+char* poly_algorithm(int length_a, int length_b);
+uint32_t* read_poly(char* filename, int* length);
+void poly_setup(int length_a, int length_b, int chunks);
+void poly_multiply_chunks(struct poly_context* q, int chunk_a, int chunk_b);
+int run_poly(struct worker_pool* pool, struct pool_options* options, struct io_stats* stats, uint32_t* result, double* elapsed);
+
+/* Matrices used by matrix mode. Set before the pool is forked so that the
+ * workers inherit the shared mappings. */
+struct matrix_context matrix;
+
+/* Polynomials used by polynomial mode, set before the pool is forked */
+struct poly_context poly;
+
+/* Big-number operands used by the modular exponentiation and product tree
+ * modes, allocated before the pool is forked */
+struct bignum_context bignum;
+
 
 /**
  * Program computes the product of two integers using decomposition.
@@ -26,11 +398,20 @@ int recieve_data(int* port, int read_end, int fork_pid);
  * is computed, the parent process computes each required intermediate value.
  * Finally, the parent process sums together the intermediate values to obtain
  * the final result.
+ *
+ * If the first argument is a flag, the program instead runs one of the worker
+ * pool modes, which stream many decomposed products through a pool of worker
+ * processes. See print_pool_usage for the available modes.
  */
 int main(int argc, char * argv[]) {
 
     int a, b, a1, a2, b1, b2;  // Integer to multiply and their components
 
+    /* Flags select one of the worker pool modes */
+    if (argc > 1 && argv[1][0] == '-' && isalpha((unsigned char) argv[1][1])) {
+        return run_pool_mode(argc, argv);
+    }
+
     /* Validate input */
     if (argc != 3) {
         printf("Invalid number of arguments recieved.");
@@ -129,7 +510,7 @@ int main(int argc, char * argv[]) {
             y = recieve_data(parent_to_child, 0, pid);
 
             /* Compute product of the recieved integers */
-            product = x * y;
+            product = (int) ((unsigned int) x * (unsigned int) y);  // Wraps instead of overflowing
             send_data(child_to_parent, 1, product, pid);  // Send computed product back to parent
 
             done += 1;  // Increment the number of products computed
@@ -216,3 +597,4532 @@ int recieve_data(int* port, int read_end, int fork_pid) {
 
 }
 
+
+
+/**
+ * Parses the arguments for the worker pool modes and runs the selected mode.
+ * 
+ * Modes
+ * -----
+ *   -p <workers> <pairs>      : Stream <pairs> random four-digit products
+ *                               through the worker pool and verify every result.
+ *   -b <workers> <pairs>      : Run the stream with every backend and channel
+ *                               type and compare system calls and throughput.
+ *   -W <workers> <pairs>      : Run the stream with fixed-width and varint
+ *                               frames and compare bytes per pair and
+ *                               throughput.
+ *   -g <rows> <cols> <file>   : Write a random matrix to a binary file.
+ *   -m <workers> <A> <B> [C]  : Multiply the matrices in binary files A and B
+ *                               using block decomposition over the worker
+ *                               pool, and optionally write the result to C.
+ *   -M <workers> <n>          : Benchmark GFLOP/s of n x n matrix
+ *                               multiplication against a single-process
+ *                               blocked baseline, for 1 to <workers> workers.
+ *   -y <workers> <A> <B> [C]  : Multiply the polynomials mod 998244353 in
+ *                               text files A and B over the worker pool, and
+ *                               optionally write the product to C.
+ *   -Y <workers> <degree>     : Benchmark coefficients/sec of multiplying
+ *                               random polynomials of the given degree, for
+ *                               1 to <workers> workers.
+ *   -q <workers> <pairs>      : Stream <pairs> random four-digit products
+ *                               through a shared-memory MPMC queue that every
+ *                               worker pulls tasks from.
+ *   -Q <workers> <pairs>      : Benchmark the MPMC queue for 1 to <workers>
+ *                               workers, with uniform tasks and with skewed
+ *                               tasks against a static partition.
+ *   -s <port> [connections] [host] : Serve products to remote parents over
+ *                               TCP, forking a worker per connection. Exits
+ *                               after the given number of connections, if
+ *                               any. Binds 127.0.0.1 unless a host is given.
+ *   -r <host:port,...> <pairs>: Stream <pairs> products split between local
+ *                               workers and the listed TCP servers.
+ *   -R <servers> <pairs>      : Start <servers> TCP servers on localhost and
+ *                               run the distributed stream against them.
+ *   -E <workers> <exp bits>   : Benchmark Montgomery modular exponentiation
+ *                               with 2048- to 16384-bit moduli and bases and
+ *                               exponents of the given size, with and without
+ *                               the worker pool.
+ *   -T <workers> <factors> <bits> : Multiply <factors> random numbers of the
+ *                               given size with a product tree, with and
+ *                               without the worker pool.
+ *   -A <round trips>          : Measure parent/worker round-trip latency for
+ *                               every CPU placement class found in
+ *                               /sys/devices/system/cpu.
+ * 
+ * Options
+ * -------
+ *   -e epoll|uring  : I/O backend used by the parent (default epoll)
+ *   -t pipe|socket  : Channel type between the parent and each worker (default pipe)
+ *   -n <batch>      : Number of operand pairs or tiles per frame (default 256
+ *                     pairs, 1 tile)
+ *   -w fixed|varint : Encoding of stream frames (default fixed)
+ *   -k <block>      : Side length of the matrix tiles (default 64)
+ *   -c <chunks>     : Number of chunks each polynomial is split into
+ *                     (default: enough to give every worker a product)
+ *   -l <workers>    : Local workers in distributed mode (default 1)
+ *   -d <depth>      : Frames in flight per connection in distributed mode (default 4)
+ *   -f <fraction>   : Fraction of tasks sent to remote servers, overriding
+ *                     the bandwidth/latency model
+ *   -a <cpus>       : Comma-separated CPUs. The parent is pinned to the first
+ *                     and workers are pinned to the rest in turn. A single
+ *                     CPU pins every process to it.
+ * 
+ * Polynomial files contain the coefficients as whitespace-separated
+ * integers, starting from the constant term.
+ * 
+ * Binary matrix files contain the number of rows and columns as two 32-bit
+ * unsigned integers, followed by the elements as doubles in row-major order.
+ * 
+ * Parameters
+ * ----------
+ *   argc : Number of command line arguments
+ *   argv : Command line arguments
+ * 
+ * Returns
+ * -------
+ *   status : Exit status of the program
+ */
+int run_pool_mode(int argc, char* argv[]) {
+
+    char* mode = argv[1];
+    struct pool_options options;
+    struct worker_pool pool;
+    struct io_stats stats;
+    double elapsed;
+
+    if (strcmp(mode, "-A") == 0 && argc >= 3) {  // CPU placement sweep
+
+        int round_trips = atoi(argv[2]);
+        if (round_trips < 1) {
+            printf("Number of round trips must be positive.\n");
+            exit(0);
+        }
+        options.batch = 1;
+        parse_pool_options(argc, argv, 3, &options);
+        run_placement_sweep(round_trips, &options);
+        return 0;
+
+    }
+
+    if (argc < 3) {
+        print_pool_usage();
+        exit(0);
+    }
+
+    if (strcmp(mode, "-s") == 0) {  // TCP server
+
+        int port = atoi(argv[2]);
+        int max_connections = argc > 3 ? atoi(argv[3]) : 0;
+        if (port < 1 || port > 65535 || max_connections < 0) {
+            print_pool_usage();
+            exit(0);
+        }
+
+        const char* host = argc > 4 ? argv[4] : NULL;
+        int listen_fd = listen_tcp(host, port);
+        printf("Serving products on %s:%d\n", host == NULL ? "127.0.0.1" : host, port);
+        serve_tcp(listen_fd, max_connections);
+        return 0;
+
+    }
+
+    if (strcmp(mode, "-r") == 0 || strcmp(mode, "-R") == 0) {  // Distributed stream
+
+        if (argc < 4) {
+            print_pool_usage();
+            exit(0);
+        }
+
+        int num_pairs = atoi(argv[3]);
+        options.batch = 256;
+        parse_pool_options(argc, argv, 4, &options);
+        if (num_pairs < 1 || options.batch > MAX_BATCH / 4) {
+            printf("Number of pairs must be positive and the batch size at most %d.\n", MAX_BATCH / 4);
+            exit(0);
+        }
+
+        int remote_fds[MAX_REMOTES];
+        char* names[MAX_REMOTES];
+        char name_storage[MAX_REMOTES][32];
+        pid_t servers[MAX_REMOTES];
+        int num_remotes = 0;
+
+        if (strcmp(mode, "-R") == 0) {  // Local servers on ephemeral ports
+
+            num_remotes = atoi(argv[2]);
+            if (num_remotes < 1 || num_remotes > MAX_REMOTES) {
+                printf("Number of servers must be between 1 and %d.\n", MAX_REMOTES);
+                exit(0);
+            }
+
+            fflush(stdout);  // Do not duplicate buffered output in the children
+            for (int r = 0; r < num_remotes; r++) {
+
+                int listen_fd = listen_tcp("127.0.0.1", 0);
+                struct sockaddr_in address;
+                socklen_t length = sizeof(address);
+                getsockname(listen_fd, (struct sockaddr*) &address, &length);
+                snprintf(name_storage[r], sizeof(name_storage[r]), "127.0.0.1:%d", ntohs(address.sin_port));
+                names[r] = name_storage[r];
+
+                servers[r] = fork();
+                if (servers[r] < 0) {
+                    printf("Error forking child process.");
+                    exit(0);
+                }
+                if (servers[r] == 0) {  // Server process serves a single parent
+                    serve_tcp(listen_fd, 1);
+                    _exit(0);
+                }
+                close(listen_fd);
+            }
+        }
+        else {  // Comma-separated list of servers
+
+            char* list = strdup(argv[2]);
+            for (char* token = strtok(list, ","); token != NULL; token = strtok(NULL, ",")) {
+                if (num_remotes == MAX_REMOTES) {
+                    printf("At most %d servers may be given.\n", MAX_REMOTES);
+                    exit(0);
+                }
+                names[num_remotes++] = token;
+            }
+        }
+
+        /* Connect to every server. Local workers are forked by
+         * distributed_mode, after the servers so they hold no listeners. */
+        for (int r = 0; r < num_remotes; r++) {
+            remote_fds[r] = connect_remote(names[r]);
+        }
+
+        distributed_mode(num_remotes, remote_fds, names, num_pairs, &options);
+
+        if (strcmp(mode, "-R") == 0) {
+            for (int r = 0; r < num_remotes; r++) {
+                waitpid(servers[r], NULL, 0);
+            }
+        }
+        return 0;
+
+    }
+
+    if (strcmp(mode, "-E") == 0) {  // Modular exponentiation benchmark
+
+        if (argc < 4) {
+            print_pool_usage();
+            exit(0);
+        }
+
+        int num_workers = parse_workers(argv[2]);
+        int exponent_bits = atoi(argv[3]);
+        if (exponent_bits < 1) {
+            printf("Exponent size must be positive.\n");
+            exit(0);
+        }
+        options.batch = 1;
+        parse_pool_options(argc, argv, 4, &options);
+
+        if (!mont_self_check()) {
+            printf("Montgomery self-check against reference arithmetic FAILED\n");
+            exit(0);
+        }
+        printf("Montgomery self-check against reference arithmetic passed\n");
+
+        /* Operands are at most 16384 bits, and the pool splits them into
+         * about sqrt(workers) chunks each */
+        bignum_setup(16384 / 32, options.chunks > 0 ? options.chunks : num_workers);
+        pool_start(&pool, num_workers, &options);
+        bignum.backend = options.backend;
+
+        int exponent_limbs = (exponent_bits + 31) / 32;
+        uint32_t seed = 12345;
+
+        for (int bits = 2048; bits <= 16384; bits *= 2) {
+
+            int n = bits / 32;
+            uint32_t* modulus = malloc(n * sizeof(uint32_t));
+            uint32_t* base = malloc(n * sizeof(uint32_t));
+            uint32_t* exponent = malloc(exponent_limbs * sizeof(uint32_t));
+            uint32_t* results[2];
+
+            bn_random(modulus, n, &seed);
+            modulus[0] |= 1;              // Montgomery form requires an odd modulus
+            modulus[n - 1] |= 0x80000000; // Full size
+            bn_random(base, n, &seed);
+            base[n - 1] &= 0x7FFFFFFF;    // Less than the modulus
+            bn_random(exponent, exponent_limbs, &seed);
+            if (exponent_bits % 32 != 0) {
+                exponent[exponent_limbs - 1] &= (1u << (exponent_bits % 32)) - 1;
+            }
+
+            double times[2];
+            for (int parallel = 0; parallel <= 1; parallel++) {
+
+                bignum.pool = parallel ? &pool : NULL;
+                results[parallel] = malloc(n * sizeof(uint32_t));
+
+                struct montgomery m;
+                double start = now_seconds();
+                mont_init(&m, modulus, n);
+                mont_pow(&m, base, exponent, exponent_limbs, results[parallel]);
+                times[parallel] = now_seconds() - start;
+                mont_free(&m);
+            }
+
+            printf("%5d-bit modulus, %d-bit exponent : local %8.4f s  %d workers %8.4f s  (%.2fx)  result ",
+                   bits, exponent_bits, times[0], num_workers, times[1], times[0] / times[1]);
+            print_bn_prefix(results[0], n);
+            printf("\n");
+            if (memcmp(results[0], results[1], n * sizeof(uint32_t)) != 0) {
+                printf("Pool result differs from the local result.\n");
+            }
+
+            free(modulus);
+            free(base);
+            free(exponent);
+            free(results[0]);
+            free(results[1]);
+        }
+
+        pool_stop(&pool);
+        return 0;
+
+    }
+
+    if (strcmp(mode, "-T") == 0) {  // Product tree benchmark
+
+        if (argc < 5) {
+            print_pool_usage();
+            exit(0);
+        }
+
+        int num_workers = parse_workers(argv[2]);
+        int count = atoi(argv[3]);
+        int bits = atoi(argv[4]);
+        if (count < 1 || bits < 1) {
+            printf("Number of factors and their size must be positive.\n");
+            exit(0);
+        }
+        options.batch = 1;
+        parse_pool_options(argc, argv, 5, &options);
+
+        /* Generate random factors */
+        int limbs = (bits + 31) / 32;
+        uint32_t** factors = malloc(count * sizeof(uint32_t*));
+        int* lengths = malloc(count * sizeof(int));
+        uint32_t seed = 12345;
+        for (int i = 0; i < count; i++) {
+            factors[i] = malloc(limbs * sizeof(uint32_t));
+            lengths[i] = limbs;
+            bn_random(factors[i], limbs, &seed);
+            factors[i][limbs - 1] |= 0x80000000;  // Keep every factor at full length
+        }
+
+        /* The largest product at the root multiplies two halves of the
+         * factors */
+        bignum_setup((count + 1) / 2 * limbs + 1, options.chunks > 0 ? options.chunks : num_workers);
+        pool_start(&pool, num_workers, &options);
+        bignum.backend = options.backend;
+
+        uint32_t* results[2];
+        int result_lengths[2];
+        double times[2];
+        for (int parallel = 0; parallel <= 1; parallel++) {
+            bignum.pool = parallel ? &pool : NULL;
+            double start = now_seconds();
+            results[parallel] = product_tree(factors, lengths, count, &result_lengths[parallel]);
+            times[parallel] = now_seconds() - start;
+        }
+        pool_stop(&pool);
+
+        /* Check against multiplying the factors one at a time */
+        bignum.pool = NULL;
+        uint32_t* expected = calloc(count * limbs, sizeof(uint32_t));
+        uint32_t* temporary = calloc(count * limbs, sizeof(uint32_t));
+        memcpy(expected, factors[0], limbs * sizeof(uint32_t));
+        for (int i = 1; i < count; i++) {
+            bn_mul_schoolbook(expected, i * limbs, factors[i], limbs, temporary);
+            memcpy(expected, temporary, (i + 1) * limbs * sizeof(uint32_t));
+        }
+
+        printf("%d factors of %d bits : local %8.4f s  %d workers %8.4f s  (%.2fx)  result ",
+               count, bits, times[0], num_workers, times[1], times[0] / times[1]);
+        print_bn_prefix(results[1], result_lengths[1]);
+        printf("\n");
+        for (int parallel = 0; parallel <= 1; parallel++) {
+            if (result_lengths[parallel] != count * limbs || memcmp(results[parallel], expected, count * limbs * sizeof(uint32_t)) != 0) {
+                printf("%s product tree differs from the sequential product.\n", parallel ? "Pool" : "Local");
+            }
+        }
+
+        /* Free dynamically allocated memory */
+        for (int i = 0; i < count; i++) {
+            free(factors[i]);
+        }
+        free(factors);
+        free(lengths);
+        free(results[0]);
+        free(results[1]);
+        free(expected);
+        free(temporary);
+        return 0;
+
+    }
+
+    if (strcmp(mode, "-q") == 0 || strcmp(mode, "-Q") == 0) {  // Shared-memory MPMC queue
+
+        if (argc < 4) {
+            print_pool_usage();
+            exit(0);
+        }
+
+        int num_workers = parse_workers(argv[2]);
+        int num_pairs = atoi(argv[3]);
+        options.batch = 1;
+        parse_pool_options(argc, argv, 4, &options);
+        if (num_pairs < 1) {
+            print_pool_usage();
+            exit(0);
+        }
+
+        if (strcmp(mode, "-q") == 0) {
+
+            int errors = run_queue(num_workers, num_pairs, 0, 0, &options, &elapsed);
+            printf("queue : workers %2d  %10.0f pairs/sec\n", num_workers, num_pairs / elapsed);
+            printf("\n%d of %d products verified\n", num_pairs - errors, num_pairs);
+
+        }
+        else {
+
+            printf("workers   uniform queue    skewed queue    skewed static   (pairs/sec)\n");
+            for (int workers = 1; workers > 0; workers = next_worker_count(workers, num_workers)) {
+
+                double uniform, skewed, partitioned;
+                int errors = run_queue(workers, num_pairs, 0, 0, &options, &uniform);
+                errors += run_queue(workers, num_pairs, 1, 0, &options, &skewed);
+                errors += run_queue(workers, num_pairs, 1, 1, &options, &partitioned);
+
+                printf("%7d  %14.0f  %14.0f  %14.0f\n", workers,
+                       num_pairs / uniform, num_pairs / skewed, num_pairs / partitioned);
+                if (errors > 0) {
+                    printf("%d products were incorrect.\n", errors);
+                }
+            }
+
+        }
+
+        return 0;
+
+    }
+
+    if (strcmp(mode, "-p") == 0 || strcmp(mode, "-b") == 0 || strcmp(mode, "-W") == 0) {  // Streams of four-digit products
+
+        if (argc < 4) {
+            print_pool_usage();
+            exit(0);
+        }
+
+        int num_workers = parse_workers(argv[2]);
+        int num_pairs = atoi(argv[3]);
+        options.batch = 256;
+        parse_pool_options(argc, argv, 4, &options);
+
+        /* Validate input */
+        if (num_pairs < 1) {
+            printf("Number of pairs must be positive.\n");
+            exit(0);
+        }
+        if (options.batch > MAX_BATCH / 4) {  // Each pair decomposes into 4 tasks
+            printf("Batch size must be between 1 and %d.\n", MAX_BATCH / 4);
+            exit(0);
+        }
+        int batch = 4 * options.batch;  // Frames carry the four decomposed products of each pair
+
+        if (strcmp(mode, "-p") == 0) {  // Single stream with the selected backend
+
+            pool_start(&pool, num_workers, &options);
+            int errors = run_stream(&pool, options.backend, options.encoding, num_pairs, batch, &stats, &elapsed);
+            pool_stop(&pool);
+
+            if (errors < 0) {
+                exit(0);
+            }
+            print_stream_result(options.backend, options.channel_type, num_workers, options.batch, num_pairs, &stats, elapsed);
+            printf("%s frames: %.2f bytes/pair\n", options.encoding ? "varint" : "fixed", (double) stats.bytes / num_pairs);
+            printf("\n%d of %d products verified\n", num_pairs - errors, num_pairs);
+
+        }
+        else if (strcmp(mode, "-W") == 0) {  // Compare fixed-width and varint frames
+
+            for (int varint = 0; varint <= 1; varint++) {
+
+                uint32_t encoding = varint ? FRAME_VARINT : 0;
+                pool_start(&pool, num_workers, &options);
+                int errors = run_stream(&pool, options.backend, encoding, num_pairs, batch, &stats, &elapsed);
+                pool_stop(&pool);
+
+                if (errors < 0) {
+                    exit(0);
+                }
+                printf("%-6s : %6.2f bytes/pair  ", varint ? "varint" : "fixed", (double) stats.bytes / num_pairs);
+                print_stream_result(options.backend, options.channel_type, num_workers, options.batch, num_pairs, &stats, elapsed);
+                if (errors > 0) {
+                    printf("%d products were incorrect.\n", errors);
+                }
+            }
+
+            print_decode_rates(num_pairs);
+
+        }
+        else {  // Compare every backend and channel type
+
+            for (int type = CHANNEL_PIPE; type <= CHANNEL_SOCKET; type++) {
+                for (int b = BACKEND_EPOLL; b <= BACKEND_URING; b++) {
+
+                    options.channel_type = type;
+                    pool_start(&pool, num_workers, &options);
+                    int errors = run_stream(&pool, b, options.encoding, num_pairs, batch, &stats, &elapsed);
+                    pool_stop(&pool);
+
+                    if (errors == 0) {
+                        print_stream_result(b, type, num_workers, options.batch, num_pairs, &stats, elapsed);
+                    }
+                    else if (errors > 0) {
+                        printf("%d products were incorrect.\n", errors);
+                    }
+                }
+            }
+
+        }
+
+    }
+    else if (strcmp(mode, "-g") == 0) {  // Generate a random matrix file
+
+        if (argc != 5) {
+            print_pool_usage();
+            exit(0);
+        }
+
+        int rows = atoi(argv[2]);
+        int cols = atoi(argv[3]);
+        if (rows < 1 || cols < 1) {
+            printf("Matrix dimensions must be positive.\n");
+            exit(0);
+        }
+
+        double* data = malloc((size_t) rows * cols * sizeof(double));
+        uint32_t seed = 12345;
+        for (size_t i = 0; i < (size_t) rows * cols; i++) {
+            data[i] = (random_next(&seed) % 2001) / 1000.0 - 1.0;  // Uniform in [-1, 1]
+        }
+        write_matrix(argv[4], data, rows, cols);
+        free(data);
+
+    }
+    else if (strcmp(mode, "-m") == 0) {  // Multiply matrices from files
+
+        if (argc < 5) {
+            print_pool_usage();
+            exit(0);
+        }
+
+        int num_workers = parse_workers(argv[2]);
+        char* output = NULL;
+        int first_option = 5;
+        if (argc > 5 && argv[5][0] != '-') {
+            output = argv[5];
+            first_option = 6;
+        }
+        options.batch = 1;
+        parse_pool_options(argc, argv, first_option, &options);
+
+        /* Read both matrices into shared memory */
+        int inner_b;
+        matrix.a = read_matrix(argv[3], &matrix.rows, &matrix.inner);
+        matrix.b = read_matrix(argv[4], &inner_b, &matrix.cols);
+        if (inner_b != matrix.inner) {
+            printf("Cannot multiply a %dx%d matrix by a %dx%d matrix.\n", matrix.rows, matrix.inner, inner_b, matrix.cols);
+            exit(0);
+        }
+        matrix.c = shared_alloc((size_t) matrix.rows * matrix.cols * sizeof(double));
+        matrix.block_size = options.block_size;
+
+        pool_start(&pool, num_workers, &options);
+        int status = run_matrix(&pool, &options, &stats, &elapsed);
+        pool_stop(&pool);
+        if (status < 0) {
+            exit(0);
+        }
+
+        print_matrix_result("workers", &matrix, elapsed);
+        if (output != NULL) {
+            write_matrix(output, matrix.c, matrix.rows, matrix.cols);
+        }
+
+    }
+    else if (strcmp(mode, "-M") == 0) {  // Benchmark against a single-process baseline
+
+        if (argc < 4) {
+            print_pool_usage();
+            exit(0);
+        }
+
+        int max_workers = parse_workers(argv[2]);
+        int n = atoi(argv[3]);
+        if (n < 1) {
+            printf("Matrix size must be positive.\n");
+            exit(0);
+        }
+        options.batch = 1;
+        parse_pool_options(argc, argv, 4, &options);
+
+        /* Generate random n x n matrices in shared memory */
+        size_t size = (size_t) n * n;
+        matrix.rows = matrix.inner = matrix.cols = n;
+        matrix.block_size = options.block_size;
+        matrix.a = shared_alloc(size * sizeof(double));
+        matrix.b = shared_alloc(size * sizeof(double));
+        matrix.c = shared_alloc(size * sizeof(double));
+        uint32_t seed = 12345;
+        for (size_t i = 0; i < size; i++) {
+            matrix.a[i] = (random_next(&seed) % 2001) / 1000.0 - 1.0;
+            matrix.b[i] = (random_next(&seed) % 2001) / 1000.0 - 1.0;
+        }
+
+        /* Single-process blocked baseline */
+        double start = now_seconds();
+        multiply_blocked(&matrix);
+        print_matrix_result("baseline", &matrix, now_seconds() - start);
+
+        double* expected = malloc(size * sizeof(double));
+        memcpy(expected, matrix.c, size * sizeof(double));
+
+        /* Worker pools of increasing size */
+        for (int workers = 1; workers > 0; workers = next_worker_count(workers, max_workers)) {
+
+            memset(matrix.c, 0, size * sizeof(double));
+            pool_start(&pool, workers, &options);
+            int status = run_matrix(&pool, &options, &stats, &elapsed);
+            pool_stop(&pool);
+            if (status < 0) {
+                exit(0);
+            }
+
+            /* Results must match the baseline exactly, since each tile is
+             * accumulated in the same order */
+            int mismatches = 0;
+            for (size_t i = 0; i < size; i++) {
+                if (matrix.c[i] != expected[i]) {
+                    mismatches++;
+                }
+            }
+
+            char label[32];
+            snprintf(label, sizeof(label), "%d workers", workers);
+            print_matrix_result(label, &matrix, elapsed);
+            if (mismatches > 0) {
+                printf("%d elements differ from the baseline.\n", mismatches);
+            }
+        }
+
+        free(expected);
+
+    }
+    else if (strcmp(mode, "-y") == 0) {  // Multiply polynomials from files
+
+        if (argc < 5) {
+            print_pool_usage();
+            exit(0);
+        }
+
+        int num_workers = parse_workers(argv[2]);
+        char* output = NULL;
+        int first_option = 5;
+        if (argc > 5 && argv[5][0] != '-') {
+            output = argv[5];
+            first_option = 6;
+        }
+        options.batch = 1;
+        parse_pool_options(argc, argv, first_option, &options);
+
+        /* Read both polynomials into shared memory */
+        poly.a = read_poly(argv[3], &poly.length_a);
+        poly.b = read_poly(argv[4], &poly.length_b);
+        if (poly.length_a + poly.length_b - 1 > POLY_MAX_LENGTH) {
+            printf("Product degree must be less than %d.\n", POLY_MAX_LENGTH);
+            exit(0);
+        }
+        poly_setup(poly.length_a, poly.length_b, options.chunks > 0 ? options.chunks : num_workers);
+
+        int length = poly.length_a + poly.length_b - 1;
+        uint32_t* result = malloc(length * sizeof(uint32_t));
+
+        pool_start(&pool, num_workers, &options);
+        int status = run_poly(&pool, &options, &stats, result, &elapsed);
+        pool_stop(&pool);
+        if (status < 0) {
+            exit(0);
+        }
+
+        printf("degree %d * degree %d : %d chunks of %d (%s)  %8.4f s  %12.0f coefficients/sec\n",
+               poly.length_a - 1, poly.length_b - 1, poly.chunks_a * poly.chunks_b, poly.chunk,
+               poly_algorithm(poly.chunk, poly.chunk), elapsed, length / elapsed);
+
+        /* Write the product, one coefficient per line */
+        if (output != NULL) {
+            FILE* file_pointer = fopen(output, "w");
+            if (file_pointer == NULL) {  // Check for error opening file
+                printf("Unable to open file %s.", output);
+                exit(0);
+            }
+            for (int i = 0; i < length; i++) {
+                fprintf(file_pointer, "%u\n", result[i]);
+            }
+            fclose(file_pointer);
+        }
+
+        free(result);
+
+    }
+    else if (strcmp(mode, "-Y") == 0) {  // Benchmark scaling with the number of workers
+
+        if (argc < 4) {
+            print_pool_usage();
+            exit(0);
+        }
+
+        int max_workers = parse_workers(argv[2]);
+        int degree = atoi(argv[3]);
+        if (degree < 0 || 2 * degree + 1 > POLY_MAX_LENGTH) {
+            printf("Degree must be between 0 and %d.\n", POLY_MAX_LENGTH / 2 - 1);
+            exit(0);
+        }
+        options.batch = 1;
+        parse_pool_options(argc, argv, 4, &options);
+
+        /* Generate random polynomials in shared memory */
+        int n = degree + 1;
+        int length = 2 * n - 1;
+        poly.length_a = poly.length_b = n;
+        poly.a = shared_alloc(n * sizeof(uint32_t));
+        poly.b = shared_alloc(n * sizeof(uint32_t));
+        uint32_t seed = 12345;
+        for (int i = 0; i < n; i++) {
+            poly.a[i] = random_next(&seed) % POLY_MODULUS;
+            poly.b[i] = random_next(&seed) % POLY_MODULUS;
+        }
+
+        /* Single-process product of the whole polynomials */
+        uint32_t* expected = malloc(length * sizeof(uint32_t));
+        uint32_t* result = malloc(length * sizeof(uint32_t));
+        double start = now_seconds();
+        poly_multiply(poly.a, n, poly.b, n, expected);
+        elapsed = now_seconds() - start;
+        printf("%-12s : degree %d  %-10s  %8.4f s  %12.0f coefficients/sec\n",
+               "single", degree, poly_algorithm(n, n), elapsed, length / elapsed);
+
+        /* Worker pools of increasing size */
+        for (int workers = 1; workers > 0; workers = next_worker_count(workers, max_workers)) {
+
+            poly_setup(n, n, options.chunks > 0 ? options.chunks : workers);
+            pool_start(&pool, workers, &options);
+            int status = run_poly(&pool, &options, &stats, result, &elapsed);
+            pool_stop(&pool);
+            munmap(poly.slots, (size_t) poly.chunks_a * poly.chunks_b * 2 * poly.chunk * sizeof(uint32_t));
+            if (status < 0) {
+                exit(0);
+            }
+
+            char label[32];
+            snprintf(label, sizeof(label), "%d workers", workers);
+            printf("%-12s : degree %d  %-10s  %8.4f s  %12.0f coefficients/sec  (%d chunks of %d)\n",
+                   label, degree, poly_algorithm(poly.chunk, poly.chunk), elapsed, length / elapsed,
+                   poly.chunks_a * poly.chunks_b, poly.chunk);
+            if (memcmp(result, expected, length * sizeof(uint32_t)) != 0) {
+                printf("Product differs from the single-process result.\n");
+            }
+        }
+
+        free(expected);
+        free(result);
+
+    }
+    else {
+        print_pool_usage();
+    }
+
+    return 0;
+
+}
+
+
+/**
+ * Parses the options following the positional arguments of a worker pool
+ * mode. Options not given keep their default value. The default batch size
+ * must be set by the caller.
+ * 
+ * Parameters
+ * ----------
+ *   argc :     Number of command line arguments
+ *   argv :     Command line arguments
+ *   first :    Index of the first option
+ *   options :  Parsed options
+ */
+void parse_pool_options(int argc, char* argv[], int first, struct pool_options* options) {
+
+    options->backend = BACKEND_EPOLL;
+    options->channel_type = CHANNEL_PIPE;
+    options->block_size = 64;
+    options->chunks = 0;
+    options->num_cpus = 0;
+    options->encoding = 0;
+    options->depth = 4;
+    options->local_workers = 1;
+    options->remote_fraction = -1;
+
+    for (int i = first; i < argc; i++) {
+        if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "uring") == 0) {
+                options->backend = BACKEND_URING;
+            }
+            else if (strcmp(argv[i], "epoll") == 0) {
+                options->backend = BACKEND_EPOLL;
+            }
+            else {
+                printf("Invalid backend %s.\n", argv[i]);
+                exit(0);
+            }
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "socket") == 0) {
+                options->channel_type = CHANNEL_SOCKET;
+            }
+            else if (strcmp(argv[i], "pipe") == 0) {
+                options->channel_type = CHANNEL_PIPE;
+            }
+            else {
+                printf("Invalid channel type %s.\n", argv[i]);
+                exit(0);
+            }
+        }
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "varint") == 0) {
+                options->encoding = FRAME_VARINT;
+            }
+            else if (strcmp(argv[i], "fixed") == 0) {
+                options->encoding = 0;
+            }
+            else {
+                printf("Invalid encoding %s.\n", argv[i]);
+                exit(0);
+            }
+        }
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            options->batch = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            options->depth = atoi(argv[++i]);
+            if (options->depth < 1 || options->depth > MAX_DEPTH) {
+                printf("Depth must be between 1 and %d.\n", MAX_DEPTH);
+                exit(0);
+            }
+        }
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            options->local_workers = atoi(argv[++i]);
+            if (options->local_workers < 0 || options->local_workers > MAX_WORKERS) {
+                printf("Number of local workers must be between 0 and %d.\n", MAX_WORKERS);
+                exit(0);
+            }
+        }
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            options->remote_fraction = atof(argv[++i]);
+            if (options->remote_fraction < 0 || options->remote_fraction > 1) {
+                printf("Remote fraction must be between 0 and 1.\n");
+                exit(0);
+            }
+        }
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            options->block_size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            options->num_cpus = parse_cpu_list(argv[++i], options->cpus, MAX_WORKERS + 1);
+            if (options->num_cpus < 1) {
+                printf("Invalid CPU list %s.\n", argv[i]);
+                exit(0);
+            }
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            options->chunks = atoi(argv[++i]);
+            if (options->chunks < 1) {
+                printf("Number of chunks must be positive.\n");
+                exit(0);
+            }
+        }
+        else {
+            print_pool_usage();
+            exit(0);
+        }
+    }
+
+    /* Validate input */
+    if (options->batch < 1 || options->batch > MAX_BATCH) {
+        printf("Batch size must be between 1 and %d.\n", MAX_BATCH);
+        exit(0);
+    }
+    if (options->block_size < 1) {
+        printf("Block size must be positive.\n");
+        exit(0);
+    }
+
+    /* Pin the parent to the first CPU given */
+    if (options->num_cpus > 0 && pin_to_cpu(options->cpus[0]) < 0) {
+        printf("Unable to pin the parent to CPU %d.\n", options->cpus[0]);
+        exit(0);
+    }
+
+}
+
+
+/**
+ * Converts and validates the number of workers given on the command line.
+ * 
+ * Parameters
+ * ----------
+ *   arg : Command line argument
+ * 
+ * Returns
+ * -------
+ *   num_workers : Number of workers, between 1 and MAX_WORKERS
+ */
+int parse_workers(char* arg) {
+
+    int num_workers = atoi(arg);
+    if (num_workers < 1 || num_workers > MAX_WORKERS) {
+        printf("Number of workers must be between 1 and %d.\n", MAX_WORKERS);
+        exit(0);
+    }
+    return num_workers;
+
+}
+
+
+/**
+ * Steps through the pool sizes of the scaling benchmarks: 1, 2, 4, ... and
+ * finally max_workers, even if it is not a power of two.
+ * 
+ * Parameters
+ * ----------
+ *   workers :     Current number of workers
+ *   max_workers : Largest number of workers
+ * 
+ * Returns
+ * -------
+ *   next : Next number of workers, or 0 after max_workers
+ */
+int next_worker_count(int workers, int max_workers) {
+    if (workers >= max_workers) {
+        return 0;
+    }
+    return workers * 2 > max_workers ? max_workers : workers * 2;
+}
+
+
+/**
+ * Prints the usage of the worker pool modes.
+ */
+void print_pool_usage(void) {
+    printf("Usage: multiply <a> <b>\n");
+    printf("       multiply -p <workers> <pairs> [-e epoll|uring] [-t pipe|socket] [-n batch] [-w fixed|varint]\n");
+    printf("       multiply -b <workers> <pairs> [-n batch] [-w fixed|varint]\n");
+    printf("       multiply -W <workers> <pairs> [-e epoll|uring] [-t pipe|socket] [-n batch]\n");
+    printf("       multiply -g <rows> <cols> <file>\n");
+    printf("       multiply -m <workers> <A> <B> [C] [-e epoll|uring] [-t pipe|socket] [-n batch] [-k block]\n");
+    printf("       multiply -M <workers> <n> [-e epoll|uring] [-t pipe|socket] [-n batch] [-k block]\n");
+    printf("       multiply -y <workers> <A> <B> [C] [-e epoll|uring] [-t pipe|socket] [-n batch] [-c chunks]\n");
+    printf("       multiply -Y <workers> <degree> [-e epoll|uring] [-t pipe|socket] [-n batch] [-c chunks]\n");
+    printf("       multiply -q <workers> <pairs>\n");
+    printf("       multiply -Q <workers> <pairs>\n");
+    printf("       multiply -s <port> [connections] [host]\n");
+    printf("       multiply -r <host:port,...> <pairs> [-l local] [-d depth] [-n batch] [-w fixed|varint] [-f fraction]\n");
+    printf("       multiply -R <servers> <pairs> [-l local] [-d depth] [-n batch] [-w fixed|varint] [-f fraction]\n");
+    printf("       multiply -E <workers> <exponent bits> [-e epoll|uring] [-t pipe|socket] [-c chunks]\n");
+    printf("       multiply -T <workers> <factors> <bits> [-e epoll|uring] [-t pipe|socket] [-c chunks]\n");
+    printf("       multiply -A <round trips> [-t pipe|socket]\n");
+    printf("Every pool mode also accepts -a <parent cpu>,<worker cpu>,... to pin each process.\n");
+}
+
+
+/**
+ * Returns the current time in seconds from a monotonic clock.
+ */
+double now_seconds(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+
+/**
+ * Generates the next value of a xorshift pseudo-random sequence.
+ * 
+ * Parameters
+ * ----------
+ *   state : Generator state, updated in place. Must not be zero.
+ * 
+ * Returns
+ * -------
+ *   value : Next pseudo-random value
+ */
+uint32_t random_next(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+
+/**
+ * Partitions two four-digit integers into 2-digit components, and stores the
+ * four pairs of components whose products are required, in the order A, B, C,
+ * D used by recombine.
+ * 
+ * Parameters
+ * ----------
+ *   a, b :   Integers to multiply
+ *   tasks :  Array of 8 operands, written as 4 consecutive pairs
+ */
+void decompose(int a, int b, int32_t* tasks) {
+
+    int a1 = a / 100, a2 = a % 100;
+    int b1 = b / 100, b2 = b % 100;
+
+    tasks[0] = a1; tasks[1] = b1;  // A = a1*b1
+    tasks[2] = a1; tasks[3] = b2;  // B = a1*b2
+    tasks[4] = a2; tasks[5] = b1;  // C = a2*b1
+    tasks[6] = a2; tasks[7] = b2;  // D = a2*b2
+
+}
+
+
+/**
+ * Sums the intermediate values X, Y, Z computed from the four products of a
+ * decomposed multiplication.
+ * 
+ * Parameters
+ * ----------
+ *   products : Products A, B, C, D in the order produced by decompose
+ * 
+ * Returns
+ * -------
+ *   result : X + Y + Z
+ */
+int recombine(int32_t* products) {
+    int X = products[0] * 10000;
+    int Y = (products[1] + products[2]) * 100;
+    int Z = products[3];
+    return X + Y + Z;
+}
+
+
+/**
+ * Writes a full buffer to a file descriptor, retrying after partial writes.
+ * 
+ * Parameters
+ * ----------
+ *   fd :      File descriptor to write to
+ *   data :    Bytes to write
+ *   length :  Number of bytes to write
+ * 
+ * Returns
+ * -------
+ *   calls : Number of write calls made, or -1 if the write failed
+ */
+int write_full(int fd, const void* data, size_t length) {
+
+    const char* bytes = data;
+    int calls = 0;
+
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        calls++;
+        if (written <= 0) {
+            return -1;
+        }
+        bytes += written;
+        length -= written;
+    }
+
+    return calls;
+
+}
+
+
+/**
+ * Reads a full buffer from a file descriptor, retrying after partial reads.
+ * 
+ * Parameters
+ * ----------
+ *   fd :      File descriptor to read from
+ *   data :    Buffer to store the bytes read
+ *   length :  Number of bytes to read
+ * 
+ * Returns
+ * -------
+ *   calls : Number of read calls made, or -1 if the end of the file was
+ *           reached or the read failed
+ */
+int read_full(int fd, void* data, size_t length) {
+
+    char* bytes = data;
+    int calls = 0;
+
+    while (length > 0) {
+        ssize_t got = read(fd, bytes, length);
+        calls++;
+        if (got <= 0) {
+            return -1;
+        }
+        bytes += got;
+        length -= got;
+    }
+
+    return calls;
+
+}
+
+
+/**
+ * Encodes values as unsigned LEB128 varints: 7 bits per byte, least
+ * significant group first, with the high bit set on every byte but the last.
+ * 
+ * Parameters
+ * ----------
+ *   values :  Values to encode, treated as unsigned
+ *   count :   Number of values
+ *   out :     Encoded bytes, at most VARINT_MAX_BYTES per value
+ * 
+ * Returns
+ * -------
+ *   length : Number of bytes written
+ */
+size_t varint_encode(const int32_t* values, int count, uint8_t* out) {
+
+    uint8_t* position = out;
+
+    for (int i = 0; i < count; i++) {
+        uint32_t value = values[i];
+        while (value >= 0x80) {
+            *position++ = (value & 0x7F) | 0x80;
+            value >>= 7;
+        }
+        *position++ = value;
+    }
+
+    return position - out;
+
+}
+
+
+/**
+ * Decodes LEB128 varints one byte at a time.
+ * 
+ * Parameters
+ * ----------
+ *   in :      Encoded bytes
+ *   length :  Number of encoded bytes
+ *   values :  Decoded values
+ *   count :   Number of values to decode
+ * 
+ * Returns
+ * -------
+ *   used : Number of bytes decoded, or -1 if the input is truncated or
+ *          contains a varint longer than VARINT_MAX_BYTES
+ */
+long varint_decode_scalar(const uint8_t* in, size_t length, int32_t* values, int count) {
+
+    size_t position = 0;
+
+    for (int i = 0; i < count; i++) {
+        uint32_t value = 0;
+        int shift = 0;
+        uint8_t byte;
+        do {
+            if (position == length || shift >= 7 * VARINT_MAX_BYTES) {
+                return -1;
+            }
+            byte = in[position++];
+            value |= (uint32_t) (byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        values[i] = value;
+    }
+
+    return position;
+
+}
+
+
+/**
+ * Decodes LEB128 varints, using SSE2 for runs of 16 bytes in which every
+ * value is one byte long, or every value is two bytes long. Operands in the
+ * stream are 2-digit components, which always fit in one byte, and most
+ * of their products fit in two. Any other pattern is decoded one value at a
+ * time before trying the fast paths again.
+ * 
+ * Parameters
+ * ----------
+ *   in :      Encoded bytes
+ *   length :  Number of encoded bytes
+ *   values :  Decoded values
+ *   count :   Number of values to decode
+ * 
+ * Returns
+ * -------
+ *   used : Number of bytes decoded, or -1 if the input is invalid
+ */
+long varint_decode(const uint8_t* in, size_t length, int32_t* values, int count) {
+
+    size_t position = 0;
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low_bits = _mm_set1_epi16(0x007F);
+    const __m128i high_bits = _mm_set1_epi16(0x7F00);
+
+    while (position + 16 <= length && i + 16 <= count) {
+
+        __m128i bytes = _mm_loadu_si128((const __m128i*) (in + position));
+        int continuation = _mm_movemask_epi8(bytes);  // High bit of each byte
+
+        if (continuation == 0) {  // 16 one-byte values
+            __m128i words_low = _mm_unpacklo_epi8(bytes, zero);
+            __m128i words_high = _mm_unpackhi_epi8(bytes, zero);
+            _mm_storeu_si128((__m128i*) &values[i], _mm_unpacklo_epi16(words_low, zero));
+            _mm_storeu_si128((__m128i*) &values[i + 4], _mm_unpackhi_epi16(words_low, zero));
+            _mm_storeu_si128((__m128i*) &values[i + 8], _mm_unpacklo_epi16(words_high, zero));
+            _mm_storeu_si128((__m128i*) &values[i + 12], _mm_unpackhi_epi16(words_high, zero));
+            position += 16;
+            i += 16;
+        }
+        else if (continuation == 0x5555) {  // 8 two-byte values
+            /* Each 16-bit lane holds low 7 bits in its first byte and the
+             * next 7 bits in its second byte */
+            __m128i words = _mm_or_si128(_mm_and_si128(bytes, low_bits),
+                                         _mm_srli_epi16(_mm_and_si128(bytes, high_bits), 1));
+            _mm_storeu_si128((__m128i*) &values[i], _mm_unpacklo_epi16(words, zero));
+            _mm_storeu_si128((__m128i*) &values[i + 4], _mm_unpackhi_epi16(words, zero));
+            position += 16;
+            i += 8;
+        }
+        else {  // Mixed lengths: decode a single value
+            long used = varint_decode_scalar(in + position, length - position, &values[i], 1);
+            if (used < 0) {
+                return -1;
+            }
+            position += used;
+            i++;
+        }
+    }
+#endif
+
+    /* Remaining values */
+    long used = varint_decode_scalar(in + position, length - position, &values[i], count - i);
+    return used < 0 ? -1 : (long) position + used;
+
+}
+
+
+/**
+ * Writes a frame header and payload, encoding the values as 4-byte words or
+ * varints depending on the frame type.
+ * 
+ * Parameters
+ * ----------
+ *   type :    Frame type, optionally including FRAME_VARINT
+ *   values :  Items of the payload
+ *   count :   Number of items
+ *   frame :   Buffer for the frame
+ * 
+ * Returns
+ * -------
+ *   length : Number of bytes in the frame, including the header
+ */
+size_t encode_payload(uint32_t type, const int32_t* values, int count, char* frame) {
+
+    struct frame_header* header = (struct frame_header*) frame;
+    char* payload = frame + sizeof(*header);
+
+    header->type = type;
+    header->count = count;
+    if (type & FRAME_VARINT) {
+        header->length = varint_encode(values, count, (uint8_t*) payload);
+    }
+    else {
+        header->length = count * sizeof(int32_t);
+        memcpy(payload, values, header->length);
+    }
+
+    return sizeof(*header) + header->length;
+
+}
+
+
+/**
+ * Decodes the payload of a frame into 4-byte values.
+ * 
+ * Parameters
+ * ----------
+ *   frame :   Frame with a complete header and payload
+ *   values :  Decoded items
+ * 
+ * Returns
+ * -------
+ *   count : Number of items decoded, or -1 if the payload is invalid
+ */
+int decode_payload(const char* frame, int32_t* values) {
+
+    const struct frame_header* header = (const struct frame_header*) frame;
+    const char* payload = frame + sizeof(*header);
+
+    if (header->type & FRAME_VARINT) {
+        if (varint_decode((const uint8_t*) payload, header->length, values, header->count) != header->length) {
+            return -1;
+        }
+    }
+    else {
+        if (header->length != header->count * sizeof(int32_t)) {
+            return -1;
+        }
+        memcpy(values, payload, header->length);
+    }
+
+    return header->count;
+
+}
+
+
+/**
+ * Determines whether a reply has been recieved in full, setting its length
+ * once the header has arrived.
+ * 
+ * Parameters
+ * ----------
+ *   reply : Reply being recieved
+ * 
+ * Returns
+ * -------
+ *   complete : 1 if every byte of the frame has been recieved, 0 if not
+ */
+int reply_complete(struct frame_buffer* reply) {
+
+    if (reply->length == 0 && reply->done >= sizeof(struct frame_header)) {
+        struct frame_header* header = (struct frame_header*) reply->data;
+        reply->length = sizeof(*header) + header->length;
+        if (reply->length > reply->capacity) {
+            printf("Reply frame is larger than expected.");
+            exit(0);
+        }
+    }
+
+    return reply->length > 0 && reply->done >= reply->length;
+
+}
+
+
+/**
+ * Main loop of a worker process. Recieves frames of operand pairs, computes
+ * the result of each pair, and sends them back in a single frame until a stop
+ * frame is recieved or the parent closes the channel. Workers serving remote
+ * parents only accept FRAME_PAIRS, since the other frame types refer to
+ * shared memory that a remote parent never set up, and close the connection
+ * on any other type.
+ * 
+ * Parameters
+ * ----------
+ *   read_fd :     File descriptor requests are read from
+ *   write_fd :    File descriptor replies are written to
+ *   pairs_only :  1 to accept only FRAME_PAIRS, 0 to accept every type
+ */
+void worker_loop(int read_fd, int write_fd, int pairs_only) {
+
+    size_t capacity = sizeof(struct frame_header) + 2 * MAX_BATCH * VARINT_MAX_BYTES;
+    char* request = malloc(capacity);
+    char* reply = malloc(capacity);
+    int32_t* operands = malloc(2 * MAX_BATCH * sizeof(int32_t));
+    int32_t* results = malloc(MAX_BATCH * sizeof(int32_t));
+    struct frame_header* header = (struct frame_header*) request;
+
+    while (read_full(read_fd, header, sizeof(*header)) > 0) {
+
+        uint32_t type = header->type & ~FRAME_VARINT;
+        if (type == FRAME_STOP || (pairs_only && type != FRAME_PAIRS) || header->count > MAX_BATCH ||
+            header->length > capacity - sizeof(*header)) {
+            break;
+        }
+
+        if (read_full(read_fd, request + sizeof(*header), header->length) < 0) {
+            break;
+        }
+
+        /* Decode operands from the payload */
+        header->count *= 2;  // Payload holds two operands per pair
+        int num_operands = decode_payload(request, operands);
+        if (num_operands < 0) {  // Checked before halving, which would round -1 to 0
+            break;
+        }
+        int pairs = num_operands / 2;
+
+        /* Compute the result of each recieved pair */
+        for (int i = 0; i < pairs; i++) {
+            results[i] = worker_compute(type, operands[2*i], operands[2*i + 1]);
+        }
+
+        /* Send all results back in a single frame, in the request's encoding */
+        size_t length = encode_payload(FRAME_PRODUCTS | (header->type & FRAME_VARINT), results, pairs, reply);
+        if (write_full(write_fd, reply, length) < 0) {
+            break;
+        }
+    }
+
+    free(request);
+    free(reply);
+    free(operands);
+    free(results);
+
+}
+
+
+/**
+ * Forks a pool of worker processes, each connected to the parent by its own
+ * channel, and registers every channel with an epoll instance. Workers are
+ * pinned to the CPUs given in the options, if any.
+ * 
+ * Parameters
+ * ----------
+ *   pool :         Pool to initialize
+ *   num_workers :  Number of worker processes to fork
+ *   options :      Channel type and CPU placement
+ */
+void pool_start(struct worker_pool* pool, int num_workers, struct pool_options* options) {
+
+    int channel_type = options->channel_type;
+    pool->num_workers = num_workers;
+    pool->channel_type = channel_type;
+    pool->buffer_batch = 0;
+    pool->ring_ready = 0;
+    pool->epoll_fd = epoll_create1(0);
+    if (pool->epoll_fd < 0) {
+        printf("Error creating epoll instance.");
+        exit(0);
+    }
+
+    fflush(stdout);  // Do not duplicate buffered output in the children
+
+    for (int w = 0; w < num_workers; w++) {
+
+        int parent_fds[2];  // Read and write ends kept by the parent
+        int child_fds[2];   // Read and write ends kept by the worker
+
+        /* Establish the channel */
+        if (channel_type == CHANNEL_SOCKET) {
+            int sv[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+                printf("Error creating socket pair.");
+                exit(0);
+            }
+            parent_fds[0] = parent_fds[1] = sv[0];
+            child_fds[0] = child_fds[1] = sv[1];
+        }
+        else {
+            int parent_to_child[2];   // Parent writes, child reads
+            int child_to_parent[2];   // Child writes, parent reads
+            if (pipe(parent_to_child) < 0 || pipe(child_to_parent) < 0) {
+                printf("Error creating pipe.");
+                exit(0);
+            }
+            parent_fds[0] = child_to_parent[0];
+            parent_fds[1] = parent_to_child[1];
+            child_fds[0] = parent_to_child[0];
+            child_fds[1] = child_to_parent[1];
+        }
+
+        /* Fork the worker process */
+        pid_t pid = fork();
+        if (pid < 0) {
+            printf("Error forking child process.");
+            exit(0);
+        }
+
+        if (pid == 0) {  // Worker process
+
+            /* Close the parent's ends of every channel */
+            for (int i = 0; i < w; i++) {
+                close(pool->channels[i].read_fd);
+                if (pool->channels[i].write_fd != pool->channels[i].read_fd) {
+                    close(pool->channels[i].write_fd);
+                }
+            }
+            close(parent_fds[0]);
+            if (parent_fds[1] != parent_fds[0]) {
+                close(parent_fds[1]);
+            }
+            close(pool->epoll_fd);
+
+            int cpu = worker_cpu(options, w);
+            if (cpu >= 0 && pin_to_cpu(cpu) < 0) {
+                printf("Unable to pin worker %d to CPU %d.\n", w, cpu);
+                _exit(0);
+            }
+
+            worker_loop(child_fds[0], child_fds[1], 0);
+            _exit(0);
+
+        }
+
+        /* Parent process keeps its own ends of the channel */
+        close(child_fds[0]);
+        if (child_fds[1] != child_fds[0]) {
+            close(child_fds[1]);
+        }
+        pool->pids[w] = pid;
+        pool->channels[w].read_fd = parent_fds[0];
+        pool->channels[w].write_fd = parent_fds[1];
+
+        struct epoll_event event = { .events = EPOLLIN, .data.u32 = w };
+        epoll_ctl(pool->epoll_fd, EPOLL_CTL_ADD, parent_fds[0], &event);
+
+    }
+
+}
+
+
+/**
+ * Returns the CPU a worker should be pinned to.
+ * 
+ * Parameters
+ * ----------
+ *   options :  CPU list given with -a
+ *   w :        Index of the worker
+ * 
+ * Returns
+ * -------
+ *   cpu : CPU number, or -1 if the worker should not be pinned
+ */
+int worker_cpu(struct pool_options* options, int w) {
+
+    if (options->num_cpus == 0) {
+        return -1;
+    }
+    if (options->num_cpus == 1) {  // Everything shares the parent's CPU
+        return options->cpus[0];
+    }
+    return options->cpus[1 + w % (options->num_cpus - 1)];
+
+}
+
+
+/**
+ * Restricts the calling process to a single CPU.
+ * 
+ * Parameters
+ * ----------
+ *   cpu : CPU number
+ * 
+ * Returns
+ * -------
+ *   status : 0 on success, -1 on failure
+ */
+int pin_to_cpu(int cpu) {
+
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return -1;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+
+}
+
+
+/**
+ * Sends every worker in a pool a stop frame, waits for them to exit, and
+ * closes their channels and frees the resources used to dispatch tasks.
+ * 
+ * Parameters
+ * ----------
+ *   pool : Pool to stop
+ */
+void pool_stop(struct worker_pool* pool) {
+
+    struct frame_header stop = { FRAME_STOP, 0, 0 };
+
+    for (int w = 0; w < pool->num_workers; w++) {
+        write_full(pool->channels[w].write_fd, &stop, sizeof(stop));
+        close(pool->channels[w].write_fd);
+        if (pool->channels[w].read_fd != pool->channels[w].write_fd) {
+            close(pool->channels[w].read_fd);
+        }
+    }
+
+    for (int w = 0; w < pool->num_workers; w++) {
+        waitpid(pool->pids[w], NULL, 0);
+    }
+
+    /* Free the buffers and ring kept between dispatches */
+    if (pool->buffer_batch > 0) {
+        for (int w = 0; w < pool->num_workers; w++) {
+            free(pool->requests[w].data);
+            free(pool->replies[w].data);
+        }
+    }
+    if (pool->ring_ready) {
+        uring_free(&pool->ring);
+    }
+    close(pool->epoll_fd);
+
+}
+
+
+/**
+ * Sends one request frame to each active worker and recieves one reply frame
+ * from each, using a write per channel and epoll_wait + read for replies.
+ * 
+ * Parameters
+ * ----------
+ *   pool :      Pool of workers
+ *   requests :  Frame to send to each worker
+ *   replies :   Buffer for the reply from each worker. Lengths must be set.
+ *   active :    Number of workers, starting from the first, taking part
+ *   stats :     Counters updated with the system calls made
+ */
+void exchange_epoll(struct worker_pool* pool, struct frame_buffer* requests, struct frame_buffer* replies, int active, struct io_stats* stats) {
+
+    /* Send each worker its frame */
+    for (int w = 0; w < active; w++) {
+        int calls = write_full(pool->channels[w].write_fd, requests[w].data, requests[w].length);
+        if (calls < 0) {
+            printf("Error sending frame to worker %d.", w);
+            exit(0);
+        }
+        stats->syscalls += calls;
+        replies[w].done = 0;
+        replies[w].length = 0;
+    }
+
+    /* Read replies as channels become readable */
+    struct epoll_event events[MAX_WORKERS];
+    int remaining = active;
+    while (remaining > 0) {
+
+        int ready = epoll_wait(pool->epoll_fd, events, MAX_WORKERS, -1);
+        stats->syscalls++;
+        if (ready < 0) {
+            printf("Error waiting for replies.");
+            exit(0);
+        }
+
+        for (int i = 0; i < ready; i++) {
+
+            int w = events[i].data.u32;
+            struct frame_buffer* reply = &replies[w];
+            if (w >= active || reply_complete(reply)) {
+                continue;
+            }
+
+            ssize_t got = read(pool->channels[w].read_fd, reply->data + reply->done, reply->capacity - reply->done);
+            stats->syscalls++;
+            if (got <= 0) {
+                printf("Error recieving frame from worker %d.", w);
+                exit(0);
+            }
+
+            reply->done += got;
+            if (reply_complete(reply)) {
+                remaining--;
+            }
+        }
+    }
+
+    stats->frames += 2 * active;
+    stats->rounds++;
+
+}
+
+
+/**
+ * Sets up an io_uring instance using the raw system calls and maps its
+ * submission and completion rings.
+ * 
+ * Parameters
+ * ----------
+ *   ring :     Instance to initialize
+ *   entries :  Number of submission queue entries
+ * 
+ * Returns
+ * -------
+ *   status : 0 on success, -1 if io_uring is unavailable
+ */
+int uring_init(struct uring* ring, unsigned entries) {
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+    ring->entries = params.sq_entries;
+
+    /* Map the submission ring, completion ring, and submission entries */
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+
+    char* sq = ring->sq_ring;
+    char* cq = ring->cq_ring;
+    ring->sq_head = (unsigned*) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*) (sq + params.sq_off.array);
+    ring->cq_head = (unsigned*) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+    return 0;
+
+}
+
+
+/**
+ * Unmaps the rings of an io_uring instance and closes it.
+ * 
+ * Parameters
+ * ----------
+ *   ring : Instance to free
+ */
+void uring_free(struct uring* ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+
+/**
+ * Queues a read or write in the submission ring. The entry is not submitted
+ * to the kernel until the next io_uring_enter.
+ * 
+ * Parameters
+ * ----------
+ *   ring :       io_uring instance
+ *   opcode :     IORING_OP_READ or IORING_OP_WRITE
+ *   fd :         File descriptor to read from or write to
+ *   data :       Buffer to transfer
+ *   length :     Number of bytes to transfer
+ *   user_data :  Value returned with the completion
+ */
+void uring_queue(struct uring* ring, int opcode, int fd, void* data, size_t length, uint64_t user_data) {
+
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) data;
+    sqe->len = length;
+    sqe->off = (uint64_t) -1;  // Use the current file position, required for pipes and sockets
+    sqe->user_data = user_data;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);  // Publish the entry to the kernel
+    ring->to_submit++;
+
+}
+
+
+/**
+ * Sends one request frame to each active worker and recieves one reply frame
+ * from each. The reads and writes for every channel are submitted to the
+ * kernel together, so a round normally takes a single system call. Partial
+ * transfers are resubmitted for the remaining bytes.
+ * 
+ * Parameters
+ * ----------
+ *   ring :      io_uring instance with at least 2*active entries
+ *   pool :      Pool of workers
+ *   requests :  Frame to send to each worker
+ *   replies :   Buffer for the reply from each worker. Lengths must be set.
+ *   active :    Number of workers, starting from the first, taking part
+ *   stats :     Counters updated with the system calls made
+ */
+void exchange_uring(struct uring* ring, struct worker_pool* pool, struct frame_buffer* requests, struct frame_buffer* replies, int active, struct io_stats* stats) {
+
+    /* Queue the write and read for every channel. Bit 0 of the user data
+     * selects the request (0) or reply (1) of worker user_data / 2. */
+    for (int w = 0; w < active; w++) {
+        requests[w].done = 0;
+        replies[w].done = 0;
+        replies[w].length = 0;
+        uring_queue(ring, IORING_OP_WRITE, pool->channels[w].write_fd, requests[w].data, requests[w].length, 2*w);
+        uring_queue(ring, IORING_OP_READ, pool->channels[w].read_fd, replies[w].data, replies[w].capacity, 2*w + 1);
+    }
+
+    unsigned in_flight = 2 * active;
+    while (in_flight > 0) {
+
+        /* Submit everything queued and wait for all of it to complete */
+        int submitted = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, in_flight, IORING_ENTER_GETEVENTS, NULL, 0);
+        stats->syscalls++;
+        if (submitted < 0) {
+            printf("Error submitting to io_uring.");
+            exit(0);
+        }
+        ring->to_submit -= submitted;
+
+        /* Reap completions */
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+
+            struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+            int w = cqe->user_data / 2;
+            int is_reply = cqe->user_data % 2;
+            struct frame_buffer* frame = is_reply ? &replies[w] : &requests[w];
+
+            if (cqe->res <= 0) {
+                printf("Error %s frame for worker %d.", is_reply ? "recieving" : "sending", w);
+                exit(0);
+            }
+
+            frame->done += cqe->res;
+            in_flight--;
+            head++;
+
+            /* Resubmit the remainder of a partial transfer */
+            if (is_reply ? !reply_complete(frame) : frame->done < frame->length) {
+                if (is_reply) {
+                    uring_queue(ring, IORING_OP_READ, pool->channels[w].read_fd, frame->data + frame->done, frame->capacity - frame->done, cqe->user_data);
+                }
+                else {
+                    uring_queue(ring, IORING_OP_WRITE, pool->channels[w].write_fd, frame->data + frame->done, frame->length - frame->done, cqe->user_data);
+                }
+                in_flight++;
+            }
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    stats->frames += 2 * active;
+    stats->rounds++;
+
+}
+
+
+/**
+ * Sends tasks to the workers of a pool in batches and collects one 4-byte
+ * result per task. Each round sends one frame to every worker that has work.
+ * The frame buffers and io_uring instance are set up by the first call and
+ * reused by later ones, so that short dispatches such as the chunk products
+ * of a single big-number multiplication do not pay for them every time.
+ * 
+ * Parameters
+ * ----------
+ *   pool :       Pool of workers
+ *   backend :    BACKEND_EPOLL or BACKEND_URING
+ *   type :       Frame type of the requests, selecting the work done
+ *   operands :   Pair of operands for each task
+ *   num_tasks :  Number of tasks
+ *   batch :      Maximum number of tasks in a frame
+ *   results :    Result of each task
+ *   stats :      Counters updated with the I/O performed
+ * 
+ * Returns
+ * -------
+ *   status : 0 on success, or -1 if the backend is unavailable
+ */
+int dispatch_tasks(struct worker_pool* pool, int backend, uint32_t type, int32_t* operands, int num_tasks, int batch, int32_t* results, struct io_stats* stats) {
+
+    if (backend == BACKEND_URING && !pool->ring_ready) {
+        if (uring_init(&pool->ring, 2 * MAX_WORKERS) < 0) {
+            printf("io_uring is unavailable on this system.\n");
+            return -1;
+        }
+        pool->ring_ready = 1;
+    }
+
+    /* Grow the request and reply frames of each worker if the batch does not fit */
+    struct frame_buffer* requests = pool->requests;
+    struct frame_buffer* replies = pool->replies;
+    int first_task[MAX_WORKERS];  // Index of the first task sent to each worker this round
+    if (batch > pool->buffer_batch) {
+        for (int w = 0; w < pool->num_workers; w++) {
+            requests[w].capacity = sizeof(struct frame_header) + 2 * batch * VARINT_MAX_BYTES;
+            replies[w].capacity = sizeof(struct frame_header) + batch * VARINT_MAX_BYTES;
+            requests[w].data = realloc(pool->buffer_batch > 0 ? requests[w].data : NULL, requests[w].capacity);
+            replies[w].data = realloc(pool->buffer_batch > 0 ? replies[w].data : NULL, replies[w].capacity);
+        }
+        pool->buffer_batch = batch;
+    }
+
+    int next = 0;  // Next task to send
+    while (next < num_tasks) {
+
+        /* Fill one frame per worker until all tasks are assigned */
+        int active = 0;
+        while (active < pool->num_workers && next < num_tasks) {
+
+            int count = num_tasks - next < batch ? num_tasks - next : batch;
+            requests[active].length = encode_payload(type, &operands[2*next], 2 * count, requests[active].data);
+
+            /* Requests carry two operands per task, counted as one */
+            ((struct frame_header*) requests[active].data)->count = count;
+
+            first_task[active] = next;
+            next += count;
+            active++;
+        }
+
+        if (backend == BACKEND_URING) {
+            exchange_uring(&pool->ring, pool, requests, replies, active, stats);
+        }
+        else {
+            exchange_epoll(pool, requests, replies, active, stats);
+        }
+
+        /* Collect the results from each reply */
+        for (int w = 0; w < active; w++) {
+            stats->bytes += requests[w].length + replies[w].length;
+            if (decode_payload(replies[w].data, &results[first_task[w]]) < 0) {
+                printf("Invalid reply from worker %d.", w);
+                exit(0);
+            }
+        }
+    }
+
+    return 0;
+
+}
+
+
+/**
+ * Computes the result of a single task in a worker process.
+ * 
+ * Parameters
+ * ----------
+ *   type :  Frame type the task was recieved in
+ *   x, y :  Operands of the task
+ * 
+ * Returns
+ * -------
+ *   result : Result sent back to the parent
+ */
+int32_t worker_compute(uint32_t type, int32_t x, int32_t y) {
+
+    switch (type) {
+        case FRAME_BLOCKS:  // Tile (x, y) of C is written to shared memory
+            multiply_block(&matrix, x, y);
+            return 0;
+        case FRAME_POLY:  // Product of chunks (x, y) is written to its slot in shared memory
+            poly_multiply_chunks(&poly, x, y);
+            return 0;
+        case FRAME_BIGNUM:  // Product of chunks (x, y) is written to its slot in shared memory
+            bn_multiply_chunks(&bignum, x, y);
+            return 0;
+        default:  // FRAME_PAIRS, wrapping modulo 2^32 like the reply's 32-bit words
+            return (int32_t) ((uint32_t) x * (uint32_t) y);
+    }
+
+}
+
+
+/**
+ * Streams random four-digit multiplications through a worker pool. Each
+ * multiplication is decomposed into four products, which are sent to the
+ * workers in batches. The parent then recombines the products and verifies
+ * every result.
+ * 
+ * Parameters
+ * ----------
+ *   pool :       Pool of workers
+ *   backend :    BACKEND_EPOLL or BACKEND_URING
+ *   encoding :   0 for 4-byte words, or FRAME_VARINT
+ *   num_pairs :  Number of multiplications to compute
+ *   batch :      Maximum number of products in a frame
+ *   stats :      Counters, reset and then updated with the I/O performed
+ *   elapsed :    Set to the time taken to stream all products, in seconds
+ * 
+ * Returns
+ * -------
+ *   errors : Number of incorrect results, or -1 if the backend is unavailable
+ */
+int run_stream(struct worker_pool* pool, int backend, uint32_t encoding, int num_pairs, int batch, struct io_stats* stats, double* elapsed) {
+
+    memset(stats, 0, sizeof(*stats));
+    int num_tasks = 4 * num_pairs;
+
+    /* Generate operands and decompose each multiplication */
+    int32_t* values = malloc(2 * num_pairs * sizeof(int32_t));
+    int32_t* operands = malloc(2 * num_tasks * sizeof(int32_t));
+    int32_t* products = malloc(num_tasks * sizeof(int32_t));
+    uint32_t seed = 12345;
+    for (int i = 0; i < num_pairs; i++) {
+        values[2*i] = 1000 + random_next(&seed) % 9000;
+        values[2*i + 1] = 1000 + random_next(&seed) % 9000;
+        decompose(values[2*i], values[2*i + 1], &operands[8*i]);
+    }
+
+    double start = now_seconds();
+    int status = dispatch_tasks(pool, backend, FRAME_PAIRS | encoding, operands, num_tasks, batch, products, stats);
+    *elapsed = now_seconds() - start;
+
+    /* Verify each result */
+    int errors = 0;
+    for (int i = 0; i < num_pairs; i++) {
+        if (recombine(&products[4*i]) != values[2*i] * values[2*i + 1]) {
+            errors++;
+        }
+    }
+
+    /* Free dynamically allocated memory */
+    free(values);
+    free(operands);
+    free(products);
+
+    return status < 0 ? -1 : errors;
+
+}
+
+
+/**
+ * Prints the system calls and throughput of a stream.
+ * 
+ * Parameters
+ * ----------
+ *   backend :       Backend used by the stream
+ *   channel_type :  Channel type used by the pool
+ *   num_workers :   Number of workers in the pool
+ *   batch :         Number of multiplications per frame
+ *   num_pairs :     Number of multiplications computed
+ *   stats :         I/O performed by the stream
+ *   elapsed :       Time taken by the stream, in seconds
+ */
+void print_stream_result(int backend, int channel_type, int num_workers, int batch, int num_pairs, struct io_stats* stats, double elapsed) {
+
+    printf("%-5s %-6s : workers %2d  batch %4d  %10.0f pairs/sec  %6.2f syscalls/round  %5.2f syscalls/frame\n",
+           backend == BACKEND_URING ? "uring" : "epoll",
+           channel_type == CHANNEL_SOCKET ? "socket" : "pipe",
+           num_workers, batch, num_pairs / elapsed,
+           (double) stats->syscalls / stats->rounds,
+           (double) stats->syscalls / stats->frames);
+
+}
+
+
+
+/**
+ * Allocates memory shared with worker processes forked afterwards.
+ * 
+ * Parameters
+ * ----------
+ *   size : Number of bytes to allocate
+ * 
+ * Returns
+ * -------
+ *   memory : Zero-initialized shared memory
+ */
+void* shared_alloc(size_t size) {
+
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        printf("Error allocating shared memory.");
+        exit(0);
+    }
+    return memory;
+
+}
+
+
+/**
+ * Reads a dense matrix from a binary file into shared memory.
+ * 
+ * Parameters
+ * ----------
+ *   filename :  Path to the matrix file
+ *   rows :      Set to the number of rows
+ *   cols :      Set to the number of columns
+ * 
+ * Returns
+ * -------
+ *   data : Elements of the matrix in row-major order
+ */
+double* read_matrix(char* filename, int* rows, int* cols) {
+
+    FILE* file_pointer = fopen(filename, "rb");
+    if (file_pointer == NULL) {  // Check for error opening file
+        printf("Unable to open file %s.", filename);
+        exit(0);
+    }
+
+    uint32_t dimensions[2];
+    if (fread(dimensions, sizeof(uint32_t), 2, file_pointer) != 2 || dimensions[0] == 0 || dimensions[1] == 0 ||
+        dimensions[0] > INT32_MAX || dimensions[1] > INT32_MAX) {
+        printf("Invalid matrix header in %s.", filename);
+        exit(0);
+    }
+    *rows = dimensions[0];
+    *cols = dimensions[1];
+
+    size_t count = (size_t) *rows * *cols;
+    double* data = shared_alloc(count * sizeof(double));
+    if (fread(data, sizeof(double), count, file_pointer) != count) {
+        printf("Matrix file %s is truncated.", filename);
+        exit(0);
+    }
+
+    fclose(file_pointer);  // Close file
+    return data;
+
+}
+
+
+/**
+ * Writes a dense matrix to a binary file.
+ * 
+ * Parameters
+ * ----------
+ *   filename :  Path to the matrix file
+ *   data :      Elements of the matrix in row-major order
+ *   rows :      Number of rows
+ *   cols :      Number of columns
+ */
+void write_matrix(char* filename, double* data, int rows, int cols) {
+
+    FILE* file_pointer = fopen(filename, "wb");
+    if (file_pointer == NULL) {  // Check for error opening file
+        printf("Unable to open file %s.", filename);
+        exit(0);
+    }
+
+    uint32_t dimensions[2] = { rows, cols };
+    size_t count = (size_t) rows * cols;
+    if (fwrite(dimensions, sizeof(uint32_t), 2, file_pointer) != 2 || fwrite(data, sizeof(double), count, file_pointer) != count) {
+        printf("Error writing matrix to %s.", filename);
+        exit(0);
+    }
+
+    fclose(file_pointer);  // Close file
+
+}
+
+
+/**
+ * Computes one tile of C = A * B by accumulating the products of the tiles
+ * of A in the same block row and the tiles of B in the same block column.
+ * Each tile of C is written by exactly one process, so no locking is needed.
+ * 
+ * Parameters
+ * ----------
+ *   m :          Matrices to multiply
+ *   block_row :  Row of the tile in C, in tiles
+ *   block_col :  Column of the tile in C, in tiles
+ */
+void multiply_block(struct matrix_context* m, int block_row, int block_col) {
+
+    int bs = m->block_size;
+    int row_start = block_row * bs, row_end = row_start + bs < m->rows ? row_start + bs : m->rows;
+    int col_start = block_col * bs, col_end = col_start + bs < m->cols ? col_start + bs : m->cols;
+
+    /* Clear the tile before accumulating */
+    for (int i = row_start; i < row_end; i++) {
+        memset(&m->c[(size_t) i * m->cols + col_start], 0, (col_end - col_start) * sizeof(double));
+    }
+
+    /* Accumulate A(block_row, k) * B(k, block_col) over every tile k */
+    for (int k_start = 0; k_start < m->inner; k_start += bs) {
+        int k_end = k_start + bs < m->inner ? k_start + bs : m->inner;
+
+        for (int i = row_start; i < row_end; i++) {
+            double* restrict c_row = &m->c[(size_t) i * m->cols];
+            const double* restrict a_row = &m->a[(size_t) i * m->inner];
+
+            for (int k = k_start; k < k_end; k++) {
+                double a_ik = a_row[k];
+                const double* restrict b_row = &m->b[(size_t) k * m->cols];
+
+                for (int j = col_start; j < col_end; j++) {  // Contiguous in both B and C
+                    c_row[j] += a_ik * b_row[j];
+                }
+            }
+        }
+    }
+
+}
+
+
+/**
+ * Computes C = A * B in the current process, one tile at a time. Used as the
+ * single-process baseline for matrix mode.
+ * 
+ * Parameters
+ * ----------
+ *   m : Matrices to multiply
+ */
+void multiply_blocked(struct matrix_context* m) {
+
+    int block_rows = (m->rows + m->block_size - 1) / m->block_size;
+    int block_cols = (m->cols + m->block_size - 1) / m->block_size;
+
+    for (int i = 0; i < block_rows; i++) {
+        for (int j = 0; j < block_cols; j++) {
+            multiply_block(m, i, j);
+        }
+    }
+
+}
+
+
+/**
+ * Computes C = A * B by dispatching every tile of C to the worker pool. The
+ * matrices are in shared memory, so frames carry only tile coordinates.
+ * 
+ * Parameters
+ * ----------
+ *   pool :     Pool of workers, forked after the matrices were allocated
+ *   options :  Backend and number of tiles per frame
+ *   stats :    Counters, reset and then updated with the I/O performed
+ *   elapsed :  Set to the time taken, in seconds
+ * 
+ * Returns
+ * -------
+ *   status : 0 on success, or -1 if the backend is unavailable
+ */
+int run_matrix(struct worker_pool* pool, struct pool_options* options, struct io_stats* stats, double* elapsed) {
+
+    memset(stats, 0, sizeof(*stats));
+
+    /* One task per tile of C */
+    int block_rows = (matrix.rows + matrix.block_size - 1) / matrix.block_size;
+    int block_cols = (matrix.cols + matrix.block_size - 1) / matrix.block_size;
+    int num_tasks = block_rows * block_cols;
+    int32_t* tiles = malloc(2 * num_tasks * sizeof(int32_t));
+    int32_t* results = malloc(num_tasks * sizeof(int32_t));
+    for (int i = 0; i < num_tasks; i++) {
+        tiles[2*i] = i / block_cols;
+        tiles[2*i + 1] = i % block_cols;
+    }
+
+    double start = now_seconds();
+    int status = dispatch_tasks(pool, options->backend, FRAME_BLOCKS, tiles, num_tasks, options->batch, results, stats);
+    *elapsed = now_seconds() - start;
+
+    free(tiles);
+    free(results);
+    return status;
+
+}
+
+
+/**
+ * Prints the time and GFLOP/s of a matrix multiplication.
+ * 
+ * Parameters
+ * ----------
+ *   label :    Description of how the product was computed
+ *   m :        Matrices multiplied
+ *   elapsed :  Time taken, in seconds
+ */
+void print_matrix_result(char* label, struct matrix_context* m, double elapsed) {
+
+    double flops = 2.0 * m->rows * m->inner * m->cols;
+    printf("%-12s : %dx%d * %dx%d  block %3d  %8.3f s  %7.2f GFLOP/s\n",
+           label, m->rows, m->inner, m->inner, m->cols, m->block_size, elapsed, flops / elapsed / 1e9);
+
+}
+
+
+
+/**
+ * Computes base^exponent modulo POLY_MODULUS by repeated squaring.
+ * 
+ * Parameters
+ * ----------
+ *   base :      Value to raise, less than the modulus
+ *   exponent :  Power to raise it to
+ * 
+ * Returns
+ * -------
+ *   result : base^exponent mod POLY_MODULUS
+ */
+uint32_t mod_pow(uint32_t base, uint64_t exponent) {
+
+    uint64_t result = 1, square = base;
+    while (exponent > 0) {
+        if (exponent & 1) {
+            result = result * square % POLY_MODULUS;
+        }
+        square = square * square % POLY_MODULUS;
+        exponent >>= 1;
+    }
+    return result;
+
+}
+
+
+/**
+ * Computes the number theoretic transform of an array in place, modulo
+ * POLY_MODULUS. The inverse transform includes the division by n.
+ * 
+ * Parameters
+ * ----------
+ *   a :       Coefficients, each less than the modulus
+ *   n :       Number of coefficients, a power of 2 up to POLY_MAX_LENGTH
+ *   invert :  1 for the inverse transform, 0 for the forward transform
+ */
+void ntt(uint32_t* a, int n, int invert) {
+
+    /* Reorder the coefficients by bit-reversed index */
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            uint32_t temp = a[i];
+            a[i] = a[j];
+            a[j] = temp;
+        }
+    }
+
+    /* Butterflies, doubling the transform length each pass */
+    for (int length = 2; length <= n; length <<= 1) {
+
+        uint32_t root = mod_pow(POLY_ROOT, (POLY_MODULUS - 1) / length);
+        if (invert) {
+            root = mod_pow(root, POLY_MODULUS - 2);
+        }
+
+        for (int i = 0; i < n; i += length) {
+            uint64_t w = 1;
+            for (int j = 0; j < length / 2; j++) {
+                uint32_t u = a[i + j];
+                uint32_t v = a[i + j + length / 2] * w % POLY_MODULUS;
+                a[i + j] = u + v < POLY_MODULUS ? u + v : u + v - POLY_MODULUS;
+                a[i + j + length / 2] = u >= v ? u - v : u + POLY_MODULUS - v;
+                w = w * root % POLY_MODULUS;
+            }
+        }
+    }
+
+    if (invert) {
+        uint64_t n_inverse = mod_pow(n, POLY_MODULUS - 2);
+        for (int i = 0; i < n; i++) {
+            a[i] = a[i] * n_inverse % POLY_MODULUS;
+        }
+    }
+
+}
+
+
+/**
+ * Multiplies two polynomials modulo POLY_MODULUS directly, in
+ * O(length_a * length_b) operations.
+ * 
+ * Parameters
+ * ----------
+ *   a, b :                Coefficients of each operand
+ *   length_a, length_b :  Number of coefficients in each operand
+ *   out :                 Product, length_a + length_b - 1 coefficients
+ */
+void poly_schoolbook(const uint32_t* a, int length_a, const uint32_t* b, int length_b, uint32_t* out) {
+
+    for (int k = 0; k < length_a + length_b - 1; k++) {
+
+        /* Each term is below 2^60, so up to 16 terms fit before reducing */
+        int i_start = k - length_b + 1 > 0 ? k - length_b + 1 : 0;
+        int i_end = k < length_a - 1 ? k : length_a - 1;
+        uint64_t sum = 0;
+        for (int i = i_start; i <= i_end; i++) {
+            sum += (uint64_t) a[i] * b[k - i];
+            if (((i - i_start) & 15) == 15) {
+                sum %= POLY_MODULUS;
+            }
+        }
+        out[k] = sum % POLY_MODULUS;
+    }
+
+}
+
+
+/**
+ * Multiplies two polynomials of equal length modulo POLY_MODULUS using
+ * Karatsuba's method, which replaces the four half-length products of
+ * decomposition with three.
+ * 
+ * Parameters
+ * ----------
+ *   a, b :     Coefficients of each operand
+ *   n :        Number of coefficients in each operand, a power of 2
+ *   out :      Product, 2n coefficients. The last is always 0.
+ *   scratch :  Temporary storage for 4n coefficients
+ */
+void poly_karatsuba(const uint32_t* a, const uint32_t* b, int n, uint32_t* out, uint32_t* scratch) {
+
+    if (n <= SCHOOLBOOK_MAX) {
+        poly_schoolbook(a, n, b, n, out);
+        out[2*n - 1] = 0;
+        return;
+    }
+
+    int h = n / 2;
+    uint32_t* sum_a = scratch;        // a_low + a_high
+    uint32_t* sum_b = scratch + h;    // b_low + b_high
+    uint32_t* middle = scratch + n;   // (a_low + a_high) * (b_low + b_high)
+
+    /* Low and high halves are multiplied directly into the output */
+    poly_karatsuba(a, b, h, out, scratch + 2*n);
+    poly_karatsuba(a + h, b + h, h, out + n, scratch + 2*n);
+
+    for (int i = 0; i < h; i++) {
+        sum_a[i] = (a[i] + a[i + h]) % POLY_MODULUS;
+        sum_b[i] = (b[i] + b[i + h]) % POLY_MODULUS;
+    }
+    poly_karatsuba(sum_a, sum_b, h, middle, scratch + 2*n);
+
+    /* The middle term is the cross product minus both halves. It is
+     * computed in full before being added, since it overlaps both halves. */
+    for (int i = 0; i < n; i++) {
+        middle[i] = ((uint64_t) middle[i] + 2ull * POLY_MODULUS - out[i] - out[i + n]) % POLY_MODULUS;
+    }
+    for (int i = 0; i < n; i++) {
+        out[i + h] = ((uint64_t) out[i + h] + middle[i]) % POLY_MODULUS;
+    }
+
+}
+
+
+/**
+ * Multiplies two polynomials modulo POLY_MODULUS, choosing the schoolbook
+ * method, Karatsuba's method, or the NTT depending on their lengths.
+ * 
+ * Parameters
+ * ----------
+ *   a, b :                Coefficients of each operand
+ *   length_a, length_b :  Number of coefficients in each operand
+ *   out :                 Product, length_a + length_b - 1 coefficients
+ */
+void poly_multiply(const uint32_t* a, int length_a, const uint32_t* b, int length_b, uint32_t* out) {
+
+    int length = length_a + length_b - 1;
+    char* algorithm = poly_algorithm(length_a, length_b);
+
+    if (strcmp(algorithm, "schoolbook") == 0) {
+        poly_schoolbook(a, length_a, b, length_b, out);
+        return;
+    }
+
+    /* Both remaining methods work on zero-padded power of 2 lengths */
+    int n = 1;
+    if (strcmp(algorithm, "karatsuba") == 0) {
+        while (n < length_a || n < length_b) {
+            n <<= 1;
+        }
+
+        uint32_t* buffer = calloc(8 * n, sizeof(uint32_t));
+        uint32_t* pa = buffer, * pb = buffer + n, * product = buffer + 2*n, * scratch = buffer + 4*n;
+        memcpy(pa, a, length_a * sizeof(uint32_t));
+        memcpy(pb, b, length_b * sizeof(uint32_t));
+        poly_karatsuba(pa, pb, n, product, scratch);
+        memcpy(out, product, length * sizeof(uint32_t));
+        free(buffer);
+    }
+    else {
+        while (n < length) {
+            n <<= 1;
+        }
+
+        uint32_t* fa = calloc(n, sizeof(uint32_t));
+        uint32_t* fb = calloc(n, sizeof(uint32_t));
+        memcpy(fa, a, length_a * sizeof(uint32_t));
+        memcpy(fb, b, length_b * sizeof(uint32_t));
+        ntt(fa, n, 0);
+        ntt(fb, n, 0);
+        for (int i = 0; i < n; i++) {
+            fa[i] = (uint64_t) fa[i] * fb[i] % POLY_MODULUS;
+        }
+        ntt(fa, n, 1);
+        memcpy(out, fa, length * sizeof(uint32_t));
+        free(fa);
+        free(fb);
+    }
+
+}
+
+
+/**
+ * Chooses the multiplication method for operands of the given lengths.
+ * 
+ * Parameters
+ * ----------
+ *   length_a, length_b : Number of coefficients in each operand
+ * 
+ * Returns
+ * -------
+ *   algorithm : "schoolbook", "karatsuba", or "ntt"
+ */
+char* poly_algorithm(int length_a, int length_b) {
+
+    if (length_a <= SCHOOLBOOK_MAX || length_b <= SCHOOLBOOK_MAX) {
+        return "schoolbook";
+    }
+    if (length_a + length_b - 1 <= KARATSUBA_MAX) {
+        return "karatsuba";
+    }
+    return "ntt";
+
+}
+
+
+/**
+ * Reads a polynomial from a text file into shared memory, reducing each
+ * coefficient modulo POLY_MODULUS.
+ * 
+ * Parameters
+ * ----------
+ *   filename :  Path to the file of whitespace-separated coefficients
+ *   length :    Set to the number of coefficients
+ * 
+ * Returns
+ * -------
+ *   coefficients : Coefficients starting from the constant term
+ */
+uint32_t* read_poly(char* filename, int* length) {
+
+    FILE* file_pointer = fopen(filename, "r");
+    if (file_pointer == NULL) {  // Check for error opening file
+        printf("Unable to open file %s.", filename);
+        exit(0);
+    }
+
+    /* Read into a growing buffer, then copy into shared memory */
+    int capacity = 1024, count = 0;
+    uint32_t* buffer = malloc(capacity * sizeof(uint32_t));
+    long long value;
+    while (fscanf(file_pointer, " %lld", &value) == 1) {
+        if (count == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity * sizeof(uint32_t));
+        }
+        value %= POLY_MODULUS;
+        buffer[count++] = value < 0 ? value + POLY_MODULUS : value;
+    }
+    if (!feof(file_pointer) || count == 0) {
+        printf("Invalid polynomial in %s.", filename);
+        exit(0);
+    }
+    fclose(file_pointer);  // Close file
+
+    uint32_t* coefficients = shared_alloc(count * sizeof(uint32_t));
+    memcpy(coefficients, buffer, count * sizeof(uint32_t));
+    free(buffer);
+
+    *length = count;
+    return coefficients;
+
+}
+
+
+/**
+ * Splits the polynomials in shared memory into chunks and allocates a
+ * shared slot for the product of every pair of chunks. Must be called
+ * before the pool is forked.
+ * 
+ * Parameters
+ * ----------
+ *   length_a, length_b :  Number of coefficients in each operand
+ *   chunks :              Minimum number of chunk products to create
+ */
+void poly_setup(int length_a, int length_b, int chunks) {
+
+    /* Split each operand into about sqrt(chunks) pieces, so there are at
+     * least as many products as requested */
+    int pieces = 1;
+    while (pieces * pieces < chunks) {
+        pieces++;
+    }
+
+    int longest = length_a > length_b ? length_a : length_b;
+    poly.chunk = (longest + pieces - 1) / pieces;
+    poly.chunks_a = (length_a + poly.chunk - 1) / poly.chunk;
+    poly.chunks_b = (length_b + poly.chunk - 1) / poly.chunk;
+    poly.slots = shared_alloc((size_t) poly.chunks_a * poly.chunks_b * 2 * poly.chunk * sizeof(uint32_t));
+
+}
+
+
+/**
+ * Multiplies one chunk of A by one chunk of B and writes the product to its
+ * slot in shared memory.
+ * 
+ * Parameters
+ * ----------
+ *   q :        Polynomials and chunking
+ *   chunk_a :  Index of the chunk of A
+ *   chunk_b :  Index of the chunk of B
+ */
+void poly_multiply_chunks(struct poly_context* q, int chunk_a, int chunk_b) {
+
+    int start_a = chunk_a * q->chunk, start_b = chunk_b * q->chunk;
+    int length_a = q->length_a - start_a < q->chunk ? q->length_a - start_a : q->chunk;
+    int length_b = q->length_b - start_b < q->chunk ? q->length_b - start_b : q->chunk;
+    uint32_t* slot = q->slots + ((size_t) chunk_a * q->chunks_b + chunk_b) * 2 * q->chunk;
+
+    poly_multiply(q->a + start_a, length_a, q->b + start_b, length_b, slot);
+
+}
+
+
+/**
+ * Multiplies the polynomials in shared memory by dispatching the product of
+ * every pair of chunks to the worker pool, then shifting and summing the
+ * chunk products into the result.
+ * 
+ * Parameters
+ * ----------
+ *   pool :     Pool of workers, forked after poly_setup
+ *   options :  Backend and number of products per frame
+ *   stats :    Counters, reset and then updated with the I/O performed
+ *   result :   Product, length_a + length_b - 1 coefficients
+ *   elapsed :  Set to the time taken, in seconds
+ * 
+ * Returns
+ * -------
+ *   status : 0 on success, or -1 if the backend is unavailable
+ */
+int run_poly(struct worker_pool* pool, struct pool_options* options, struct io_stats* stats, uint32_t* result, double* elapsed) {
+
+    memset(stats, 0, sizeof(*stats));
+
+    /* One task per pair of chunks */
+    int num_tasks = poly.chunks_a * poly.chunks_b;
+    int32_t* tasks = malloc(2 * num_tasks * sizeof(int32_t));
+    int32_t* status = malloc(num_tasks * sizeof(int32_t));
+    for (int i = 0; i < num_tasks; i++) {
+        tasks[2*i] = i / poly.chunks_b;
+        tasks[2*i + 1] = i % poly.chunks_b;
+    }
+
+    double start = now_seconds();
+    if (dispatch_tasks(pool, options->backend, FRAME_POLY, tasks, num_tasks, options->batch, status, stats) < 0) {
+        free(tasks);
+        free(status);
+        return -1;
+    }
+
+    /* Shift each chunk product by (i + j) * chunk and sum */
+    int length = poly.length_a + poly.length_b - 1;
+    memset(result, 0, length * sizeof(uint32_t));
+    for (int i = 0; i < poly.chunks_a; i++) {
+        int length_a = poly.length_a - i * poly.chunk < poly.chunk ? poly.length_a - i * poly.chunk : poly.chunk;
+
+        for (int j = 0; j < poly.chunks_b; j++) {
+            int length_b = poly.length_b - j * poly.chunk < poly.chunk ? poly.length_b - j * poly.chunk : poly.chunk;
+            uint32_t* slot = poly.slots + ((size_t) i * poly.chunks_b + j) * 2 * poly.chunk;
+            uint32_t* target = result + (i + j) * poly.chunk;
+
+            for (int k = 0; k < length_a + length_b - 1; k++) {
+                uint32_t sum = target[k] + slot[k];
+                target[k] = sum >= POLY_MODULUS ? sum - POLY_MODULUS : sum;
+            }
+        }
+    }
+    *elapsed = now_seconds() - start;
+
+    free(tasks);
+    free(status);
+    return 0;
+
+}
+
+
+
+/**
+ * Parses a list of CPUs in the format used by sysfs and the -a option, such
+ * as "0,2,4-7". CPUs are returned in the order listed.
+ * 
+ * Parameters
+ * ----------
+ *   text :      List to parse
+ *   cpus :      Parsed CPU numbers
+ *   max_cpus :  Capacity of cpus
+ * 
+ * Returns
+ * -------
+ *   count : Number of CPUs parsed, or -1 if the list is invalid
+ */
+int parse_cpu_list(const char* text, int* cpus, int max_cpus) {
+
+    int count = 0;
+    const char* position = text;
+
+    while (*position != '\0' && *position != '\n') {
+
+        char* end;
+        long first = strtol(position, &end, 10);
+        long last = first;
+        if (end == position || first < 0) {
+            return -1;
+        }
+        if (*end == '-') {  // Range of CPUs
+            position = end + 1;
+            last = strtol(position, &end, 10);
+            if (end == position || last < first) {
+                return -1;
+            }
+        }
+
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (count == max_cpus) {
+                return -1;
+            }
+            cpus[count++] = cpu;
+        }
+
+        position = end;
+        if (*position == ',') {
+            position++;
+        }
+        else if (*position != '\0' && *position != '\n') {
+            return -1;
+        }
+    }
+
+    return count;
+
+}
+
+
+/**
+ * Reads a file under /sys/devices/system/cpu/cpu<N>/.
+ * 
+ * Parameters
+ * ----------
+ *   cpu :     CPU number
+ *   suffix :  Path of the file relative to the CPU's directory
+ *   buffer :  Contents of the file, null terminated
+ *   size :    Capacity of buffer
+ * 
+ * Returns
+ * -------
+ *   status : 0 on success, -1 if the file could not be read
+ */
+int read_sysfs(int cpu, const char* suffix, char* buffer, size_t size) {
+
+    char path[256];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, suffix);
+
+    FILE* file_pointer = fopen(path, "r");
+    if (file_pointer == NULL) {
+        return -1;
+    }
+    size_t length = fread(buffer, 1, size - 1, file_pointer);
+    buffer[length] = '\0';
+    fclose(file_pointer);
+
+    return length > 0 ? 0 : -1;
+
+}
+
+
+/**
+ * Reads the core, package, and last level cache of every online CPU this
+ * process may run on.
+ * 
+ * Parameters
+ * ----------
+ *   topology : Array of MAX_CPUS entries, indexed by CPU number
+ * 
+ * Returns
+ * -------
+ *   count : Number of usable CPUs
+ */
+int read_topology(struct cpu_topology* topology) {
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+
+    int count = 0;
+    char buffer[4096];
+    int shared[MAX_CPUS];
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+
+        struct cpu_topology* t = &topology[cpu];
+        t->online = 0;
+        if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed)) {
+            continue;
+        }
+
+        /* Core and package. CPUs without a topology directory are offline. */
+        if (read_sysfs(cpu, "topology/core_id", buffer, sizeof(buffer)) < 0) {
+            continue;
+        }
+        t->core = atoi(buffer);
+        t->package = read_sysfs(cpu, "topology/physical_package_id", buffer, sizeof(buffer)) == 0 ? atoi(buffer) : 0;
+
+        /* The last level cache is the highest level listed under cache/.
+         * It is identified by the lowest CPU that shares it. */
+        t->llc = cpu;
+        int highest_level = 0;
+        for (int index = 0; ; index++) {
+            char suffix[64];
+            snprintf(suffix, sizeof(suffix), "cache/index%d/level", index);
+            if (read_sysfs(cpu, suffix, buffer, sizeof(buffer)) < 0) {
+                break;
+            }
+            int level = atoi(buffer);
+            snprintf(suffix, sizeof(suffix), "cache/index%d/shared_cpu_list", index);
+            if (level > highest_level && read_sysfs(cpu, suffix, buffer, sizeof(buffer)) == 0 &&
+                parse_cpu_list(buffer, shared, MAX_CPUS) > 0) {
+                highest_level = level;
+                t->llc = shared[0];
+            }
+        }
+
+        t->online = 1;
+        count++;
+    }
+
+    return count;
+
+}
+
+
+/**
+ * Determines the placement class of two CPUs.
+ * 
+ * Parameters
+ * ----------
+ *   topology :       Topology read by read_topology
+ *   first, second :  CPU numbers
+ * 
+ * Returns
+ * -------
+ *   placement : One of the PLACEMENT_* constants
+ */
+int classify_placement(struct cpu_topology* topology, int first, int second) {
+
+    struct cpu_topology* a = &topology[first];
+    struct cpu_topology* b = &topology[second];
+
+    if (first == second) {
+        return PLACEMENT_SAME;
+    }
+    if (a->package != b->package) {
+        return PLACEMENT_REMOTE;
+    }
+    if (a->core == b->core) {
+        return PLACEMENT_SMT;
+    }
+    if (a->llc == b->llc) {
+        return PLACEMENT_LLC;
+    }
+    return PLACEMENT_SOCKET;
+
+}
+
+
+/**
+ * Initializes an empty queue. Every slot starts with a sequence number equal
+ * to its index, marking it free for the producer at that position.
+ * 
+ * Parameters
+ * ----------
+ *   queue : Queue in shared memory
+ */
+void queue_init(struct mpmc_queue* queue) {
+
+    for (size_t i = 0; i < QUEUE_CAPACITY; i++) {
+        atomic_store_explicit(&queue->slots[i].sequence, i, memory_order_relaxed);
+    }
+    atomic_store_explicit(&queue->enqueue_position, 0, memory_order_relaxed);
+    atomic_store_explicit(&queue->dequeue_position, 0, memory_order_release);
+
+}
+
+
+/**
+ * Adds an item to a queue without blocking. A producer claims a position by
+ * compare-and-swap once the slot at that position is free, then publishes
+ * the item by advancing the slot's sequence number.
+ * 
+ * Parameters
+ * ----------
+ *   queue :  Queue in shared memory
+ *   item :   Item to add
+ * 
+ * Returns
+ * -------
+ *   status : 0 if the item was added, -1 if the queue is full
+ */
+int queue_push(struct mpmc_queue* queue, const struct queue_item* item) {
+
+    size_t position = atomic_load_explicit(&queue->enqueue_position, memory_order_relaxed);
+
+    while (1) {
+        struct queue_slot* slot = &queue->slots[position & (QUEUE_CAPACITY - 1)];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+
+        if (difference == 0) {  // Slot is free: try to claim the position
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueue_position, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                slot->item = *item;
+                atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+                return 0;
+            }
+            // A failed compare-and-swap reloads position
+        }
+        else if (difference < 0) {  // Slot still holds an item from the previous lap
+            return -1;
+        }
+        else {  // Another producer claimed the position
+            position = atomic_load_explicit(&queue->enqueue_position, memory_order_relaxed);
+        }
+    }
+
+}
+
+
+/**
+ * Removes an item from a queue without blocking. A consumer claims a
+ * position by compare-and-swap once the slot at that position is full, then
+ * frees the slot for the producer one lap later.
+ * 
+ * Parameters
+ * ----------
+ *   queue :  Queue in shared memory
+ *   item :   Removed item
+ * 
+ * Returns
+ * -------
+ *   status : 0 if an item was removed, -1 if the queue is empty
+ */
+int queue_pop(struct mpmc_queue* queue, struct queue_item* item) {
+
+    size_t position = atomic_load_explicit(&queue->dequeue_position, memory_order_relaxed);
+
+    while (1) {
+        struct queue_slot* slot = &queue->slots[position & (QUEUE_CAPACITY - 1)];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) (position + 1);
+
+        if (difference == 0) {  // Slot is full: try to claim the position
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeue_position, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *item = slot->item;
+                atomic_store_explicit(&slot->sequence, position + QUEUE_CAPACITY, memory_order_release);
+                return 0;
+            }
+        }
+        else if (difference < 0) {  // Nothing has been pushed at this position yet
+            return -1;
+        }
+        else {  // Another consumer claimed the position
+            position = atomic_load_explicit(&queue->dequeue_position, memory_order_relaxed);
+        }
+    }
+
+}
+
+
+/**
+ * Computes the product of a task's operands after doing its extra work.
+ * 
+ * Parameters
+ * ----------
+ *   task : Task to compute
+ * 
+ * Returns
+ * -------
+ *   product : x * y, modulo 2^32
+ */
+int32_t compute_task(const struct queue_item* task) {
+
+    volatile uint32_t busy = 0;  // Extra work the compiler cannot remove
+    for (int i = 0; i < task->cost; i++) {
+        busy = busy * 31 + i;
+    }
+    return (int32_t) ((uint32_t) task->x * (uint32_t) task->y);
+
+}
+
+
+/**
+ * Streams random four-digit multiplications through worker processes that
+ * share one task queue and one completion queue in shared memory. The
+ * parent pushes decomposed products and pops completions until every product
+ * is back, then recombines and verifies each result. In a skewed stream every
+ * SLOW_TASK_EVERY-th task does extra work; with a static partition each
+ * worker instead computes every num_workers-th task, as it would with its own
+ * channel, so all slow tasks land on the same worker.
+ * 
+ * Parameters
+ * ----------
+ *   num_workers :       Number of worker processes to fork
+ *   num_pairs :         Number of multiplications to compute
+ *   skewed :            1 to make some tasks slow, 0 for uniform tasks
+ *   static_partition :  1 to assign tasks round-robin instead of using the queue
+ *   options :           CPU placement given with -a
+ *   elapsed :           Set to the time taken, in seconds
+ * 
+ * Returns
+ * -------
+ *   errors : Number of incorrect results
+ */
+int run_queue(int num_workers, int num_pairs, int skewed, int static_partition, struct pool_options* options, double* elapsed) {
+
+    int num_tasks = 4 * num_pairs;
+
+    /* Shared queues, tasks, and results, allocated before forking */
+    struct mpmc_queue* tasks = shared_alloc(sizeof(struct mpmc_queue));
+    struct mpmc_queue* completions = shared_alloc(sizeof(struct mpmc_queue));
+    struct queue_item* items = shared_alloc(num_tasks * sizeof(struct queue_item));
+    int32_t* products = shared_alloc(num_tasks * sizeof(int32_t));
+    queue_init(tasks);
+    queue_init(completions);
+
+    /* Generate operands and decompose each multiplication */
+    int32_t* values = malloc(2 * num_pairs * sizeof(int32_t));
+    int32_t operands[8];
+    uint32_t seed = 12345;
+    for (int i = 0; i < num_pairs; i++) {
+        values[2*i] = 1000 + random_next(&seed) % 9000;
+        values[2*i + 1] = 1000 + random_next(&seed) % 9000;
+        decompose(values[2*i], values[2*i + 1], operands);
+        for (int k = 0; k < 4; k++) {
+            struct queue_item* item = &items[4*i + k];
+            item->index = 4*i + k;
+            item->x = operands[2*k];
+            item->y = operands[2*k + 1];
+            item->cost = skewed && item->index % SLOW_TASK_EVERY == 0 ? SLOW_TASK_COST : 0;
+        }
+    }
+
+    fflush(stdout);  // Do not duplicate buffered output in the children
+    double start = now_seconds();
+
+    /* Fork the workers */
+    pid_t pids[MAX_WORKERS];
+    for (int w = 0; w < num_workers; w++) {
+
+        pids[w] = fork();
+        if (pids[w] < 0) {
+            printf("Error forking child process.");
+            exit(0);
+        }
+
+        if (pids[w] == 0) {  // Worker process
+
+            int cpu = worker_cpu(options, w);
+            if (cpu >= 0 && pin_to_cpu(cpu) < 0) {
+                printf("Unable to pin worker %d to CPU %d.\n", w, cpu);
+                _exit(0);
+            }
+
+            if (static_partition) {  // Fixed share of the tasks
+                for (int i = w; i < num_tasks; i += num_workers) {
+                    products[i] = compute_task(&items[i]);
+                }
+                _exit(0);
+            }
+
+            /* Pull tasks until told to exit */
+            struct queue_item task;
+            while (1) {
+                while (queue_pop(tasks, &task) < 0) {
+                    sched_yield();
+                }
+                if (task.index < 0) {
+                    break;
+                }
+
+                struct queue_item done = { task.index, compute_task(&task), 0, 0 };
+                while (queue_push(completions, &done) < 0) {
+                    sched_yield();
+                }
+            }
+            _exit(0);
+        }
+    }
+
+    /* Push tasks and collect completions, alternating so that neither
+     * queue stays full */
+    if (!static_partition) {
+        int pushed = 0, collected = 0;
+        struct queue_item done;
+
+        while (collected < num_tasks) {
+            int progress = 0;
+            while (pushed < num_tasks && queue_push(tasks, &items[pushed]) == 0) {
+                pushed++;
+                progress = 1;
+            }
+            while (queue_pop(completions, &done) == 0) {
+                products[done.index] = done.x;
+                collected++;
+                progress = 1;
+            }
+            if (!progress) {
+                sched_yield();
+            }
+        }
+
+        /* Tell every worker to exit */
+        struct queue_item stop = { -1, 0, 0, 0 };
+        for (int w = 0; w < num_workers; w++) {
+            while (queue_push(tasks, &stop) < 0) {
+                sched_yield();
+            }
+        }
+    }
+
+    for (int w = 0; w < num_workers; w++) {
+        waitpid(pids[w], NULL, 0);
+    }
+    *elapsed = now_seconds() - start;
+
+    /* Verify each result */
+    int errors = 0;
+    for (int i = 0; i < num_pairs; i++) {
+        if (recombine(&products[4*i]) != values[2*i] * values[2*i + 1]) {
+            errors++;
+        }
+    }
+
+    /* Free shared and dynamically allocated memory */
+    munmap(tasks, sizeof(struct mpmc_queue));
+    munmap(completions, sizeof(struct mpmc_queue));
+    munmap(items, num_tasks * sizeof(struct queue_item));
+    munmap(products, num_tasks * sizeof(int32_t));
+    free(values);
+
+    return errors;
+
+}
+
+
+/**
+ * Compares the sorted order of two doubles, for qsort.
+ */
+int compare_doubles(const void* first, const void* second) {
+    double a = *(const double*) first, b = *(const double*) second;
+    return (a > b) - (a < b);
+}
+
+
+/**
+ * Measures the round-trip latency between the parent and a single worker for
+ * every placement class available on this machine. For each class, the first
+ * pair of CPUs found in that class is used: the parent is pinned to one and
+ * the worker to the other, and single-product frames are passed back and
+ * forth. The minimum, median, and 99th percentile round trip are reported.
+ * 
+ * Parameters
+ * ----------
+ *   round_trips :  Number of round trips measured per class
+ *   options :      Channel type used for the measurement
+ */
+void run_placement_sweep(int round_trips, struct pool_options* options) {
+
+    char* names[NUM_PLACEMENTS] = { "same cpu", "smt sibling", "shared llc", "same socket", "cross socket" };
+
+    struct cpu_topology* topology = malloc(MAX_CPUS * sizeof(struct cpu_topology));
+    int count = read_topology(topology);
+    printf("%d usable CPUs\n", count);
+
+    /* Find the first pair of CPUs in each placement class */
+    int pairs[NUM_PLACEMENTS][2];
+    int found[NUM_PLACEMENTS] = { 0 };
+    for (int first = 0; first < MAX_CPUS; first++) {
+        for (int second = first; second < MAX_CPUS && topology[first].online; second++) {
+            if (topology[second].online) {
+                int placement = classify_placement(topology, first, second);
+                if (!found[placement]) {
+                    pairs[placement][0] = first;
+                    pairs[placement][1] = second;
+                    found[placement] = 1;
+                }
+            }
+        }
+    }
+
+    double* samples = malloc(round_trips * sizeof(double));
+    struct frame_header header = { FRAME_PAIRS, 1, 2 * sizeof(int32_t) };
+    char request[sizeof(header) + 2 * sizeof(int32_t)];
+    char reply[sizeof(header) + sizeof(int32_t)];
+    int32_t operands[2] = { 12, 34 };
+    memcpy(request, &header, sizeof(header));
+    memcpy(request + sizeof(header), operands, sizeof(operands));
+
+    for (int placement = 0; placement < NUM_PLACEMENTS; placement++) {
+
+        if (!found[placement]) {
+            printf("%-12s : not available on this machine\n", names[placement]);
+            continue;
+        }
+
+        /* Pin the parent and a single worker to the pair of CPUs */
+        options->num_cpus = 2;
+        options->cpus[0] = pairs[placement][0];
+        options->cpus[1] = pairs[placement][1];
+        if (pin_to_cpu(options->cpus[0]) < 0) {
+            printf("Unable to pin the parent to CPU %d.\n", options->cpus[0]);
+            continue;
+        }
+
+        struct worker_pool pool;
+        pool_start(&pool, 1, options);
+        int read_fd = pool.channels[0].read_fd, write_fd = pool.channels[0].write_fd;
+
+        /* Warm up, then time each round trip */
+        for (int i = 0; i < round_trips / 10 + 1; i++) {
+            write_full(write_fd, request, sizeof(request));
+            read_full(read_fd, reply, sizeof(reply));
+        }
+        for (int i = 0; i < round_trips; i++) {
+            double start = now_seconds();
+            write_full(write_fd, request, sizeof(request));
+            read_full(read_fd, reply, sizeof(reply));
+            samples[i] = now_seconds() - start;
+        }
+
+        pool_stop(&pool);
+
+        qsort(samples, round_trips, sizeof(double), compare_doubles);
+        printf("%-12s : cpu %3d <-> cpu %3d  min %8.2f us  median %8.2f us  p99 %8.2f us\n",
+               names[placement], pairs[placement][0], pairs[placement][1],
+               samples[0] * 1e6, samples[round_trips / 2] * 1e6, samples[(int) (round_trips * 0.99)] * 1e6);
+    }
+
+    free(samples);
+    free(topology);
+
+}
+
+
+
+/**
+ * Prints the rate at which varint payloads of the stream are decoded one
+ * byte at a time and with SSE2, for both the operands and the products.
+ * 
+ * Parameters
+ * ----------
+ *   num_pairs : Number of multiplications in the stream
+ */
+void print_decode_rates(int num_pairs) {
+
+    /* Build the operand and product streams of the same multiplications */
+    int num_tasks = 4 * num_pairs;
+    int32_t* operands = malloc(2 * num_tasks * sizeof(int32_t));
+    int32_t* products = malloc(num_tasks * sizeof(int32_t));
+    int32_t* decoded = malloc(2 * num_tasks * sizeof(int32_t));
+    uint8_t* encoded = malloc(2 * num_tasks * VARINT_MAX_BYTES);
+    uint32_t seed = 12345;
+    for (int i = 0; i < num_pairs; i++) {
+        int a = 1000 + random_next(&seed) % 9000;
+        int b = 1000 + random_next(&seed) % 9000;
+        decompose(a, b, &operands[8*i]);
+    }
+    for (int i = 0; i < num_tasks; i++) {
+        products[i] = operands[2*i] * operands[2*i + 1];
+    }
+
+    char* names[2] = { "operands", "products" };
+    int32_t* streams[2] = { operands, products };
+    int counts[2] = { 2 * num_tasks, num_tasks };
+
+    for (int s = 0; s < 2; s++) {
+
+        size_t length = varint_encode(streams[s], counts[s], encoded);
+        double rates[2];
+
+        for (int simd = 0; simd <= 1; simd++) {
+            double start = now_seconds();
+            long used = simd ? varint_decode(encoded, length, decoded, counts[s])
+                             : varint_decode_scalar(encoded, length, decoded, counts[s]);
+            rates[simd] = counts[s] / (now_seconds() - start);
+
+            if (used != (long) length || memcmp(decoded, streams[s], counts[s] * sizeof(int32_t)) != 0) {
+                printf("Decoded %s do not match.\n", names[s]);
+            }
+        }
+
+        printf("decode %-8s : %.2f bytes/value  scalar %8.1f M values/sec  simd %8.1f M values/sec\n",
+               names[s], (double) length / counts[s], rates[0] / 1e6, rates[1] / 1e6);
+    }
+
+    free(operands);
+    free(products);
+    free(decoded);
+    free(encoded);
+
+}
+
+
+
+/**
+ * Disables Nagle's algorithm on a TCP socket, so small frames are sent
+ * immediately instead of waiting to be coalesced.
+ * 
+ * Parameters
+ * ----------
+ *   fd : Connected TCP socket
+ */
+void set_nodelay(int fd) {
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+}
+
+
+/**
+ * Connects to a server given as host:port.
+ * 
+ * Parameters
+ * ----------
+ *   address : Host name or IP address and port, separated by a colon
+ * 
+ * Returns
+ * -------
+ *   fd : Connected TCP socket with TCP_NODELAY set
+ */
+int connect_remote(char* address) {
+
+    char host[256];
+    char* colon = strrchr(address, ':');
+    if (colon == NULL || colon - address >= (long) sizeof(host)) {
+        printf("Invalid server address %s.\n", address);
+        exit(0);
+    }
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+
+    struct addrinfo hints, * results;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, colon + 1, &hints, &results) != 0) {
+        printf("Unable to resolve %s.\n", address);
+        exit(0);
+    }
+
+    /* Try each address until one connects */
+    int fd = -1;
+    for (struct addrinfo* result = results; result != NULL && fd < 0; result = result->ai_next) {
+        fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+        if (fd >= 0 && connect(fd, result->ai_addr, result->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(results);
+
+    if (fd < 0) {
+        printf("Unable to connect to %s.\n", address);
+        exit(0);
+    }
+
+    set_nodelay(fd);
+    return fd;
+
+}
+
+
+/**
+ * Creates a TCP socket listening on the given address and port.
+ * 
+ * Parameters
+ * ----------
+ *   host :  IPv4 address to bind, or NULL for the loopback interface
+ *   port :  Port to bind, or 0 for an ephemeral port
+ * 
+ * Returns
+ * -------
+ *   fd : Listening socket
+ */
+int listen_tcp(const char* host, int port) {
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = host == NULL ? htonl(INADDR_LOOPBACK) : inet_addr(host);
+
+    if (address.sin_addr.s_addr == INADDR_NONE) {
+        printf("Invalid address %s.\n", host);
+        exit(0);
+    }
+    if (fd < 0 || bind(fd, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(fd, 16) < 0) {
+        printf("Unable to listen on port %d.\n", port);
+        exit(0);
+    }
+
+    return fd;
+
+}
+
+
+/**
+ * Accepts connections from parent processes and forks a worker for each,
+ * which serves frames with the same protocol used over local channels.
+ * 
+ * Parameters
+ * ----------
+ *   listen_fd :        Listening socket
+ *   max_connections :  Number of connections to serve before exiting, or 0
+ *                      to serve forever
+ */
+void serve_tcp(int listen_fd, int max_connections) {
+
+    int served = 0;
+
+    while (max_connections == 0 || served < max_connections) {
+
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        set_nodelay(fd);
+        fflush(stdout);
+
+        pid_t pid = fork();
+        if (pid == 0) {  // Worker serving one connection
+            close(listen_fd);
+            worker_loop(fd, fd, 1);  // Remote parents only send pairs
+            _exit(0);
+        }
+
+        close(fd);
+        served++;
+
+        while (waitpid(-1, NULL, WNOHANG) > 0);  // Reap workers that have finished
+    }
+
+    close(listen_fd);
+    while (wait(NULL) > 0);  // Wait for the remaining workers
+
+}
+
+
+/**
+ * Sends a frame on a blocking connection and waits for the full reply.
+ * 
+ * Parameters
+ * ----------
+ *   fd :        Connected socket
+ *   request :   Frame to send
+ *   length :    Number of bytes in the frame
+ *   reply :     Buffer for the reply
+ *   capacity :  Size of the reply buffer
+ * 
+ * Returns
+ * -------
+ *   length : Number of bytes in the reply, or -1 on failure
+ */
+int round_trip(int fd, char* request, size_t length, char* reply, size_t capacity) {
+
+    struct frame_header* header = (struct frame_header*) reply;
+
+    if (write_full(fd, request, length) < 0 || read_full(fd, header, sizeof(*header)) < 0 ||
+        header->length > capacity - sizeof(*header) || read_full(fd, reply + sizeof(*header), header->length) < 0) {
+        return -1;
+    }
+    return sizeof(*header) + header->length;
+
+}
+
+
+/**
+ * Measures the latency and per-task cost of a connection by timing round
+ * trips of single-task frames and of full frames.
+ * 
+ * Parameters
+ * ----------
+ *   fd :        Blocking socket to a worker or server
+ *   batch :     Number of tasks in a full frame
+ *   encoding :  0 for 4-byte words, or FRAME_VARINT
+ *   model :     Measured costs
+ */
+void probe_link(int fd, int batch, uint32_t encoding, struct link_model* model) {
+
+    size_t capacity = sizeof(struct frame_header) + 2 * batch * VARINT_MAX_BYTES;
+    char* request = malloc(capacity);
+    char* reply = malloc(capacity);
+    int32_t* operands = malloc(2 * batch * sizeof(int32_t));
+    double samples[20];
+
+    uint32_t seed = 54321;
+    for (int i = 0; i < 2 * batch; i++) {
+        operands[i] = random_next(&seed) % 100;  // Typical 2-digit components
+    }
+
+    /* Single-task frames give the latency */
+    size_t length = encode_payload(FRAME_PAIRS | encoding, operands, 2, request);
+    ((struct frame_header*) request)->count = 1;
+    for (int i = 0; i < 20; i++) {
+        double start = now_seconds();
+        if (round_trip(fd, request, length, reply, capacity) < 0) {
+            printf("Error probing connection.");
+            exit(0);
+        }
+        samples[i] = now_seconds() - start;
+    }
+    qsort(samples, 20, sizeof(double), compare_doubles);
+    model->latency = samples[10];
+
+    /* Full frames give the cost of each additional task */
+    length = encode_payload(FRAME_PAIRS | encoding, operands, 2 * batch, request);
+    ((struct frame_header*) request)->count = batch;
+    int reply_length = 0;
+    for (int i = 0; i < 10; i++) {
+        double start = now_seconds();
+        reply_length = round_trip(fd, request, length, reply, capacity);
+        if (reply_length < 0) {
+            printf("Error probing connection.");
+            exit(0);
+        }
+        samples[i] = now_seconds() - start;
+    }
+    qsort(samples, 10, sizeof(double), compare_doubles);
+    model->per_task = (samples[5] > model->latency ? samples[5] - model->latency : 1e-9) / batch;
+    model->bytes_per_task = (double) (length + reply_length) / batch;
+
+    free(request);
+    free(reply);
+    free(operands);
+
+}
+
+
+/**
+ * Chooses how many tasks to send to remote servers so that the local pool
+ * and the servers are expected to finish at the same time.
+ * 
+ * The local pool computes n_local tasks in n_local * c_local / W, where W is
+ * the number of local workers that can run at once. The servers take one
+ * round trip of latency L, then compute n_remote tasks in
+ * n_remote * c_remote / R. With d frames of b tasks in flight, a connection
+ * stays busy only if d * b * c_remote covers L, so c_remote is at least
+ * L / (d * b). Equating both times gives
+ *   n_remote = (N * c_local / W - L) / (c_local / W + c_remote / R).
+ * 
+ * Parameters
+ * ----------
+ *   local :          Measured cost of a local worker
+ *   local_workers :  Number of local workers
+ *   remote :         Measured cost of a server, averaged over the servers
+ *   num_remotes :    Number of servers
+ *   depth :          Frames in flight per connection
+ *   batch :          Tasks per frame
+ *   num_tasks :      Total number of tasks
+ * 
+ * Returns
+ * -------
+ *   remote_tasks : Number of tasks to send to the servers
+ */
+int plan_remote_tasks(struct link_model* local, int local_workers, struct link_model* remote, int num_remotes, int depth, int batch, int num_tasks) {
+
+    if (num_remotes == 0) {
+        return 0;
+    }
+    if (local_workers == 0) {
+        return num_tasks;
+    }
+
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    int parallel = local_workers < online ? local_workers : online;
+
+    double local_cost = local->per_task / parallel;
+    double remote_cost = remote->per_task > remote->latency / (depth * batch) ? remote->per_task : remote->latency / (depth * batch);
+    remote_cost /= num_remotes;
+
+    double remote_tasks = (num_tasks * local_cost - remote->latency) / (local_cost + remote_cost);
+    if (remote_tasks < 0) {
+        remote_tasks = 0;
+    }
+    if (remote_tasks > num_tasks) {
+        remote_tasks = num_tasks;
+    }
+
+    printf("model : local %.1f ns/task on %d workers, remote %.1f us latency, %.1f ns/task, %.1f MB/s on %d servers\n",
+           local->per_task * 1e9, parallel, remote->latency * 1e6, remote->per_task * 1e9,
+           remote->bytes_per_task / remote->per_task / 1e6, num_remotes);
+    printf("model : predicted %.4f s, sending %.1f%% of tasks to servers\n",
+           (num_tasks - remote_tasks) * local_cost, 100.0 * remote_tasks / num_tasks);
+
+    return remote_tasks;
+
+}
+
+
+/**
+ * Writes as much of a channel's pending frame as the socket accepts.
+ * 
+ * Parameters
+ * ----------
+ *   channel : Channel with a frame to send
+ * 
+ * Returns
+ * -------
+ *   calls : Number of write calls made
+ */
+int flush_channel(struct stream_channel* channel) {
+
+    struct frame_buffer* send = &channel->send;
+    int calls = 0;
+
+    while (send->done < send->length) {
+        ssize_t written = write(channel->fd, send->data + send->done, send->length - send->done);
+        calls++;
+        if (written < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return calls;  // Resume when the socket is writable
+            }
+            printf("Error sending frame.");
+            exit(0);
+        }
+        send->done += written;
+    }
+
+    send->length = send->done = 0;  // Idle
+    return calls;
+
+}
+
+
+/**
+ * Streams tasks over local and remote connections at once. Tasks before
+ * num_tasks - remote_tasks are shared by the local channels and the rest by
+ * the remote channels, each channel taking the next batch of its group's
+ * tasks whenever it has fewer than depth frames in flight.
+ * 
+ * Parameters
+ * ----------
+ *   channels :      Connections, with send and recieve buffers allocated
+ *   num_channels :  Number of connections
+ *   options :       Batch size, depth, and encoding
+ *   operands :      Pair of operands for each task
+ *   num_tasks :     Number of tasks
+ *   remote_tasks :  Number of tasks, at the end, sent to remote channels
+ *   results :       Result of each task
+ *   finish :        Time each group recieved its last reply, relative to the start
+ * 
+ * Returns
+ * -------
+ *   syscalls : Number of system calls made to move frames
+ */
+int run_distributed(struct stream_channel* channels, int num_channels, struct pool_options* options, int32_t* operands, int num_tasks, int remote_tasks, int32_t* results, double* finish) {
+
+    int next[2] = { 0, num_tasks - remote_tasks };  // Next task of each group
+    int end[2] = { num_tasks - remote_tasks, num_tasks };
+    int remaining[2] = { end[0], remote_tasks };    // Tasks not yet recieved
+    int batch = options->batch;
+    int syscalls = 0;
+
+    finish[0] = finish[1] = 0;
+    double start = now_seconds();
+
+    int epoll_fd = epoll_create1(0);
+    for (int c = 0; c < num_channels; c++) {
+        fcntl(channels[c].fd, F_SETFL, fcntl(channels[c].fd, F_GETFL) | O_NONBLOCK);
+        struct epoll_event event = { .events = EPOLLIN, .data.u32 = c };
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, channels[c].fd, &event);
+        channels[c].in_flight = channels[c].oldest = channels[c].want_write = 0;
+        channels[c].send.length = channels[c].send.done = channels[c].recv.done = 0;
+    }
+
+    struct epoll_event events[MAX_WORKERS + MAX_REMOTES];
+    while (remaining[0] + remaining[1] > 0) {
+
+        /* Keep each channel's pipeline full */
+        for (int c = 0; c < num_channels; c++) {
+
+            struct stream_channel* channel = &channels[c];
+            int group = channel->group;
+
+            while (channel->send.length == 0 && channel->in_flight < options->depth && next[group] < end[group]) {
+
+                int count = end[group] - next[group] < batch ? end[group] - next[group] : batch;
+                channel->send.length = encode_payload(FRAME_PAIRS | options->encoding, &operands[2 * next[group]], 2 * count, channel->send.data);
+                ((struct frame_header*) channel->send.data)->count = count;
+                channel->first_task[(channel->oldest + channel->in_flight) % MAX_DEPTH] = next[group];
+                channel->task_count[(channel->oldest + channel->in_flight) % MAX_DEPTH] = count;
+                channel->in_flight++;
+                next[group] += count;
+
+                syscalls += flush_channel(channel);
+            }
+
+            /* Watch for writability only while a frame is partly sent */
+            int want_write = channel->send.length > 0;
+            if (want_write != channel->want_write) {
+                struct epoll_event event = { .events = EPOLLIN | (want_write ? EPOLLOUT : 0), .data.u32 = c };
+                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, channel->fd, &event);
+                syscalls++;
+                channel->want_write = want_write;
+            }
+        }
+
+        int ready = epoll_wait(epoll_fd, events, MAX_WORKERS + MAX_REMOTES, -1);
+        syscalls++;
+
+        for (int i = 0; i < ready; i++) {
+
+            struct stream_channel* channel = &channels[events[i].data.u32];
+
+            if (events[i].events & EPOLLOUT) {
+                syscalls += flush_channel(channel);
+            }
+            if (!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                continue;
+            }
+
+            /* Read whatever has arrived */
+            struct frame_buffer* recv = &channel->recv;
+            ssize_t got = read(channel->fd, recv->data + recv->done, recv->capacity - recv->done);
+            syscalls++;
+            if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                printf("Connection closed with frames in flight.");
+                exit(0);
+            }
+            if (got < 0) {
+                continue;
+            }
+            recv->done += got;
+
+            /* Parse every complete reply */
+            while (recv->done >= sizeof(struct frame_header)) {
+                struct frame_header* header = (struct frame_header*) recv->data;
+                size_t length = sizeof(*header) + header->length;
+                if (length > recv->capacity) {
+                    printf("Invalid reply frame.");
+                    exit(0);
+                }
+                if (recv->done < length) {
+                    break;
+                }
+
+                /* The peer is not trusted: a reply must hold exactly the
+                 * results of the oldest frame in flight */
+                int first = channel->first_task[channel->oldest];
+                if (channel->in_flight == 0 || header->count != (uint32_t) channel->task_count[channel->oldest]
+                        || decode_payload(recv->data, &results[first]) < 0) {
+                    printf("Invalid reply frame.");
+                    exit(0);
+                }
+                remaining[channel->group] -= header->count;
+                if (remaining[channel->group] == 0) {
+                    finish[channel->group] = now_seconds() - start;
+                }
+                channel->oldest = (channel->oldest + 1) % MAX_DEPTH;
+                channel->in_flight--;
+
+                memmove(recv->data, recv->data + length, recv->done - length);
+                recv->done -= length;
+            }
+        }
+    }
+
+    /* Restore blocking mode for the stop frames */
+    for (int c = 0; c < num_channels; c++) {
+        fcntl(channels[c].fd, F_SETFL, fcntl(channels[c].fd, F_GETFL) & ~O_NONBLOCK);
+    }
+    close(epoll_fd);
+
+    return syscalls;
+
+}
+
+
+/**
+ * Streams random four-digit multiplications split between a local worker
+ * pool and remote TCP servers. Every connection is probed first, and the
+ * split is chosen by the bandwidth/latency model unless a fraction is given.
+ * 
+ * Parameters
+ * ----------
+ *   num_remotes :  Number of servers
+ *   remote_fds :   Connected socket to each server
+ *   names :        Address of each server, for messages
+ *   num_pairs :    Number of multiplications to compute
+ *   options :      Local workers, depth, batch size, encoding, and split
+ */
+void distributed_mode(int num_remotes, int* remote_fds, char** names, int num_pairs, struct pool_options* options) {
+
+    int num_tasks = 4 * num_pairs;
+    int batch = 4 * options->batch;  // Frames carry the four decomposed products of each pair
+    int local_workers = options->local_workers;
+    struct pool_options batched = *options;
+    batched.batch = batch;
+
+    /* Local workers use socket pairs, so every channel is one descriptor */
+    struct worker_pool pool;
+    struct pool_options local_options = *options;
+    local_options.channel_type = CHANNEL_SOCKET;
+    if (local_workers > 0) {
+        pool_start(&pool, local_workers, &local_options);
+    }
+
+    /* Probe one local worker and every server */
+    struct link_model local = { 0, 0, 0 }, remote = { 0, 0, 0 };
+    if (local_workers > 0) {
+        probe_link(pool.channels[0].read_fd, batch, options->encoding, &local);
+    }
+    for (int r = 0; r < num_remotes; r++) {
+        struct link_model model;
+        probe_link(remote_fds[r], batch, options->encoding, &model);
+        printf("probe : %-21s latency %8.1f us  %8.1f ns/task\n", names[r], model.latency * 1e6, model.per_task * 1e9);
+        remote.latency += model.latency / num_remotes;
+        remote.per_task += model.per_task / num_remotes;
+        remote.bytes_per_task += model.bytes_per_task / num_remotes;
+    }
+
+    int remote_tasks;
+    if (options->remote_fraction >= 0) {
+        remote_tasks = options->remote_fraction * num_tasks;
+    }
+    else {
+        remote_tasks = plan_remote_tasks(&local, local_workers, &remote, num_remotes, options->depth, batch, num_tasks);
+    }
+    if (local_workers == 0) {
+        remote_tasks = num_tasks;
+    }
+    if (num_remotes == 0) {
+        remote_tasks = 0;
+    }
+    remote_tasks -= remote_tasks % 4;  // Keep each multiplication in one group
+
+    /* Set up a channel per connection */
+    int num_channels = local_workers + num_remotes;
+    struct stream_channel* channels = malloc(num_channels * sizeof(struct stream_channel));
+    for (int c = 0; c < num_channels; c++) {
+        channels[c].fd = c < local_workers ? pool.channels[c].read_fd : remote_fds[c - local_workers];
+        channels[c].group = c < local_workers ? GROUP_LOCAL : GROUP_REMOTE;
+        channels[c].send.capacity = sizeof(struct frame_header) + 2 * batch * VARINT_MAX_BYTES;
+        channels[c].recv.capacity = MAX_DEPTH * (sizeof(struct frame_header) + batch * VARINT_MAX_BYTES);
+        channels[c].send.data = malloc(channels[c].send.capacity);
+        channels[c].recv.data = malloc(channels[c].recv.capacity);
+    }
+
+    /* Generate operands and decompose each multiplication */
+    int32_t* values = malloc(2 * num_pairs * sizeof(int32_t));
+    int32_t* operands = malloc(2 * num_tasks * sizeof(int32_t));
+    int32_t* products = malloc(num_tasks * sizeof(int32_t));
+    uint32_t seed = 12345;
+    for (int i = 0; i < num_pairs; i++) {
+        values[2*i] = 1000 + random_next(&seed) % 9000;
+        values[2*i + 1] = 1000 + random_next(&seed) % 9000;
+        decompose(values[2*i], values[2*i + 1], &operands[8*i]);
+    }
+
+    double finish[2];
+    double start = now_seconds();
+    int syscalls = run_distributed(channels, num_channels, &batched, operands, num_tasks, remote_tasks, products, finish);
+    double elapsed = now_seconds() - start;
+
+    /* Verify each result */
+    int errors = 0;
+    for (int i = 0; i < num_pairs; i++) {
+        if (recombine(&products[4*i]) != values[2*i] * values[2*i + 1]) {
+            errors++;
+        }
+    }
+
+    printf("tcp   : %d local workers, %d servers  depth %d  batch %d  %.1f%% remote  %10.0f pairs/sec  %.3f syscalls/pair\n",
+           local_workers, num_remotes, options->depth, options->batch, 100.0 * remote_tasks / num_tasks,
+           num_pairs / elapsed, (double) syscalls / num_pairs);
+    printf("tcp   : local finished at %.4f s, remote finished at %.4f s\n", finish[GROUP_LOCAL], finish[GROUP_REMOTE]);
+    printf("\n%d of %d products verified\n", num_pairs - errors, num_pairs);
+
+    /* Close connections and free dynamically allocated memory */
+    for (int r = 0; r < num_remotes; r++) {
+        close(remote_fds[r]);
+    }
+    if (local_workers > 0) {
+        pool_stop(&pool);
+    }
+    for (int c = 0; c < num_channels; c++) {
+        free(channels[c].send.data);
+        free(channels[c].recv.data);
+    }
+    free(channels);
+    free(values);
+    free(operands);
+    free(products);
+
+}
+
+
+
+/**
+ * Allocates the shared operands and slots used to multiply big numbers over
+ * the worker pool. Must be called before the pool is forked.
+ * 
+ * Parameters
+ * ----------
+ *   capacity :  Largest number of limbs in an operand
+ *   chunks :    Minimum number of chunk products per multiplication
+ */
+void bignum_setup(int capacity, int chunks) {
+
+    /* Split each operand into about sqrt(chunks) pieces */
+    int pieces = 1;
+    while (pieces * pieces < chunks) {
+        pieces++;
+    }
+
+    bignum.capacity = capacity;
+    bignum.pieces = pieces;
+    bignum.a = shared_alloc(capacity * sizeof(uint32_t));
+    bignum.b = shared_alloc(capacity * sizeof(uint32_t));
+    bignum.layout = shared_alloc(sizeof(struct bignum_layout));
+
+    /* Every chunk product needs 2 * chunk limbs, and the chunk is at most
+     * capacity / pieces rounded up */
+    int chunk = (capacity + pieces - 1) / pieces;
+    bignum.slots_capacity = (size_t) pieces * pieces * 2 * chunk;
+    bignum.slots = shared_alloc(bignum.slots_capacity * sizeof(uint32_t));
+    bignum.pool = NULL;
+
+}
+
+
+/**
+ * Fills a big number with pseudo-random limbs.
+ * 
+ * Parameters
+ * ----------
+ *   a :     Number to fill
+ *   n :     Number of limbs
+ *   seed :  Generator state, updated in place
+ */
+void bn_random(uint32_t* a, int n, uint32_t* seed) {
+    for (int i = 0; i < n; i++) {
+        a[i] = random_next(seed);
+    }
+}
+
+
+/**
+ * Compares two big numbers of the same length.
+ * 
+ * Returns
+ * -------
+ *   order : -1, 0, or 1 if a is less than, equal to, or greater than b
+ */
+int bn_compare(const uint32_t* a, const uint32_t* b, int n) {
+
+    for (int i = n - 1; i >= 0; i--) {
+        if (a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+
+}
+
+
+/**
+ * Subtracts b from a in place.
+ * 
+ * Parameters
+ * ----------
+ *   a :  Minuend, replaced by the difference
+ *   b :  Subtrahend
+ *   n :  Number of limbs in both
+ * 
+ * Returns
+ * -------
+ *   borrow : 1 if b was greater than a, 0 if not
+ */
+uint32_t bn_subtract(uint32_t* a, const uint32_t* b, int n) {
+
+    uint64_t borrow = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t difference = (uint64_t) a[i] - b[i] - borrow;
+        a[i] = difference;
+        borrow = (difference >> 32) & 1;
+    }
+    return borrow;
+
+}
+
+
+/**
+ * Adds a big number into another at a limb offset, propagating the carry.
+ * 
+ * Parameters
+ * ----------
+ *   out :     Sum, updated in place
+ *   length :  Number of limbs in out
+ *   a :       Number to add
+ *   n :       Number of limbs in a
+ *   offset :  Limb of out where a's least significant limb is added
+ */
+void bn_add_at(uint32_t* out, int length, const uint32_t* a, int n, int offset) {
+
+    uint64_t carry = 0;
+    int i = 0;
+    for (; i < n && offset + i < length; i++) {
+        uint64_t sum = (uint64_t) out[offset + i] + a[i] + carry;
+        out[offset + i] = sum;
+        carry = sum >> 32;
+    }
+    for (i += offset; carry && i < length; i++) {
+        uint64_t sum = (uint64_t) out[i] + carry;
+        out[i] = sum;
+        carry = sum >> 32;
+    }
+
+}
+
+
+/**
+ * Multiplies two big numbers one limb at a time.
+ * 
+ * Parameters
+ * ----------
+ *   a, b :                Operands
+ *   length_a, length_b :  Number of limbs in each operand
+ *   out :                 Product, length_a + length_b limbs. Must not
+ *                         overlap either operand.
+ */
+void bn_mul_schoolbook(const uint32_t* a, int length_a, const uint32_t* b, int length_b, uint32_t* out) {
+
+    memset(out, 0, (length_a + length_b) * sizeof(uint32_t));
+
+    for (int i = 0; i < length_a; i++) {
+        uint64_t carry = 0;
+        uint64_t a_i = a[i];
+        for (int j = 0; j < length_b; j++) {
+            uint64_t product = a_i * b[j] + out[i + j] + carry;  // Fits in 64 bits
+            out[i + j] = product;
+            carry = product >> 32;
+        }
+        out[i + length_b] = carry;
+    }
+
+}
+
+
+/**
+ * Multiplies two big numbers. Large products are decomposed into chunk
+ * products computed by the worker pool, in the same way four-digit integers
+ * are decomposed into 2-digit components, and the parent adds each chunk
+ * product at its offset. Smaller products are computed locally.
+ * 
+ * Parameters
+ * ----------
+ *   a, b :                Operands
+ *   length_a, length_b :  Number of limbs in each operand
+ *   out :                 Product, length_a + length_b limbs. Must not
+ *                         overlap either operand.
+ */
+void bn_mul(const uint32_t* a, int length_a, const uint32_t* b, int length_b, uint32_t* out) {
+
+    if (bignum.pool == NULL || length_a < BIGNUM_PARALLEL_MIN || length_b < BIGNUM_PARALLEL_MIN ||
+        length_a > bignum.capacity || length_b > bignum.capacity) {
+        bn_mul_schoolbook(a, length_a, b, length_b, out);
+        return;
+    }
+
+    /* Copy the operands to shared memory and split them into chunks */
+    memcpy(bignum.a, a, length_a * sizeof(uint32_t));
+    memcpy(bignum.b, b, length_b * sizeof(uint32_t));
+    struct bignum_layout* layout = bignum.layout;
+    int longest = length_a > length_b ? length_a : length_b;
+    layout->length_a = length_a;
+    layout->length_b = length_b;
+    layout->chunk = (longest + bignum.pieces - 1) / bignum.pieces;
+    layout->chunks_a = (length_a + layout->chunk - 1) / layout->chunk;
+    layout->chunks_b = (length_b + layout->chunk - 1) / layout->chunk;
+
+    /* One task per pair of chunks */
+    int num_tasks = layout->chunks_a * layout->chunks_b;  // Up to pieces^2, which -c does not bound
+    int32_t* tasks = malloc(2 * num_tasks * sizeof(int32_t));
+    int32_t* status = malloc(num_tasks * sizeof(int32_t));
+    for (int i = 0; i < num_tasks; i++) {
+        tasks[2*i] = i / layout->chunks_b;
+        tasks[2*i + 1] = i % layout->chunks_b;
+    }
+
+    struct io_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (dispatch_tasks(bignum.pool, bignum.backend, FRAME_BIGNUM, tasks, num_tasks, 1, status, &stats) < 0) {
+        exit(0);
+    }
+    free(tasks);
+    free(status);
+
+    /* Add each chunk product at limb offset (i + j) * chunk */
+    int length = length_a + length_b;
+    memset(out, 0, length * sizeof(uint32_t));
+    int chunk = layout->chunk;
+    for (int i = 0; i < layout->chunks_a; i++) {
+        int chunk_a = length_a - i * chunk < chunk ? length_a - i * chunk : chunk;
+        for (int j = 0; j < layout->chunks_b; j++) {
+            int chunk_b = length_b - j * chunk < chunk ? length_b - j * chunk : chunk;
+            uint32_t* slot = bignum.slots + ((size_t) i * layout->chunks_b + j) * 2 * chunk;
+            bn_add_at(out, length, slot, chunk_a + chunk_b, (i + j) * chunk);
+        }
+    }
+
+}
+
+
+/**
+ * Multiplies one chunk of A by one chunk of B and writes the product to its
+ * slot in shared memory.
+ * 
+ * Parameters
+ * ----------
+ *   c :        Operands and chunking
+ *   chunk_a :  Index of the chunk of A
+ *   chunk_b :  Index of the chunk of B
+ */
+void bn_multiply_chunks(struct bignum_context* c, int chunk_a, int chunk_b) {
+
+    struct bignum_layout* layout = c->layout;
+    int start_a = chunk_a * layout->chunk, start_b = chunk_b * layout->chunk;
+    int length_a = layout->length_a - start_a < layout->chunk ? layout->length_a - start_a : layout->chunk;
+    int length_b = layout->length_b - start_b < layout->chunk ? layout->length_b - start_b : layout->chunk;
+    uint32_t* slot = c->slots + ((size_t) chunk_a * layout->chunks_b + chunk_b) * 2 * layout->chunk;
+
+    bn_mul_schoolbook(c->a + start_a, length_a, c->b + start_b, length_b, slot);
+
+}
+
+
+/**
+ * Prepares Montgomery arithmetic for an odd modulus. Computes -N^-1 mod R by
+ * Newton iteration, doubling the number of correct limbs each step, and
+ * R^2 mod N by repeated doubling.
+ * 
+ * Parameters
+ * ----------
+ *   m :        Context to initialize
+ *   modulus :  Odd modulus N
+ *   n :        Number of limbs in the modulus
+ */
+void mont_init(struct montgomery* m, const uint32_t* modulus, int n) {
+
+    m->n = n;
+    m->modulus = malloc(n * sizeof(uint32_t));
+    m->inverse = calloc(n, sizeof(uint32_t));
+    m->r_squared = calloc(n + 1, sizeof(uint32_t));
+    m->scratch = malloc((8 * n + 2) * sizeof(uint32_t));
+    memcpy(m->modulus, modulus, n * sizeof(uint32_t));
+
+    /* Inverse of the lowest limb mod 2^32. Each step doubles the number of
+     * correct bits, starting from 3 since N * N = 1 mod 8. */
+    uint32_t x = modulus[0];
+    for (int i = 0; i < 4; i++) {
+        x *= 2 - modulus[0] * x;
+    }
+    m->inverse[0] = x;
+
+    /* Lift to N^-1 mod 2^(32p) for p = 2, 4, ..., n: x = x * (2 - N * x) */
+    uint32_t* product = m->scratch;        // 2n limbs
+    uint32_t* correction = m->scratch + 2*n; // n limbs
+    uint32_t* lifted = m->scratch + 4*n;   // 2n limbs
+    for (int p = 1; p < n; ) {
+        p = 2 * p < n ? 2 * p : n;
+
+        bn_mul(modulus, p, m->inverse, p, product);  // N * x mod 2^(32p)
+
+        /* 2 - N * x mod 2^(32p) */
+        memset(correction, 0, p * sizeof(uint32_t));
+        correction[0] = 2;
+        bn_subtract(correction, product, p);
+
+        bn_mul(m->inverse, p, correction, p, lifted);
+        memcpy(m->inverse, lifted, p * sizeof(uint32_t));
+    }
+
+    /* Negate: -N^-1 mod R */
+    for (int i = 0; i < n; i++) {
+        m->inverse[i] = ~m->inverse[i];
+    }
+    for (int i = 0; i < n && ++m->inverse[i] == 0; i++);
+
+    /* R^2 mod N by doubling 1, 64n times, subtracting N whenever the value
+     * reaches it */
+    uint32_t* r = m->r_squared;
+    uint32_t* extended_modulus = m->scratch;  // N with an extra zero limb
+    memcpy(extended_modulus, modulus, n * sizeof(uint32_t));
+    extended_modulus[n] = 0;
+    r[0] = 1;
+    for (int i = 0; i < 64 * n; i++) {
+        uint32_t carry = 0;
+        for (int k = 0; k <= n; k++) {
+            uint32_t next = r[k] >> 31;
+            r[k] = (r[k] << 1) | carry;
+            carry = next;
+        }
+        if (bn_compare(r, extended_modulus, n + 1) >= 0) {
+            bn_subtract(r, extended_modulus, n + 1);
+        }
+    }
+
+}
+
+
+/**
+ * Frees the memory of a Montgomery context.
+ */
+void mont_free(struct montgomery* m) {
+    free(m->modulus);
+    free(m->inverse);
+    free(m->r_squared);
+    free(m->scratch);
+}
+
+
+/**
+ * Computes a * b * R^-1 mod N using three full multiplications, so that
+ * every large product can be computed by the worker pool:
+ *   T = a * b,  q = (T mod R) * (-N^-1) mod R,  out = (T + q * N) / R
+ * with a final subtraction of N if out is at least N.
+ * 
+ * Parameters
+ * ----------
+ *   m :     Montgomery context
+ *   a, b :  Operands in Montgomery form, less than N
+ *   out :   Product in Montgomery form. May overlap either operand.
+ */
+void mont_mul(struct montgomery* m, const uint32_t* a, const uint32_t* b, uint32_t* out) {
+
+    int n = m->n;
+    uint32_t* t = m->scratch;            // 2n + 1 limbs
+    uint32_t* q = m->scratch + 2*n + 1;  // 2n limbs, low n used
+    uint32_t* qn = m->scratch + 4*n + 1; // 2n limbs
+
+    bn_mul(a, n, b, n, t);
+    t[2*n] = 0;
+    bn_mul(t, n, m->inverse, n, q);
+    bn_mul(q, n, m->modulus, n, qn);
+    bn_add_at(t, 2*n + 1, qn, 2*n, 0);  // Low n limbs are now zero
+
+    /* Divide by R and reduce */
+    uint32_t* result = t + n;  // n + 1 limbs
+    if (result[n] != 0 || bn_compare(result, m->modulus, n) >= 0) {
+        bn_subtract(result, m->modulus, n);
+    }
+    memcpy(out, result, n * sizeof(uint32_t));
+
+}
+
+
+/**
+ * Computes base^exponent mod N by left-to-right sliding window
+ * exponentiation in Montgomery form. Odd powers of the base up to the
+ * window size are precomputed, so each window of up to w exponent bits costs
+ * w squarings and one multiplication.
+ * 
+ * Parameters
+ * ----------
+ *   m :               Montgomery context
+ *   base :            Base, less than N, n limbs
+ *   exponent :        Exponent
+ *   exponent_limbs :  Number of limbs in the exponent
+ *   out :             Result, n limbs
+ */
+void mont_pow(struct montgomery* m, const uint32_t* base, const uint32_t* exponent, int exponent_limbs, uint32_t* out) {
+
+    int n = m->n;
+    int bits = 32 * exponent_limbs;
+    while (bits > 0 && !((exponent[(bits - 1) / 32] >> ((bits - 1) % 32)) & 1)) {
+        bits--;
+    }
+
+    /* Window size grows with the exponent, as in common practice */
+    int window = bits > 671 ? 6 : bits > 239 ? 5 : bits > 79 ? 4 : bits > 23 ? 3 : 1;
+    if (window > BIGNUM_MAX_WINDOW) {
+        window = BIGNUM_MAX_WINDOW;
+    }
+
+    /* table[i] = base^(2i + 1) in Montgomery form */
+    int table_size = 1 << (window - 1);
+    uint32_t* table = malloc((size_t) table_size * n * sizeof(uint32_t));
+    uint32_t* square = malloc(n * sizeof(uint32_t));
+    uint32_t* x = malloc(n * sizeof(uint32_t));
+    uint32_t* one = calloc(n, sizeof(uint32_t));
+    one[0] = 1;
+
+    mont_mul(m, base, m->r_squared, table);  // base * R mod N
+    mont_mul(m, table, table, square);
+    for (int i = 1; i < table_size; i++) {
+        mont_mul(m, &table[(i - 1) * n], square, &table[i * n]);
+    }
+    mont_mul(m, one, m->r_squared, x);  // 1 in Montgomery form
+
+    /* Scan the exponent from its most significant bit */
+    int i = bits - 1;
+    while (i >= 0) {
+
+        if (!((exponent[i / 32] >> (i % 32)) & 1)) {
+            mont_mul(m, x, x, x);
+            i--;
+            continue;
+        }
+
+        /* Longest window of at most w bits starting at i and ending in a 1 */
+        int j = i - window + 1 > 0 ? i - window + 1 : 0;
+        while (!((exponent[j / 32] >> (j % 32)) & 1)) {
+            j++;
+        }
+        int value = 0;
+        for (int k = i; k >= j; k--) {
+            value = (value << 1) | ((exponent[k / 32] >> (k % 32)) & 1);
+            mont_mul(m, x, x, x);
+        }
+        mont_mul(m, x, &table[(value / 2) * n], x);
+        i = j - 1;
+    }
+
+    mont_mul(m, x, one, out);  // Convert out of Montgomery form
+
+    free(table);
+    free(square);
+    free(x);
+    free(one);
+
+}
+
+
+/**
+ * Reduces a big number modulo another by shifting it in one bit at a time
+ * and subtracting the modulus whenever the remainder reaches it. Slow, but
+ * independent of the Montgomery code it is used to check.
+ * 
+ * Parameters
+ * ----------
+ *   a :        Number to reduce
+ *   length :   Number of limbs in a
+ *   modulus :  Modulus
+ *   n :        Number of limbs in the modulus
+ *   out :      Remainder, n limbs
+ */
+void bn_mod_reference(const uint32_t* a, int length, const uint32_t* modulus, int n, uint32_t* out) {
+
+    uint32_t* r = calloc(n + 1, sizeof(uint32_t));
+    uint32_t* extended_modulus = calloc(n + 1, sizeof(uint32_t));  // N with an extra zero limb
+    memcpy(extended_modulus, modulus, n * sizeof(uint32_t));
+
+    for (int i = 32 * length - 1; i >= 0; i--) {
+        uint32_t carry = (a[i / 32] >> (i % 32)) & 1;
+        for (int k = 0; k <= n; k++) {
+            uint32_t next = r[k] >> 31;
+            r[k] = (r[k] << 1) | carry;
+            carry = next;
+        }
+        if (bn_compare(r, extended_modulus, n + 1) >= 0) {
+            bn_subtract(r, extended_modulus, n + 1);
+        }
+    }
+
+    memcpy(out, r, n * sizeof(uint32_t));
+    free(r);
+    free(extended_modulus);
+
+}
+
+
+/**
+ * Checks Montgomery exponentiation against 128-bit integer arithmetic for
+ * random 64-bit moduli, and against schoolbook products reduced by
+ * bn_mod_reference for every modulus size benchmarked by -E.
+ * 
+ * Returns
+ * -------
+ *   passed : 1 if every result matched, 0 if not
+ */
+int mont_self_check(void) {
+
+    uint32_t seed = 999;
+
+    for (int trial = 0; trial < 200; trial++) {
+
+        uint32_t modulus[2], base[2], exponent[2], result[2];
+        bn_random(modulus, 2, &seed);
+        bn_random(base, 2, &seed);
+        bn_random(exponent, 2, &seed);
+        modulus[0] |= 1;
+        modulus[1] |= 1;
+
+        uint64_t n = (uint64_t) modulus[1] << 32 | modulus[0];
+        uint64_t b = ((uint64_t) base[1] << 32 | base[0]) % n;
+        uint64_t e = (uint64_t) exponent[1] << 32 | exponent[0];
+        base[0] = b;
+        base[1] = b >> 32;
+
+        /* Reference result by square and multiply */
+        unsigned __int128 expected = 1, square = b;
+        for (uint64_t k = e; k > 0; k >>= 1) {
+            if (k & 1) {
+                expected = expected * square % n;
+            }
+            square = square * square % n;
+        }
+
+        struct montgomery m;
+        mont_init(&m, modulus, 2);
+        mont_pow(&m, base, exponent, 2, result);
+        mont_free(&m);
+
+        if (((uint64_t) result[1] << 32 | result[0]) != (uint64_t) expected) {
+            return 0;
+        }
+    }
+
+    /* 2048- to 16384-bit moduli, with 16-bit exponents to bound the cost of
+     * the reference */
+    for (int n = 2048 / 32; n <= 16384 / 32; n *= 2) {
+
+        uint32_t* modulus = malloc(n * sizeof(uint32_t));
+        uint32_t* base = malloc(n * sizeof(uint32_t));
+        uint32_t* result = malloc(n * sizeof(uint32_t));
+        uint32_t* expected = calloc(n, sizeof(uint32_t));
+        uint32_t* product = malloc(2 * n * sizeof(uint32_t));
+
+        bn_random(modulus, n, &seed);
+        modulus[0] |= 1;
+        modulus[n - 1] |= 0x80000000;
+        bn_random(base, n, &seed);
+        base[n - 1] &= 0x7FFFFFFF;  // Less than the modulus
+        uint32_t exponent = (random_next(&seed) >> 16) | 0x8000;
+
+        struct montgomery m;
+        mont_init(&m, modulus, n);
+        mont_pow(&m, base, &exponent, 1, result);
+        mont_free(&m);
+
+        /* Reference result by square and multiply */
+        expected[0] = 1;
+        for (int k = 15; k >= 0; k--) {
+            bn_mul_schoolbook(expected, n, expected, n, product);
+            bn_mod_reference(product, 2 * n, modulus, n, expected);
+            if ((exponent >> k) & 1) {
+                bn_mul_schoolbook(expected, n, base, n, product);
+                bn_mod_reference(product, 2 * n, modulus, n, expected);
+            }
+        }
+
+        int matched = memcmp(result, expected, n * sizeof(uint32_t)) == 0;
+        free(modulus);
+        free(base);
+        free(result);
+        free(expected);
+        free(product);
+        if (!matched) {
+            return 0;
+        }
+    }
+
+    return 1;
+
+}
+
+
+/**
+ * Multiplies many numbers by multiplying adjacent pairs, then adjacent pairs
+ * of those products, until one remains. Operands stay balanced, so the
+ * largest products are at the root, where the worker pool is used.
+ * 
+ * Parameters
+ * ----------
+ *   factors :  Numbers to multiply
+ *   lengths :  Number of limbs in each factor
+ *   count :    Number of factors
+ *   length :   Set to the number of limbs in the product
+ * 
+ * Returns
+ * -------
+ *   product : Product of every factor, allocated with malloc
+ */
+uint32_t* product_tree(uint32_t** factors, int* lengths, int count, int* length) {
+
+    /* Copy the leaves, so every level owns its numbers */
+    uint32_t** level = malloc(count * sizeof(uint32_t*));
+    int* level_lengths = malloc(count * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        level[i] = malloc(lengths[i] * sizeof(uint32_t));
+        memcpy(level[i], factors[i], lengths[i] * sizeof(uint32_t));
+        level_lengths[i] = lengths[i];
+    }
+
+    while (count > 1) {
+        int next = 0;
+        for (int i = 0; i < count; i += 2) {
+            if (i + 1 == count) {  // Odd one out moves up unchanged
+                level[next] = level[i];
+                level_lengths[next++] = level_lengths[i];
+                continue;
+            }
+            int product_length = level_lengths[i] + level_lengths[i + 1];
+            uint32_t* product = malloc(product_length * sizeof(uint32_t));
+            bn_mul(level[i], level_lengths[i], level[i + 1], level_lengths[i + 1], product);
+            free(level[i]);
+            free(level[i + 1]);
+            level[next] = product;
+            level_lengths[next++] = product_length;
+        }
+        count = next;
+    }
+
+    uint32_t* product = level[0];
+    *length = level_lengths[0];
+    free(level);
+    free(level_lengths);
+    return product;
+
+}
+
+
+/**
+ * Prints the most significant 64 bits of a big number in hexadecimal.
+ * 
+ * Parameters
+ * ----------
+ *   a :  Number to print
+ *   n :  Number of limbs
+ */
+void print_bn_prefix(const uint32_t* a, int n) {
+    while (n > 1 && a[n - 1] == 0) n--;  // Skip leading zero limbs
+    printf("%08x%08x...", a[n - 1], n > 1 ? a[n - 2] : 0);
+}
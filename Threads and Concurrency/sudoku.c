@@ -5,10 +5,472 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <unistd.h>
+#include <sched.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-void *thread_validate(int* args);
+/* The AVX2 validator is compiled for x86 and selected at runtime */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_AVX2_VALIDATOR
+#endif
+
+
+/* Output detail, set at compile time with -DVERBOSITY=<level>:
+ *   0 : Final results only
+ *   1 : Also the units or grids found invalid
+ *   2 : One line for every unit or grid */
+#ifndef VERBOSITY
+#define VERBOSITY 2
+#endif
+
+/* Unit validation */
+#define FULL_UNIT_MASK 0x3FE  // Bits 1-9 set, one for each digit
+#define UNIT_LOG_SIZE  64     // Room for the result line of a unit thread
+#define ALL_UNITS_VALID ((1u << 27) - 1)  // One bit for each of the 27 units
+
+/* Cells of each row, column and subgrid in a row-major grid, in the order of
+ * the thread responsible for them */
+static const uint8_t unit_cells[27][9] = {
+    { 0,  1,  2,  9, 10, 11, 18, 19, 20},  // Subgrids (threads 1-9)
+    { 3,  4,  5, 12, 13, 14, 21, 22, 23},
+    { 6,  7,  8, 15, 16, 17, 24, 25, 26},
+    {27, 28, 29, 36, 37, 38, 45, 46, 47},
+    {30, 31, 32, 39, 40, 41, 48, 49, 50},
+    {33, 34, 35, 42, 43, 44, 51, 52, 53},
+    {54, 55, 56, 63, 64, 65, 72, 73, 74},
+    {57, 58, 59, 66, 67, 68, 75, 76, 77},
+    {60, 61, 62, 69, 70, 71, 78, 79, 80},
+    { 0,  1,  2,  3,  4,  5,  6,  7,  8},  // Rows (threads 10-18)
+    { 9, 10, 11, 12, 13, 14, 15, 16, 17},
+    {18, 19, 20, 21, 22, 23, 24, 25, 26},
+    {27, 28, 29, 30, 31, 32, 33, 34, 35},
+    {36, 37, 38, 39, 40, 41, 42, 43, 44},
+    {45, 46, 47, 48, 49, 50, 51, 52, 53},
+    {54, 55, 56, 57, 58, 59, 60, 61, 62},
+    {63, 64, 65, 66, 67, 68, 69, 70, 71},
+    {72, 73, 74, 75, 76, 77, 78, 79, 80},
+    { 0,  9, 18, 27, 36, 45, 54, 63, 72},  // Columns (threads 19-27)
+    { 1, 10, 19, 28, 37, 46, 55, 64, 73},
+    { 2, 11, 20, 29, 38, 47, 56, 65, 74},
+    { 3, 12, 21, 30, 39, 48, 57, 66, 75},
+    { 4, 13, 22, 31, 40, 49, 58, 67, 76},
+    { 5, 14, 23, 32, 41, 50, 59, 68, 77},
+    { 6, 15, 24, 33, 42, 51, 60, 69, 78},
+    { 7, 16, 25, 34, 43, 52, 61, 70, 79},
+    { 8, 17, 26, 35, 44, 53, 62, 71, 80}
+};
+
+/* Row, column and subgrid of each cell in a row-major grid */
+static const uint8_t cell_row[81] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    8, 8, 8, 8, 8, 8, 8, 8, 8
+};
+static const uint8_t cell_col[81] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 1, 2, 3, 4, 5,
+    6, 7, 8, 0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 1, 2,
+    3, 4, 5, 6, 7, 8, 0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 1, 2, 3, 4, 5, 6, 7, 8,
+    0, 1, 2, 3, 4, 5, 6, 7, 8
+};
+static const uint8_t cell_box[81] = {
+    0, 0, 0, 1, 1, 1, 2, 2, 2, 0, 0, 0, 1, 1, 1, 2, 2, 2, 0, 0, 0, 1, 1, 1,
+    2, 2, 2, 3, 3, 3, 4, 4, 4, 5, 5, 5, 3, 3, 3, 4, 4, 4, 5, 5, 5, 3, 3, 3,
+    4, 4, 4, 5, 5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 6, 6, 6, 7, 7, 7, 8, 8, 8,
+    6, 6, 6, 7, 7, 7, 8, 8, 8
+};
+
+/* Work of one unit thread: the grid it reads and the bitmap it writes */
+struct unit_task {
+    const uint8_t* grid;
+    atomic_uint* valid_units;  // Bit u is set once unit u is found valid
+    atomic_int* invalid_found; // Set once any unit is found invalid
+    int fail_fast;             // Skip the unit if another was already found invalid
+    int unit;                  // Index into unit_cells, the thread number - 1
+    char log[UNIT_LOG_SIZE];   // Result line, printed in unit order after the join
+};
+
+/* State of the bitset solver. Digit v is used in a unit if bit v of its
+ * mask is set, so the candidates of an empty cell are the bits missing from
+ * its row, column and subgrid. */
+struct solver_state {
+    uint8_t grid[81];   // 0 marks an empty cell
+    uint16_t rows[9], cols[9], boxes[9];
+    int empty;          // Number of empty cells
+    int next_cell;      // Empty cell with the fewest candidates, set by solver_propagate
+};
+
+/* Dancing links exact-cover matrix. Nodes live in flat arrays and link to
+ * each other by index: node 0 is the root, nodes 1 to num_columns are the
+ * column headers, and the nodes of the rows follow. Primary columns must be
+ * covered exactly once; secondary columns at most once. */
+struct dlx {
+    int* left;
+    int* right;
+    int* up;
+    int* down;
+    int* column;          // Column header of each node
+    int* row;             // Row id of each node
+    int* size;            // Number of nodes in each column, by header index
+    int num_columns, num_nodes;
+    int max_columns, max_nodes;
+    int* partial;         // Row ids of the partial solution being searched
+    int depth;
+    int* solution;        // Row ids of the first solution found
+    int solution_length;
+    long found;           // Number of solutions found so far
+    long limit;           // Search stops once this many are found
+};
+
+/* Parallel search. Subtrees above the split depth become tasks; below it
+ * each task is searched sequentially */
+#define SPLIT_DEPTH   4    // Number of branch levels split into tasks
+#define DEQUE_TASKS   256  // Capacity of each thread's task deque
+
+/* Subtree of the search, given by the state at its root */
+struct search_task {
+    struct solver_state state;
+    int depth;  // Number of branches taken to reach the state
+};
+
+/* Deque of search tasks. Its owner pushes and pops at the bottom, and other
+ * threads steal the oldest, largest subtrees from the top */
+struct task_deque {
+    struct search_task tasks[DEQUE_TASKS];
+    int top, bottom;
+    pthread_mutex_t lock;
+};
+
+/* Shared state of a parallel search */
+struct parallel_search {
+    int num_threads;
+    struct task_deque* deques;   // One for each thread
+    long limit;                  // Stop after this many solutions, or 0 to count them all
+    atomic_long pending;         // Number of tasks queued or running
+    atomic_long solutions;       // Number of solutions found
+    atomic_long steals;          // Number of tasks taken from another thread
+    atomic_int cancel;           // Set once the limit is reached
+    atomic_int have_solution;    // Set by the thread that stores the first solution
+    uint8_t solution[81];
+};
+
+/* Worker thread of a parallel search */
+struct search_worker {
+    struct parallel_search* search;
+    int id;
+    uint32_t seed;  // Chooses the threads to steal from
+};
+
+/* Candidate digits of an empty cell, as bits 1-9 */
+#define CANDIDATES(state, cell) \
+    (FULL_UNIT_MASK & ~((state)->rows[cell_row[cell]] | (state)->cols[cell_col[cell]] | (state)->boxes[cell_box[cell]]))
+
+/* Sudoku as exact cover: each row of the matrix places one digit in one
+ * cell, and each unit adds one column per digit */
+#define DLX_CELL_COLUMNS 324     // Cell, row-digit, column-digit and box-digit constraints
+#define MAX_EXTRA_UNITS  4       // Extra units a variant may add
+#define DLX_MAX_COLUMNS  (DLX_CELL_COLUMNS + 9 * MAX_EXTRA_UNITS)
+#define DLX_MAX_NODES    (1 + DLX_MAX_COLUMNS + 729 * 5)
+
+/* Sudoku variants, each adding extra units that must hold every digit */
+enum variant { STANDARD, DIAGONAL, WINDOKU, NUM_VARIANTS };
+static const char* variant_names[NUM_VARIANTS] = {"standard", "diagonal", "windoku"};
+static const int variant_units[NUM_VARIANTS] = {0, 2, 4};
+static const uint8_t variant_cells[NUM_VARIANTS][MAX_EXTRA_UNITS][9] = {
+    {{0}},
+    {{0, 10, 20, 30, 40, 50, 60, 70, 80},    // Main diagonal
+     {8, 16, 24, 32, 40, 48, 56, 64, 72}},   // Anti-diagonal
+    {{10, 11, 12, 19, 20, 21, 28, 29, 30},   // Windows offset one cell from the subgrids
+     {14, 15, 16, 23, 24, 25, 32, 33, 34},
+     {46, 47, 48, 55, 56, 57, 64, 65, 66},
+     {50, 51, 52, 59, 60, 61, 68, 69, 70}}
+};
+
+/* Grid sizes with n x n boxes, from 4x4 (n = 2) to 36x36 (n = 6) */
+#define MIN_BOX   2
+#define MAX_BOX   6
+#define MAX_SIDE  (MAX_BOX * MAX_BOX)
+#define MAX_CELLS (MAX_SIDE * MAX_SIDE)
+
+/* Bulk validation */
+#define BULK_CHUNK   65536  // Number of grids read before they are validated
+#define BULK_BATCH   1024   // Number of grids in each task
+#define MAX_THREADS  256    // Maximum number of worker threads
+#define POOL_QUEUE   1024   // Maximum number of queued tasks
+#define GRID_LOG_SIZE 40    // Longest result line of a grid in bulk mode
+
+/* File of grids mapped into memory and decoded in place */
+struct grid_file {
+    const char* data;  // Contents of the file, mapped read-only
+    size_t size;
+    size_t offset;     // Position of the next unread byte
+    long line;         // Line number at the offset, for error messages
+    int simd;          // Decode 81-character lines with SIMD when available
+    int packed_box;    // Box size of a packed binary file, 0 for a text file
+    long packed_count; // Number of grids in a packed binary file
+};
+
+/* Packed binary grids: two cells per byte, the first in the low nibble, so
+ * 41 bytes hold a 9x9 grid. 0 marks a blank cell, and values that do not fit
+ * in a nibble are stored as 15, which no validator accepts. A file starts
+ * with a header giving the number of grids and the box size, or has none and
+ * holds 9x9 grids if its name ends in PACKED_SUFFIX. */
+#define PACKED_MAGIC       "SDK4"
+#define PACKED_HEADER_SIZE 16     // Magic, 32-bit little-endian count, box size, reserved
+#define PACKED_SUFFIX      ".pk4"
+#define PACKED_BYTES(cells) (((cells) + 1) / 2)
+
+/* Grids shared with the worker threads, and one result for each */
+struct grid_set {
+    uint8_t (*grids)[81];
+    uint8_t* results;          // 1 if the grid is valid, 0 if not
+    int fail_fast;             // Stop validating after the first invalid grid
+    atomic_long first_invalid; // Index of the first invalid grid found, in fail-fast mode
+};
+
+/* Task run by a pool thread: a function applied to a range of items */
+struct pool_task {
+    void (*function)(void* data, long first, long last);
+    void* data;
+    long first, last;
+};
+
+/* Persistent pool of worker threads taking tasks from a bounded queue */
+struct thread_pool {
+    int num_threads;
+    pthread_t threads[MAX_THREADS];
+    struct pool_task tasks[POOL_QUEUE];  // Circular queue of tasks
+    int head, tail, queued;
+    long pending;                // Number of tasks submitted but not finished
+    int stopping;                // Set when the threads should exit
+    pthread_mutex_t lock;
+    pthread_cond_t task_ready;   // Signalled when a task is queued
+    pthread_cond_t space_ready;  // Signalled when a task is taken from a full queue
+    pthread_cond_t all_done;     // Signalled when the last pending task finishes
+};
+
+/* Pipeline validation */
+#define PIPELINE_BATCH 1024  // Default number of grids in each batch
+#define PIPELINE_DEPTH 16    // Default number of batches in flight
+#define MAX_BATCH      65536
+#define MAX_DEPTH      1024
+
+/* Batch of grids passed between the stages of the pipeline */
+struct grid_batch {
+    long seq;              // Position of the batch in the file
+    long count;            // Number of grids in the batch
+    uint8_t (*grids)[81];
+    uint8_t* results;      // 1 if the grid is valid, 0 if not
+};
+
+/* Bounded lock-free queue of batches for any number of producers and
+ * consumers. Each slot has a sequence number telling whether it is ready to
+ * be written for position pos (seq == pos) or read (seq == pos + 1). */
+struct batch_ring {
+    _Alignas(64) atomic_size_t head;  // Position of the next batch to take
+    _Alignas(64) atomic_size_t tail;  // Position of the next batch to add
+    _Alignas(64) size_t mask;         // Capacity - 1, a power of two - 1
+    atomic_size_t* seq;
+    struct grid_batch** batches;
+};
+
+/* Reader, validator and writer stages connected by rings. Batches go from
+ * the free ring to the reader, through the full ring to the validators and
+ * through the done ring to the writer, which returns them in file order. */
+struct pipeline {
+    struct batch_ring free, full, done;
+    struct grid_batch* batches;
+    int depth;                 // Number of batches, which bounds every ring
+    int batch_size;            // Maximum number of grids in a batch
+    int print;                 // Write a result line for each grid
+    atomic_long num_batches;   // Batches read, set once the reader finishes
+    long total, num_valid;     // Counted by the writer
+};
+
+/* Grid that is edited one cell at a time, with the digits of each unit
+ * counted so a move only updates the three units of its cell */
+struct move_tracker {
+    uint8_t grid[81];          // 0 marks an empty cell
+    uint8_t counts[27][10];    // Number of times each digit appears in each unit
+    uint16_t masks[27];        // Bit d is set if digit d appears in the unit
+    uint8_t repeats[27];       // Number of digits appearing more than once in each unit
+    uint32_t conflict_units;   // Bit u is set if unit u has a repeated digit
+    int conflicts;             // Number of repeated digits over all units
+    int filled;                // Number of filled cells
+    int bad_values;            // Number of cells holding a value other than 0-9
+};
+
+/* A move, holding what it replaced so it can be undone */
+struct move {
+    uint8_t cell;
+    uint8_t digit;
+    uint8_t previous;
+};
+
+/* Puzzle generation */
+#define MIN_CLUES         17   // No 9x9 puzzle with fewer clues has a unique solution
+#define GENERATE_ATTEMPTS 1000 // Solutions tried for each puzzle before giving up on the target
+#define GENERATE_BATCH    64   // Puzzles generated before they are printed
+
+/* Puzzles generated by the pool threads, one per task */
+struct puzzle_set {
+    uint32_t seed;             // Seed of the run, from which each puzzle's seed is derived
+    int target;                // Clues of each puzzle, or 0 for minimal puzzles
+    long first;                // Number of puzzle 0 of the set in the run
+    int search_threads;        // Threads of each uniqueness check, more than 1 when puzzles are fewer than threads
+    uint8_t (*puzzles)[81];
+    int* clues;                // Clues of each puzzle, or 0 if the target was not reached
+    long* attempts;            // Solutions tried for each puzzle
+};
+
+int validate_file(char* filename, int fail_fast);
+void *thread_validate(void* args);
+int validate_unit_cells(const uint8_t* grid, int unit);
+int validate_unit_mask(const int* values);
+int validate_unit_pairwise(const int* values);
+
+/* Whole-grid validation of a flat row-major array of 81 cells */
+int validate_grid_scalar(const uint8_t* grid);
+#ifdef HAVE_AVX2_VALIDATOR
+int validate_grid_avx2(const uint8_t* grid);
+#endif
+void select_grid_validator(void);
+
+/* Consistency and candidates of partially filled 9x9 grids */
+int grid_candidates_scalar(const uint8_t* grid, uint16_t* candidates);
+#ifdef HAVE_AVX2_VALIDATOR
+int grid_candidates_avx2(const uint8_t* grid, uint16_t* candidates);
+#endif
+int (*grid_candidates)(const uint8_t* grid, uint16_t* candidates) = grid_candidates_scalar;  // Fastest version for this CPU
+void run_candidates(char* filename);
+void run_candidates_benchmark(long iterations);
+
+/* Validation of grids with n x n boxes */
+int validate_grid_generic(const uint8_t* grid, int box);
+int validate_grid_box2(const uint8_t* grid);
+int validate_grid_box4(const uint8_t* grid);
+int validate_grid_box5(const uint8_t* grid);
+int validate_grid_box6(const uint8_t* grid);
+int (*validator_for_box(int box))(const uint8_t* grid);
+int (*validate_grid)(const uint8_t* grid) = validate_grid_scalar;  // Fastest validator for this CPU
+const char* grid_validator_name = "scalar";
+
+int run_mode(int argc, char* argv[]);
+void print_usage(void);
+double now_seconds(void);
+uint32_t random_next(uint32_t* state);
+void run_kernel_benchmark(long iterations);
+void random_solution(uint8_t* grid, uint32_t* seed);
+void shuffle(int* values, int count, uint32_t* seed);
+void random_solution_box(uint8_t* grid, int box, uint32_t* seed);
+void run_grid_benchmark(long iterations);
+void grid_file_open(struct grid_file* file, const char* filename);
+void grid_file_close(struct grid_file* file);
+int parse_grid(struct grid_file* file, uint8_t* grid);
+int parse_cells(struct grid_file* file, uint8_t* grid, int num_cells);
+int decode_line_scalar(const char* text, uint8_t* grid, int num_cells);
+#ifdef __SSE2__
+int decode_line_sse2(const char* text, uint8_t* grid);
+#endif
+void pack_cells(const uint8_t* grid, uint8_t* packed, int num_cells);
+void unpack_cells_scalar(const uint8_t* packed, uint8_t* grid, int num_cells);
+#ifdef __SSE2__
+void unpack_grid_sse2(const uint8_t* packed, uint8_t* grid);
+#endif
+void run_pack(char* text_filename, char* packed_filename, int box, int header);
+void run_parse_benchmark(char* filename);
+void run_sized_file(int box, char* filename);
+void run_size_benchmark(long iterations);
+void validate_range(void* data, long first, long last);
+void run_bulk(char* filename, int num_threads, int fail_fast);
+size_t format_grid_results(char* out, long number, const uint8_t* results, long count);
+int default_threads(void);
+void thread_pool_start(struct thread_pool* pool, int num_threads);
+void* thread_pool_worker(void* args);
+void thread_pool_submit(struct thread_pool* pool, void (*function)(void*, long, long), void* data, long first, long last);
+void thread_pool_wait(struct thread_pool* pool);
+void thread_pool_stop(struct thread_pool* pool);
+void* unit_thread(void* args);
+int validate_grid_threaded(const uint8_t* grid, int fail_fast);
+void run_pool_benchmark(long num_grids, int num_threads);
+
+/* Reader, validator and writer pipeline */
+void batch_ring_init(struct batch_ring* ring, int capacity);
+void batch_ring_free(struct batch_ring* ring);
+int batch_ring_push(struct batch_ring* ring, struct grid_batch* batch);
+struct grid_batch* batch_ring_pop(struct batch_ring* ring);
+void batch_ring_push_wait(struct batch_ring* ring, struct grid_batch* batch);
+struct grid_batch* batch_ring_pop_wait(struct batch_ring* ring);
+void* pipeline_validator(void* args);
+void* pipeline_writer(void* args);
+double run_pipeline(char* filename, int num_threads, int batch_size, int depth, int print);
+void run_pipeline_benchmark(char* filename, int num_threads);
+
+/* Incremental move validation */
+void tracker_init(struct move_tracker* tracker, const uint8_t* grid);
+void tracker_add(struct move_tracker* tracker, int cell, int digit);
+void tracker_remove(struct move_tracker* tracker, int cell, int digit);
+struct move tracker_apply(struct move_tracker* tracker, int cell, int digit);
+void tracker_undo(struct move_tracker* tracker, struct move move);
+int tracker_consistent(const struct move_tracker* tracker);
+int tracker_solved(const struct move_tracker* tracker);
+int tracker_equal(const struct move_tracker* a, const struct move_tracker* b);
+int count_conflicts_scan(const uint8_t* grid);
+void print_unit_name(int unit);
+void run_edit(char* filename);
+void run_move_benchmark(long iterations);
+
+/* Puzzle generation */
+int remove_clues(uint8_t* puzzle, int target, int num_threads, uint32_t* seed);
+void generate_range(void* data, long first, long last);
+void run_generate(long num_puzzles, int target, int num_threads, uint32_t seed);
+
+/* Bitset solver for 9x9 puzzles, with 0 marking blank cells */
+int solver_init(struct solver_state* state, const uint8_t* puzzle);
+void solver_place(struct solver_state* state, int cell, int digit);
+int solver_propagate(struct solver_state* state);
+long solver_count(struct solver_state* state, long limit, uint8_t* solution, atomic_int* cancel);
+int check_solution(const uint8_t* puzzle, const uint8_t* solution);
+void run_solve(char* filename);
+
+/* Parallel work-stealing search */
+int deque_push(struct task_deque* deque, const struct search_task* task);
+int deque_pop(struct task_deque* deque, struct search_task* task);
+int deque_steal(struct task_deque* deque, struct search_task* task);
+void record_solutions(struct parallel_search* search, long found, const uint8_t* solution);
+void process_task(struct parallel_search* search, int id, struct search_task* task);
+void* search_worker(void* args);
+long parallel_count(const uint8_t* puzzle, int num_threads, long limit, uint8_t* solution, long* steals);
+void run_count(char* filename, int num_threads, long limit);
+
+/* Dancing links exact-cover engine, with sudoku and its variants built on it */
+struct dlx* dlx_create(int max_columns, int max_nodes);
+void dlx_free(struct dlx* dlx);
+void dlx_reset(struct dlx* dlx, int num_primary, int num_secondary);
+void dlx_add_row(struct dlx* dlx, int row_id, const int* columns, int count);
+void dlx_cover(struct dlx* dlx, int c);
+void dlx_uncover(struct dlx* dlx, int c);
+void dlx_search(struct dlx* dlx);
+long dlx_solve(struct dlx* dlx, long limit);
+int parse_variant(const char* name);
+void dlx_build_sudoku(struct dlx* dlx, const uint8_t* puzzle, int variant);
+long dlx_solve_sudoku(struct dlx* dlx, const uint8_t* puzzle, int variant, long limit, uint8_t* solution);
+int check_variant_solution(const uint8_t* puzzle, const uint8_t* solution, int variant);
+void run_dlx_solve(char* filename, int variant);
+void run_solver_benchmark(char* filename);
 
 /**
  * Program validates a 9x9 sudoku puzzle solution using basic threading
@@ -23,175 +485,147 @@ void *thread_validate(int* args);
  */
 int main(int argc, char * argv[]) {
 
+    /* Flags select one of the benchmark modes */
+    if (argc > 1 && argv[1][0] == '-' && isalpha((unsigned char) argv[1][1])) {
+        return run_mode(argc, argv);
+    }
+
     /* Validate input */
     if (argc != 2) {
         printf("Invalid number of arguments recieved.");
         exit(0);
     }
 
+    validate_file(argv[1], 0);
+    return 0;
 
-    /* Allocate memory for the sudoku grid as a 2D array of integers */
-    int** sudoku_grid = (int**)malloc(9*sizeof(int*));
-    for (int row = 0; row < 9; row++) {
-        sudoku_grid[row] = (int*)malloc(9*sizeof(int));
-    }
-
-    /* Read sudoku solution from file */
-    FILE* file_pointer = fopen(argv[1], "r");  // Open file
-
-    int row = 0, col = 0;
-    while (row < 9 && col < 9) {
-
-        /* Read a single integer and store in the grid */
-        fscanf(file_pointer, " %d", &sudoku_grid[row][col]);  
-
-        if (col == 8) {  // At the end of the row
-            row++; // Move to the beginning of the next row
-            col = 0;
-        }
-        else {
-            col++;
-        }
-    }
-
-    fclose(file_pointer);  // Close file
-
-
-    /* Allocate memory to store the data to be processed by each thread and the thread's number */
-    int** thread_data = (int**)malloc(27*sizeof(int*));
-    for (int row = 0; row < 27; row++) {
-        thread_data[row] = (int*)malloc(10*sizeof(int));
-        thread_data[row][9] = row + 1; // Corresponding thread number
-    }
-
-    /* Divide data between threads */
-    int index = 0;  // Thread's coresponding index in data array
-
-    /* Subgrids (Threads 1-9) */
-    int i = 0, j = 0;  // Used to iterate over rows in columns in the sudoku board
-    int k = 0;         // Used to iterate over positions in the thread data array
-    while (index < 9) {  // Repeat until all 9 subgrids have been added
-
-        for (int row = 3*i; row < 3*(i+1); row++) {  // Iterate over rows in groups of 3
-
-            for (int col = 3*j; col < 3*(j+1); col++) {  // Iterate over columns in groups of 3
-                thread_data[index][k] = sudoku_grid[row][col];
-                k++;
-            }
-
-        }
+}
 
-        j++;      // Move to next group of 3 columns
-        index++;  // Add data to next thread's array
-        k = 0;    // Begin at first index of the array
 
-        if (index % 3 == 0) {  // Last subgrid in a row
-            i++;    // Move to next row of subgrids
-            j = 0;  // Restart from beginning of the row
-        }
+/**
+ * Validates the grid in a file with 27 threads, one for each row, column and
+ * subgrid, and prints each thread's result followed by the final result.
+ * 
+ * In fail-fast mode, once any thread finds an invalid unit, no more threads
+ * are created and threads that have not started checking their unit skip it.
+ * 
+ * Parameters
+ * ----------
+ *   filename :  File containing the grid
+ *   fail_fast : 1 to stop at the first invalid unit, 0 to check every unit
+ * 
+ * Returns
+ * -------
+ *   valid : 1 if the grid is a valid solution, 0 if not
+ */
+int validate_file(char* filename, int fail_fast) {
 
+    /* Read sudoku solution from file into a flat row-major grid */
+    struct grid_file file;
+    uint8_t sudoku_grid[81];
+    grid_file_open(&file, filename);
+    if (!parse_grid(&file, sudoku_grid)) {
+        printf("Error: %s does not contain a grid.\n", filename);
+        exit(0);
     }
+    grid_file_close(&file);
 
-    /* Rows (Threads 10-18) */
-    for (int grid_row = 0; grid_row < 9; grid_row++) {
-
-        for (int i = 0; i < 9; i++) {  // Store row data from sudoku grid in data array
-            thread_data[index][i] = sudoku_grid[grid_row][i];
-        }
 
-        index++;  // Increment row in thread data array
+    /* Each thread is given the grid and the index of its unit in the unit
+    tables: subgrids are threads 1-9, rows 10-18 and columns 19-27 */
+    struct unit_task tasks[27];
+    atomic_uint valid_units = 0;  // Bitmap of the units found valid
+    atomic_int invalid_found = 0; // Set by the first thread to find an invalid unit
 
+    for (int index = 0; index < 27; index++) {
+        tasks[index].grid = sudoku_grid;
+        tasks[index].valid_units = &valid_units;
+        tasks[index].invalid_found = &invalid_found;
+        tasks[index].fail_fast = fail_fast;
+        tasks[index].unit = index;
+        tasks[index].log[0] = '\0';
     }
 
-    /* Columns (Threads 19-27) */
-    for (int grid_col = 0; grid_col < 9; grid_col++) {
-
-        for (int i = 0; i < 9; i++) {  // Store column data from sudoku grid in data array
-            thread_data[index][i] = sudoku_grid[i][grid_col];
-        }
-
-        index++;  // Increment row in thread data array
-
-    }
-  
 
     /* Create threads to validate each row/column/subgrid */
     pthread_t threads[27];  // Stores the threads created
-    int* valid[27];         // Boolean results returned from each thread
+    int num_created = 0;    // Fewer than 27 if fail-fast mode stopped early
     
     for (int index = 0; index < 27; index++) {
-        if (pthread_create(&threads[index], NULL, thread_validate, thread_data[index])) {
+        if (fail_fast && atomic_load(&invalid_found)) {
+            break;  // The result is already known
+        }
+        if (pthread_create(&threads[index], NULL, thread_validate, &tasks[index])) {
             printf("Error creating threads.");
         }
+        num_created++;
     }
 
     /* Join threads before continuing */
-    for (int i = 0; i < 27; i++) {
-        if (pthread_join(threads[i], (void**) &valid[i]) != 0) {
+    for (int i = 0; i < num_created; i++) {
+        if (pthread_join(threads[i], NULL) != 0) {
             printf("Error joining threads.");
         }
     }
 
+    /* Print each thread's result line in unit order */
+    for (int i = 0; i < num_created; i++) {
+        fputs(tasks[i].log, stdout);
+    }
 
-    /* Determine correctness of the full solution by checking if any
-    row/column/subgrid was invalid */
-    char* result_str = "a valid"; // String representation of the result
-    for (int i = 0; i < 27; i++) {  // Iterate over each result
-
-        if (*valid[i] == 0) {  // Invalid row/column/subgrid was found
-            result_str = "an INVALID";
-            break;  // Do not continue checking other results
 
-        }
-    }
+    /* The solution is correct if every row/column/subgrid was valid */
+    int valid = atomic_load(&valid_units) == ALL_UNITS_VALID;
+    char* result_str = valid ? "a valid" : "an INVALID"; // String representation of the result
 
     /* Print the final result */
-    printf("\n%s contains %s solution\n", argv[1], result_str);
-
-    /* Free dynamically allocated memory*/
-    free(sudoku_grid);
-    free(thread_data);
-    for (int i = 0; i < 27; i++) {
-        free(valid[i]);
+    if (num_created < 27) {
+        printf("Stopped after %d of 27 threads\n", num_created);
     }
+    printf("\n%s contains %s solution\n", filename, result_str);
 
-    return 0;
+    return valid;
 
 }
 
 
 /**
  * Determines if a single row/column/subgrid of the sudoku grid is valid, and
- * outputs the result. A row/column/subgrid is valid if it contains no repeated
- * digits.
+ * writes the result line into the task's log. A row/column/subgrid is valid
+ * if it contains no repeated digits. Valid units set their bit in the shared
+ * bitmap, so no memory is allocated for the result. The log is printed by the
+ * main thread after the join, so threads never contend for stdout, and lines
+ * above the compile-time VERBOSITY are not formatted at all.
  * 
  * Parameters
  * ----------
- *   args : Array where the first 9 elements are the numbers in the
- *          row/column/subgrid, and the final digit is the thread number.
+ *   args : Unit task giving the grid, the bitmap of valid units, the flag
+ *          set when a unit is invalid, and the unit to check, whose index
+ *          is the thread number - 1.
  * Returns
  * -------
- *   valid : 1 if the row/column/subgrid is valid, 0 if not.
+ *   NULL
  */
-void *thread_validate(int* args) {
-
-    int thread_num = args[9];
-
-    /* Allocate memory to store the result */
-    int* valid = malloc(sizeof(int));
-    *valid = 1;  // Boolean indicating if the row/column/subgrid is valid
+void *thread_validate(void* args) {
 
-    /* Check for repeated digits in the given array */ 
-    for (int i = 0; i < 9; i++) {  // Iterate over each value in the array
+    struct unit_task* task = args;
 
-        for (int j = 0; j < 9; j++) {  // Compare value to each other value in the array
+    /* Check for repeated or out of range digits in the unit, unless another
+    thread has already shown the solution is invalid */
+    int skipped = task->fail_fast && atomic_load(task->invalid_found);
+    int valid = !skipped && validate_unit_cells(task->grid, task->unit);
+    if (valid) {
+        atomic_fetch_or(task->valid_units, 1u << task->unit);
+    }
+    else if (!skipped) {
+        atomic_store(task->invalid_found, 1);
+    }
 
-            if (i != j && args[i]==args[j]) {  // Same value found in another position
-                *valid = 0;  // Row/column/subgrid is invalid
-                break;
-            }
-        }
+#if VERBOSITY >= 1
+    if (VERBOSITY < 2 && (valid || skipped)) {
+        return NULL;
     }
+    int thread_num = task->unit + 1;
 
     /* Determine which region of the sudoku grid was validated based on thread number */
     char* type;   // Whether the region is a row, column, or subgrid
@@ -211,9 +645,12 @@ void *thread_validate(int* args) {
 
     /* Define string to print depending on result */
     char* result_str;  // String representation of the result
-    if (*valid == 1) {
+    if (valid) {
         result_str = "valid";
     }
+    else if (skipped) {
+        result_str = "skipped";
+    }
     else {
         result_str = "INVALID";
     }
@@ -224,9 +661,4281 @@ void *thread_validate(int* args) {
         padding = 1;
     }
 
-    /* Print result */
-    printf("Thread # %*s%d (%s %d) is %s\n", padding, "", thread_num, type, num, result_str);
+    /* Log result */
+    snprintf(task->log, UNIT_LOG_SIZE, "Thread # %*s%d (%s %d) is %s\n", padding, "", thread_num, type, num, result_str);
+#endif
+
+    return NULL;
+
+}
+
+
+/**
+ * Determines if a single row/column/subgrid of a flat grid contains each
+ * digit 1-9 exactly once, reading its cells through the unit tables.
+ * 
+ * Parameters
+ * ----------
+ *   grid : The 81 cells of the grid in row-major order
+ *   unit : Index of the row/column/subgrid in the unit tables
+ * 
+ * Returns
+ * -------
+ *   valid : 1 if the row/column/subgrid is valid, 0 if not.
+ */
+int validate_unit_cells(const uint8_t* grid, int unit) {
+
+    const uint8_t* cells = unit_cells[unit];
+    unsigned mask = 0;          // Bit v is set if digit v was seen
+    unsigned out_of_range = 0;  // Nonzero if any value is not a digit 1-9
+
+    for (int i = 0; i < 9; i++) {
+        unsigned value = grid[cells[i]];
+        out_of_range |= value - 1 > 8;
+        mask |= 1u << (value & 15);
+    }
+
+    return mask == FULL_UNIT_MASK && !out_of_range;
+
+}
+
+
+/**
+ * Determines if a single row/column/subgrid contains each digit 1-9 exactly
+ * once, by setting bit v of a mask for each value v. Nine distinct digits in
+ * range set exactly bits 1-9, so a single comparison checks the whole unit.
+ * 
+ * Parameters
+ * ----------
+ *   values : The 9 numbers in the row/column/subgrid
+ * 
+ * Returns
+ * -------
+ *   valid : 1 if the row/column/subgrid is valid, 0 if not.
+ */
+int validate_unit_mask(const int* values) {
+
+    unsigned mask = 0;          // Bit v is set if digit v was seen
+    unsigned out_of_range = 0;  // Nonzero if any value is not a digit 1-9
+
+    for (int i = 0; i < 9; i++) {
+        out_of_range |= (unsigned) (values[i] - 1) > 8;
+        mask |= 1u << (values[i] & 15);  // Masked so the shift is always defined
+    }
+
+    return mask == FULL_UNIT_MASK && !out_of_range;
+
+}
+
+
+/**
+ * Determines if a single row/column/subgrid contains no repeated values by
+ * comparing every pair of values. This is the original kernel, kept for
+ * comparison in the benchmark. It does not check that values are in range.
+ * 
+ * Parameters
+ * ----------
+ *   values : The 9 numbers in the row/column/subgrid
+ * 
+ * Returns
+ * -------
+ *   valid : 1 if no value is repeated, 0 if not.
+ */
+int validate_unit_pairwise(const int* values) {
+
+    for (int i = 0; i < 9; i++) {  // Iterate over each value in the array
+
+        for (int j = 0; j < 9; j++) {  // Compare value to each other value in the array
+
+            if (i != j && values[i] == values[j]) {  // Same value found in another position
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+
+}
+
+
+/**
+ * Determines if a full 9x9 grid is a valid solution in a single pass, by
+ * building the digit bitmask of every row, column and subgrid at once.
+ * 
+ * Parameters
+ * ----------
+ *   grid : The 81 cells of the grid in row-major order
+ * 
+ * Returns
+ * -------
+ *   valid : 1 if every row, column and subgrid is valid, 0 if not.
+ */
+int validate_grid_scalar(const uint8_t* grid) {
+
+    uint16_t rows[9] = {0}, cols[9] = {0}, boxes[9] = {0};  // Digit bitmask of each unit
+    unsigned out_of_range = 0;  // Nonzero if any cell is not a digit 1-9
+
+    for (int row = 0; row < 9; row++) {
+        for (int col = 0; col < 9; col++) {
+            unsigned value = grid[9*row + col];
+            uint16_t bit = 1u << (value & 15);
+            out_of_range |= value - 1 > 8;
+            rows[row] |= bit;
+            cols[col] |= bit;
+            boxes[3*(row/3) + col/3] |= bit;
+        }
+    }
+
+    unsigned combined = FULL_UNIT_MASK;  // Stays full only if every unit is full
+    for (int i = 0; i < 9; i++) {
+        combined &= rows[i] & cols[i] & boxes[i];
+    }
+
+    return combined == FULL_UNIT_MASK && !out_of_range;
+
+}
+
+
+#ifdef HAVE_AVX2_VALIDATOR
+/**
+ * Determines if a full 9x9 grid is a valid solution using AVX2.
+ * 
+ * Each cell is mapped with a byte shuffle to a bit for digits 1-8 and to no
+ * bit for digit 9. Once every cell is known to hold a digit 1-9, a unit is
+ * valid exactly when the OR of its bits is 0xFF and its digits sum to 45: the
+ * OR shows digits 1-8 are present, which leaves one cell whose value the sum
+ * forces to be 9. Columns and subgrids combine whole rows with vector OR and
+ * byte addition, and rows are reduced two at a time, one per 128-bit lane.
+ * 
+ * Parameters
+ * ----------
+ *   grid : The 81 cells of the grid in row-major order. Only these 81 bytes
+ *          are read.
+ * 
+ * Returns
+ * -------
+ *   valid : 1 if every row, column and subgrid is valid, 0 if not.
+ */
+__attribute__((target("avx2")))
+int validate_grid_avx2(const uint8_t* grid) {
+
+    /* Every cell must hold a digit 1-9; the last load overlaps the second */
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i eight = _mm256_set1_epi8(8);
+    __m256i in_range = _mm256_set1_epi8(-1);
+    const int offsets[3] = {0, 32, 49};
+    for (int i = 0; i < 3; i++) {
+        __m256i shifted = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*) (grid + offsets[i])), one);
+        in_range = _mm256_and_si256(in_range, _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, eight), shifted));
+    }
+    if (_mm256_movemask_epi8(in_range) != -1) {
+        return 0;
+    }
+
+    /* Load each row into the low 9 bytes of a register. The last row is
+     * loaded from an earlier offset and shifted down, to stay within the grid */
+    const __m128i keep_row = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i digit_bits = _mm_setr_epi8(0, 1, 2, 4, 8, 16, 32, 64, (char) 128, 0, 0, 0, 0, 0, 0, 0);
+    __m128i values[9], bits[9];
+    for (int row = 0; row < 8; row++) {
+        values[row] = _mm_and_si128(_mm_loadu_si128((const __m128i*) (grid + 9*row)), keep_row);
+    }
+    values[8] = _mm_srli_si128(_mm_loadu_si128((const __m128i*) (grid + 65)), 7);
+    for (int row = 0; row < 9; row++) {
+        bits[row] = _mm_shuffle_epi8(digit_bits, values[row]);
+    }
+
+    /* Rows, two per register; the last register holds row 8 twice */
+    const __m256i full_bits = _mm256_set1_epi8(-1);
+    const __m256i row_sum = _mm256_set1_epi64x(45);
+    int rows_valid = 1;
+    for (int row = 0; row < 9; row += 2) {
+        int other = row < 8 ? row + 1 : row;
+        __m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(bits[row]), bits[other], 1);
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(values[row]), values[other], 1);
+        b = _mm256_or_si256(b, _mm256_srli_si256(b, 1));
+        b = _mm256_or_si256(b, _mm256_srli_si256(b, 2));
+        b = _mm256_or_si256(b, _mm256_srli_si256(b, 4));
+        b = _mm256_or_si256(b, _mm256_srli_si256(b, 8));  // Byte 0 of each lane holds the row's OR
+        __m256i sums = _mm256_sad_epu8(v, _mm256_setzero_si256());
+        sums = _mm256_add_epi64(sums, _mm256_srli_si256(sums, 8));  // Quadword 0 of each lane holds the row's sum
+        int or_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(b, full_bits));
+        int sum_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi64(sums, row_sum));
+        rows_valid &= (or_mask & 0x00010001) == 0x00010001 && (sum_mask & 0x00010001) == 0x00010001;
+    }
+
+    /* Columns and the three bands of rows that hold the subgrids */
+    __m128i column_bits = _mm_setzero_si128(), column_sums = _mm_setzero_si128();
+    __m128i box_bits[3], box_sums[3];
+    for (int band = 0; band < 3; band++) {
+        box_bits[band] = _mm_or_si128(_mm_or_si128(bits[3*band], bits[3*band + 1]), bits[3*band + 2]);
+        box_sums[band] = _mm_add_epi8(_mm_add_epi8(values[3*band], values[3*band + 1]), values[3*band + 2]);
+        column_bits = _mm_or_si128(column_bits, box_bits[band]);
+        column_sums = _mm_add_epi8(column_sums, box_sums[band]);
+    }
+    int columns = _mm_movemask_epi8(_mm_cmpeq_epi8(column_bits, _mm_set1_epi8(-1)))
+                & _mm_movemask_epi8(_mm_cmpeq_epi8(column_sums, _mm_set1_epi8(45)));
+
+    /* Each subgrid combines three adjacent columns of its band, so bytes 0, 3
+     * and 6 hold the results for the band's three subgrids */
+    int boxes = 0x49;
+    for (int band = 0; band < 3; band++) {
+        __m128i b = box_bits[band], v = box_sums[band];
+        b = _mm_or_si128(_mm_or_si128(b, _mm_srli_si128(b, 1)), _mm_srli_si128(b, 2));
+        v = _mm_add_epi8(_mm_add_epi8(v, _mm_srli_si128(v, 1)), _mm_srli_si128(v, 2));
+        boxes &= _mm_movemask_epi8(_mm_cmpeq_epi8(b, _mm_set1_epi8(-1)))
+               & _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(45)));
+    }
+
+    return rows_valid && (columns & 0x1FF) == 0x1FF && boxes == 0x49;
+
+}
+#endif
+
+
+/**
+ * Checks that no row, column or subgrid of a partially filled grid repeats
+ * a digit, and computes the digits each empty cell can still take.
+ * 
+ * Parameters
+ * ----------
+ *   grid :       The 81 cells of the grid in row-major order, 0 for empty
+ *   candidates : Array of 81 masks that receives, for each empty cell, bit d
+ *                set if digit d is not yet in its row, column or subgrid,
+ *                and 0 for each filled cell
+ * 
+ * Returns
+ * -------
+ *   consistent : 1 if the filled cells hold digits 1-9 with no repeats in
+ *                any unit, 0 if not. Values above 9 rule out no candidates.
+ */
+int grid_candidates_scalar(const uint8_t* grid, uint16_t* candidates) {
+
+    uint16_t rows[9] = {0}, cols[9] = {0}, boxes[9] = {0};
+    int consistent = 1;
+
+    for (int cell = 0; cell < 81; cell++) {
+        unsigned value = grid[cell];
+        if (value == 0) {
+            continue;
+        }
+        if (value > 9) {
+            consistent = 0;
+            continue;
+        }
+        unsigned bit = 1u << value;
+        int r = cell_row[cell], c = cell_col[cell], b = cell_box[cell];
+        if ((rows[r] | cols[c] | boxes[b]) & bit) {  // Only a repeat in the same unit sets the bit
+            consistent &= !(rows[r] & bit) && !(cols[c] & bit) && !(boxes[b] & bit);
+        }
+        rows[r] |= bit;
+        cols[c] |= bit;
+        boxes[b] |= bit;
+    }
+
+    for (int cell = 0; cell < 81; cell++) {
+        uint16_t used = rows[cell_row[cell]] | cols[cell_col[cell]] | boxes[cell_box[cell]];
+        candidates[cell] = grid[cell] == 0 ? ~used & FULL_UNIT_MASK : 0;
+    }
+
+    return consistent;
+
+}
+
+
+#ifdef HAVE_AVX2_VALIDATOR
+/**
+ * Computes the consistency and candidates of a partially filled grid like
+ * grid_candidates_scalar, a whole row at a time.
+ * 
+ * Each row sits in the low 9 bytes of a register, as in validate_grid_avx2.
+ * A byte shuffle maps digits 1-8 to a bit in one plane of bytes and digit 9
+ * to a bit in a second plane, so the digits used by every column come from
+ * ORing the rows, by every subgrid from ORing the rows of a band and three
+ * adjacent bytes, and by every row from ORing its bytes. Candidates are the
+ * complement of the three, widened to 16 bits for the empty cells.
+ * 
+ * No unit repeats a digit exactly when, for rows, columns and subgrids
+ * alike, the digits used by the units add up to the number of filled cells.
+ * 
+ * Parameters
+ * ----------
+ *   grid :       The 81 cells of the grid in row-major order, 0 for empty.
+ *                Only these 81 bytes are read.
+ *   candidates : Array of 81 masks that receives the candidates
+ * 
+ * Returns
+ * -------
+ *   consistent : 1 if the filled cells hold digits 1-9 with no repeats in
+ *                any unit, 0 if not
+ */
+__attribute__((target("avx2")))
+int grid_candidates_avx2(const uint8_t* grid, uint16_t* candidates) {
+
+    /* Values above 9 are clamped to 10, which maps to no digit */
+    const __m128i keep_row = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i ten = _mm_set1_epi8(10);
+    const __m128i low_digit_bits = _mm_setr_epi8(0, 1, 2, 4, 8, 16, 32, 64, (char) 128, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nine_bit = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i values[9], low[9], high[9];
+    int filled = 0, out_of_range = 0;
+    for (int row = 0; row < 9; row++) {
+        if (row < 8) {
+            values[row] = _mm_and_si128(_mm_loadu_si128((const __m128i*) (grid + 9*row)), keep_row);
+        }
+        else {  // Loaded from an earlier offset and shifted down, to stay within the grid
+            values[row] = _mm_srli_si128(_mm_loadu_si128((const __m128i*) (grid + 65)), 7);
+        }
+        __m128i clamped = _mm_min_epu8(values[row], ten);
+        out_of_range |= _mm_movemask_epi8(_mm_cmpeq_epi8(clamped, ten));
+        filled += __builtin_popcount(~_mm_movemask_epi8(_mm_cmpeq_epi8(values[row], zero)) & 0x1FF);
+        low[row] = _mm_shuffle_epi8(low_digit_bits, clamped);
+        high[row] = _mm_shuffle_epi8(nine_bit, clamped);
+    }
+
+    /* Digits used by each column, and by each subgrid spread over its three
+     * columns */
+    const __m128i box_spread = _mm_setr_epi8(0, 0, 0, 3, 3, 3, 6, 6, 6, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i box_starts = _mm_setr_epi8(-1, 0, 0, -1, 0, 0, -1, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i column_low = zero, column_high = zero;
+    __m128i box_low[3], box_high[3];
+    int box_digits = 0;
+    for (int band = 0; band < 3; band++) {
+        __m128i l = _mm_or_si128(_mm_or_si128(low[3*band], low[3*band + 1]), low[3*band + 2]);
+        __m128i h = _mm_or_si128(_mm_or_si128(high[3*band], high[3*band + 1]), high[3*band + 2]);
+        column_low = _mm_or_si128(column_low, l);
+        column_high = _mm_or_si128(column_high, h);
+        l = _mm_or_si128(_mm_or_si128(l, _mm_srli_si128(l, 1)), _mm_srli_si128(l, 2));
+        h = _mm_or_si128(_mm_or_si128(h, _mm_srli_si128(h, 1)), _mm_srli_si128(h, 2));
+        box_digits += __builtin_popcountll(_mm_cvtsi128_si64(_mm_and_si128(l, box_starts)))
+                    + __builtin_popcountll(_mm_cvtsi128_si64(_mm_and_si128(h, box_starts)));
+        box_low[band] = _mm_shuffle_epi8(l, box_spread);
+        box_high[band] = _mm_shuffle_epi8(h, box_spread);
+    }
+    int column_digits = __builtin_popcountll(_mm_cvtsi128_si64(column_low)) + __builtin_popcount(_mm_extract_epi8(column_low, 8))
+                      + __builtin_popcountll(_mm_cvtsi128_si64(column_high)) + __builtin_popcount(_mm_extract_epi8(column_high, 8));
+
+    /* Digits used by each row, broadcast to every byte, then the candidates
+     * of the row's empty cells */
+    int row_digits = 0;
+    for (int row = 0; row < 9; row++) {
+        __m128i l = low[row], h = high[row];
+        l = _mm_or_si128(l, _mm_srli_si128(l, 1));
+        l = _mm_or_si128(l, _mm_srli_si128(l, 2));
+        l = _mm_or_si128(l, _mm_srli_si128(l, 4));
+        l = _mm_or_si128(l, _mm_srli_si128(l, 8));
+        h = _mm_or_si128(h, _mm_srli_si128(h, 1));
+        h = _mm_or_si128(h, _mm_srli_si128(h, 2));
+        h = _mm_or_si128(h, _mm_srli_si128(h, 4));
+        h = _mm_or_si128(h, _mm_srli_si128(h, 8));
+        row_digits += __builtin_popcount(_mm_cvtsi128_si32(l) & 0xFF) + (_mm_cvtsi128_si32(h) & 1);
+
+        __m128i used_low = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(l, zero), column_low), box_low[row / 3]);
+        __m128i used_high = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(h, zero), column_high), box_high[row / 3]);
+        __m128i empty = _mm_cmpeq_epi8(values[row], zero);
+        __m128i free_low = _mm_andnot_si128(used_low, empty);
+        __m128i free_high = _mm_andnot_si128(used_high, _mm_and_si128(empty, _mm_set1_epi8(1)));
 
-    return (void *) valid;
+        /* Digits 1-8 become bits 1-8 and digit 9 bit 9 */
+        __m256i wide = _mm256_or_si256(_mm256_cvtepu8_epi16(free_low), _mm256_slli_epi16(_mm256_cvtepu8_epi16(free_high), 8));
+        wide = _mm256_slli_epi16(wide, 1);
+        _mm_storeu_si128((__m128i*) (candidates + 9*row), _mm256_castsi256_si128(wide));
+        candidates[9*row + 8] = _mm256_extract_epi16(wide, 8);
+    }
+
+    return !(out_of_range & 0x1FF) && row_digits == filled && column_digits == filled && box_digits == filled;
+
+}
+#endif
 
-}
\ No newline at end of file
+
+/**
+ * Determines if a full grid with n x n boxes is a valid solution, for any box
+ * size, using 64-bit digit bitmasks and loops bounded at runtime.
+ * 
+ * Parameters
+ * ----------
+ *   grid : The n^4 cells of the grid in row-major order
+ *   box :  Box size n, at most MAX_BOX
+ * 
+ * Returns
+ * -------
+ *   valid : 1 if every row, column and box is valid, 0 if not.
+ */
+int validate_grid_generic(const uint8_t* grid, int box) {
+
+    int side = box * box;
+    uint64_t rows[MAX_SIDE] = {0}, cols[MAX_SIDE] = {0}, boxes[MAX_SIDE] = {0};
+    unsigned out_of_range = 0;
+
+    for (int row = 0; row < side; row++) {
+        for (int col = 0; col < side; col++) {
+            unsigned value = grid[side*row + col];
+            uint64_t bit = 1ull << (value & 63);
+            out_of_range |= value - 1 > (unsigned) side - 1;
+            rows[row] |= bit;
+            cols[col] |= bit;
+            boxes[box*(row/box) + col/box] |= bit;
+        }
+    }
+
+    uint64_t full = ((1ull << side) - 1) << 1;  // Bits 1 to side
+    uint64_t combined = full;
+    for (int i = 0; i < side; i++) {
+        combined &= rows[i] & cols[i] & boxes[i];
+    }
+
+    return combined == full && !out_of_range;
+
+}
+
+
+/* Defines validate_grid_box<BOX>, a validator specialized for n x n boxes.
+ * The side, the box of each cell and the full mask are compile-time
+ * constants, and masks use the narrowest type that holds bits 1 to n^2. The
+ * loop over a row is fully unrolled. */
+#define DEFINE_BOX_VALIDATOR(BOX, MASK_TYPE)                                  \
+int validate_grid_box##BOX(const uint8_t* grid) {                             \
+    enum { SIDE = BOX * BOX };                                                \
+    MASK_TYPE rows[SIDE] = {0}, cols[SIDE] = {0}, boxes[SIDE] = {0};          \
+    unsigned out_of_range = 0;                                                \
+    for (int row = 0; row < SIDE; row++) {                                    \
+        MASK_TYPE row_mask = 0;                                               \
+        _Pragma("GCC unroll 36")                                              \
+        for (int col = 0; col < SIDE; col++) {                                \
+            unsigned value = grid[SIDE*row + col];                            \
+            MASK_TYPE bit = (MASK_TYPE) (1ull << (value & 63));               \
+            out_of_range |= value - 1 > SIDE - 1;                             \
+            row_mask |= bit;                                                  \
+            cols[col] |= bit;                                                 \
+            boxes[BOX*(row/BOX) + col/BOX] |= bit;                            \
+        }                                                                     \
+        rows[row] = row_mask;                                                 \
+    }                                                                         \
+    const MASK_TYPE full = (MASK_TYPE) (((1ull << SIDE) - 1) << 1);           \
+    MASK_TYPE combined = full;                                                \
+    for (int i = 0; i < SIDE; i++) {                                          \
+        combined &= rows[i] & cols[i] & boxes[i];                             \
+    }                                                                         \
+    return combined == full && !out_of_range;                                 \
+}
+
+DEFINE_BOX_VALIDATOR(2, uint8_t)
+DEFINE_BOX_VALIDATOR(4, uint32_t)
+DEFINE_BOX_VALIDATOR(5, uint32_t)
+DEFINE_BOX_VALIDATOR(6, uint64_t)
+
+
+/**
+ * Returns the fastest validator for grids with n x n boxes. 9x9 grids use
+ * the validator chosen by select_grid_validator.
+ * 
+ * Parameters
+ * ----------
+ *   box : Box size n, from MIN_BOX to MAX_BOX
+ * 
+ * Returns
+ * -------
+ *   validator : Function that validates one grid of that size
+ */
+int (*validator_for_box(int box))(const uint8_t* grid) {
+    switch (box) {
+        case 2: return validate_grid_box2;
+        case 3: return validate_grid;
+        case 4: return validate_grid_box4;
+        case 5: return validate_grid_box5;
+        case 6: return validate_grid_box6;
+    }
+    return NULL;
+}
+
+
+/**
+ * Selects the fastest whole-grid validator and candidate computation
+ * supported by the CPU, falling back to the scalar versions.
+ */
+void select_grid_validator(void) {
+#ifdef HAVE_AVX2_VALIDATOR
+    if (__builtin_cpu_supports("avx2")) {
+        validate_grid = validate_grid_avx2;
+        grid_candidates = grid_candidates_avx2;
+        grid_validator_name = "avx2";
+    }
+#endif
+}
+
+
+/**
+ * Runs one of the benchmark modes selected by the first command line flag.
+ * 
+ * Modes
+ * -----
+ *   -f <file>       : Validate the grid in a file with 27 threads like the
+ *                     default mode, but stop at the first invalid unit.
+ *   -b <iterations> : Compare the bitmask and pairwise unit validation
+ *                     kernels over a set of random valid and invalid units.
+ *   -g <iterations> : Compare the per-unit, scalar whole-grid, and AVX2
+ *                     whole-grid validators over random valid and invalid
+ *                     grids.
+ *   -m <file> [threads] [-f] : Validate every grid in a file on a fixed pool
+ *                     of worker threads, one per core by default, and print
+ *                     one result per grid followed by a summary. With -f,
+ *                     stop at the first invalid grid.
+ *   -p <grids> [threads] : Compare grids/s of creating 27 threads per grid
+ *                     with a persistent pool taking one grid or one batch of
+ *                     grids per task.
+ *   -r <file>       : Parse every grid in a file with the scalar and SIMD
+ *                     line decoders and report the parsing rate.
+ *   -k <text file> <packed file> [box] [raw] : Convert a text file of grids
+ *                     to the packed binary format, with a header unless raw
+ *                     is given. Every mode that reads grids also reads
+ *                     packed files.
+ *   -n <box> <file> : Validate every grid with box x box boxes in a file,
+ *                     from 4x4 (box 2) to 36x36 (box 6) grids.
+ *   -G <iterations> : Compare the generic and size-specialized validators
+ *                     for every grid size.
+ *   -s <file>       : Solve every puzzle in a file with the bitset solver,
+ *                     printing each solution as a line of 81 digits.
+ *   -d <file> [variant] : Solve every puzzle in a file with dancing links,
+ *                     as a standard, diagonal or windoku sudoku.
+ *   -D <file>       : Compare the bitset and dancing links solvers on every
+ *                     puzzle in a file, grouped by number of givens.
+ *   -c <file> [threads] [limit] : Count the solutions of every puzzle in a
+ *                     file with a parallel work-stealing search, stopping
+ *                     at limit solutions if given; a limit of 2 checks that
+ *                     each puzzle has a unique solution.
+ *   -l <file> [threads] [batch] [depth] : Validate every grid in a file with
+ *                     a reader, validator threads and an ordered writer
+ *                     connected by lock-free queues of batches of grids.
+ *   -L <file> [threads] : Compare the pipeline throughput for several batch
+ *                     sizes and queue depths.
+ *   -e <file>       : Load a grid that may have blank cells, then apply the
+ *                     moves read from standard input, one "<row> <column>
+ *                     <digit>" per line with digit 0 clearing the cell, or
+ *                     "u" to undo, printing whether the grid is consistent
+ *                     after each.
+ *   -E <iterations> : Compare incremental move validation with rescanning
+ *                     the grid after every move.
+ *   -a <file>       : Check that the filled cells of every partial grid in
+ *                     a file do not conflict, and print the candidates of
+ *                     each empty cell.
+ *   -A <iterations> : Compare the scalar and AVX2 candidate computations
+ *                     over random partial grids.
+ *   -q <puzzles> [clues] [threads] [seed] : Generate puzzles with a unique
+ *                     solution by removing clues from random solutions,
+ *                     one puzzle per thread at a time, down to the given
+ *                     number of clues or until no clue can be removed.
+ *                     With fewer puzzles than threads, the spare threads
+ *                     check the uniqueness of each removal in parallel.
+ * 
+ * Parameters
+ * ----------
+ *   argc : Number of command line arguments
+ *   argv : Command line arguments
+ * 
+ * Returns
+ * -------
+ *   status : Exit status of the program
+ */
+int run_mode(int argc, char* argv[]) {
+
+    char* mode = argv[1];
+
+    if (strcmp(mode, "-f") == 0) {
+        if (argc != 3) {
+            print_usage();
+            exit(0);
+        }
+        validate_file(argv[2], 1);
+    }
+    else if (strcmp(mode, "-b") == 0) {
+        if (argc != 3 || atol(argv[2]) < 1) {
+            print_usage();
+            exit(0);
+        }
+        run_kernel_benchmark(atol(argv[2]));
+    }
+    else if (strcmp(mode, "-g") == 0) {
+        if (argc != 3 || atol(argv[2]) < 1) {
+            print_usage();
+            exit(0);
+        }
+        run_grid_benchmark(atol(argv[2]));
+    }
+    else if (strcmp(mode, "-m") == 0) {
+        int fail_fast = argc > 3 && strcmp(argv[argc - 1], "-f") == 0;
+        int num_args = argc - fail_fast;  // Arguments before the fail-fast flag
+        if (num_args < 3 || num_args > 4) {
+            print_usage();
+            exit(0);
+        }
+        int num_threads = num_args == 4 ? atoi(argv[3]) : default_threads();
+        if (num_threads < 1 || num_threads > MAX_THREADS) {
+            printf("Number of threads must be between 1 and %d.\n", MAX_THREADS);
+            exit(0);
+        }
+        run_bulk(argv[2], num_threads, fail_fast);
+    }
+    else if (strcmp(mode, "-p") == 0) {
+        if (argc < 3 || argc > 4 || atol(argv[2]) < 1) {
+            print_usage();
+            exit(0);
+        }
+        int num_threads = argc == 4 ? atoi(argv[3]) : default_threads();
+        if (num_threads < 1 || num_threads > MAX_THREADS) {
+            printf("Number of threads must be between 1 and %d.\n", MAX_THREADS);
+            exit(0);
+        }
+        run_pool_benchmark(atol(argv[2]), num_threads);
+    }
+    else if (strcmp(mode, "-r") == 0) {
+        if (argc != 3) {
+            print_usage();
+            exit(0);
+        }
+        run_parse_benchmark(argv[2]);
+    }
+    else if (strcmp(mode, "-k") == 0) {
+        int header = !(argc > 4 && strcmp(argv[argc - 1], "raw") == 0);
+        int num_args = argc - !header;  // Arguments before raw
+        if (num_args < 4 || num_args > 5) {
+            print_usage();
+            exit(0);
+        }
+        int box = num_args == 5 ? atoi(argv[4]) : 3;
+        if (box < MIN_BOX || box > 3 || (!header && box != 3)) {
+            printf("Packed grids must have box size %d or 3, and files without a header box size 3.\n", MIN_BOX);
+            exit(0);
+        }
+        run_pack(argv[2], argv[3], box, header);
+    }
+    else if (strcmp(mode, "-n") == 0) {
+        if (argc != 4) {
+            print_usage();
+            exit(0);
+        }
+        int box = atoi(argv[2]);
+        if (box < MIN_BOX || box > MAX_BOX) {
+            printf("Box size must be between %d and %d.\n", MIN_BOX, MAX_BOX);
+            exit(0);
+        }
+        run_sized_file(box, argv[3]);
+    }
+    else if (strcmp(mode, "-G") == 0) {
+        if (argc != 3 || atol(argv[2]) < 1) {
+            print_usage();
+            exit(0);
+        }
+        run_size_benchmark(atol(argv[2]));
+    }
+    else if (strcmp(mode, "-s") == 0) {
+        if (argc != 3) {
+            print_usage();
+            exit(0);
+        }
+        run_solve(argv[2]);
+    }
+    else if (strcmp(mode, "-d") == 0) {
+        if (argc < 3 || argc > 4) {
+            print_usage();
+            exit(0);
+        }
+        run_dlx_solve(argv[2], argc == 4 ? parse_variant(argv[3]) : STANDARD);
+    }
+    else if (strcmp(mode, "-D") == 0) {
+        if (argc != 3) {
+            print_usage();
+            exit(0);
+        }
+        run_solver_benchmark(argv[2]);
+    }
+    else if (strcmp(mode, "-c") == 0) {
+        if (argc < 3 || argc > 5) {
+            print_usage();
+            exit(0);
+        }
+        int num_threads = argc >= 4 ? atoi(argv[3]) : default_threads();
+        long limit = argc == 5 ? atol(argv[4]) : 0;
+        if (num_threads < 1 || num_threads > MAX_THREADS || limit < 0) {
+            printf("Number of threads must be between 1 and %d, and the limit must not be negative.\n", MAX_THREADS);
+            exit(0);
+        }
+        run_count(argv[2], num_threads, limit);
+    }
+    else if (strcmp(mode, "-l") == 0) {
+        if (argc < 3 || argc > 6) {
+            print_usage();
+            exit(0);
+        }
+        int num_threads = argc >= 4 ? atoi(argv[3]) : default_threads();
+        int batch_size = argc >= 5 ? atoi(argv[4]) : PIPELINE_BATCH;
+        int depth = argc == 6 ? atoi(argv[5]) : PIPELINE_DEPTH;
+        if (num_threads < 1 || num_threads > MAX_THREADS || batch_size < 1 || batch_size > MAX_BATCH || depth < 1 || depth > MAX_DEPTH) {
+            printf("Threads must be between 1 and %d, batch size between 1 and %d, and depth between 1 and %d.\n", MAX_THREADS, MAX_BATCH, MAX_DEPTH);
+            exit(0);
+        }
+        run_pipeline(argv[2], num_threads, batch_size, depth, 1);
+    }
+    else if (strcmp(mode, "-L") == 0) {
+        if (argc < 3 || argc > 4) {
+            print_usage();
+            exit(0);
+        }
+        int num_threads = argc == 4 ? atoi(argv[3]) : default_threads();
+        if (num_threads < 1 || num_threads > MAX_THREADS) {
+            printf("Number of threads must be between 1 and %d.\n", MAX_THREADS);
+            exit(0);
+        }
+        run_pipeline_benchmark(argv[2], num_threads);
+    }
+    else if (strcmp(mode, "-e") == 0) {
+        if (argc != 3) {
+            print_usage();
+            exit(0);
+        }
+        run_edit(argv[2]);
+    }
+    else if (strcmp(mode, "-E") == 0) {
+        if (argc != 3 || atol(argv[2]) < 1) {
+            print_usage();
+            exit(0);
+        }
+        run_move_benchmark(atol(argv[2]));
+    }
+    else if (strcmp(mode, "-a") == 0) {
+        if (argc != 3) {
+            print_usage();
+            exit(0);
+        }
+        run_candidates(argv[2]);
+    }
+    else if (strcmp(mode, "-A") == 0) {
+        if (argc != 3 || atol(argv[2]) < 1) {
+            print_usage();
+            exit(0);
+        }
+        run_candidates_benchmark(atol(argv[2]));
+    }
+    else if (strcmp(mode, "-q") == 0) {
+        if (argc < 3 || argc > 6 || atol(argv[2]) < 1) {
+            print_usage();
+            exit(0);
+        }
+        int target = argc >= 4 ? atoi(argv[3]) : 0;
+        int num_threads = argc >= 5 ? atoi(argv[4]) : default_threads();
+        uint32_t seed = argc == 6 ? strtoul(argv[5], NULL, 10) : (uint32_t) time(NULL);
+        if ((target != 0 && (target < MIN_CLUES || target > 80)) || num_threads < 1 || num_threads > MAX_THREADS) {
+            printf("Clues must be 0 for minimal puzzles or between %d and 80, and threads between 1 and %d.\n", MIN_CLUES, MAX_THREADS);
+            exit(0);
+        }
+        run_generate(atol(argv[2]), target, num_threads, seed != 0 ? seed : 1);
+    }
+    else {
+        print_usage();
+    }
+
+    return 0;
+
+}
+
+
+/**
+ * Prints the command line usage of the program.
+ */
+void print_usage(void) {
+    printf("Usage: sudoku <file>\n");
+    printf("       sudoku -f <file>\n");
+    printf("       sudoku -b <iterations>\n");
+    printf("       sudoku -g <iterations>\n");
+    printf("       sudoku -m <file> [threads] [-f]\n");
+    printf("       sudoku -p <grids> [threads]\n");
+    printf("       sudoku -r <file>\n");
+    printf("       sudoku -k <text file> <packed file> [box size] [raw]\n");
+    printf("       sudoku -n <box size> <file>\n");
+    printf("       sudoku -G <iterations>\n");
+    printf("       sudoku -s <file>\n");
+    printf("       sudoku -d <file> [standard|diagonal|windoku]\n");
+    printf("       sudoku -D <file>\n");
+    printf("       sudoku -c <file> [threads] [limit]\n");
+    printf("       sudoku -l <file> [threads] [batch] [depth]\n");
+    printf("       sudoku -L <file> [threads]\n");
+    printf("       sudoku -e <file> < moves\n");
+    printf("       sudoku -E <iterations>\n");
+    printf("       sudoku -a <file>\n");
+    printf("       sudoku -A <iterations>\n");
+    printf("       sudoku -q <puzzles> [clues] [threads] [seed]\n");
+}
+
+
+/**
+ * Returns the current time in seconds from a monotonic clock.
+ */
+double now_seconds(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+
+/**
+ * Generates the next value of a xorshift pseudo-random sequence.
+ * 
+ * Parameters
+ * ----------
+ *   state : Generator state, updated in place. Must not be zero.
+ * 
+ * Returns
+ * -------
+ *   value : Next pseudo-random value
+ */
+uint32_t random_next(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+
+/**
+ * Times the bitmask and pairwise unit validation kernels over the same set of
+ * random units, half of which contain a repeated digit, and checks that both
+ * kernels agree on every unit.
+ * 
+ * Parameters
+ * ----------
+ *   iterations : Number of passes over the set of units
+ */
+void run_kernel_benchmark(long iterations) {
+
+    enum { NUM_UNITS = 4096 };
+    static int units[NUM_UNITS][9];
+    uint32_t seed = 12345;
+
+    /* Shuffle the digits 1-9 into each unit, then repeat a digit in half */
+    for (int u = 0; u < NUM_UNITS; u++) {
+        for (int i = 0; i < 9; i++) {
+            units[u][i] = i + 1;
+        }
+        for (int i = 8; i > 0; i--) {
+            int j = random_next(&seed) % (i + 1);
+            int temp = units[u][i];
+            units[u][i] = units[u][j];
+            units[u][j] = temp;
+        }
+        if (u % 2 == 1) {
+            int from = random_next(&seed) % 9;
+            int to = (from + 1 + random_next(&seed) % 8) % 9;
+            units[u][to] = units[u][from];
+        }
+    }
+
+    /* Both kernels must agree before timing them */
+    for (int u = 0; u < NUM_UNITS; u++) {
+        if (validate_unit_mask(units[u]) != validate_unit_pairwise(units[u])) {
+            printf("Error: kernels disagree on unit %d.\n", u);
+            exit(0);
+        }
+    }
+
+    const char* names[2] = {"pairwise", "bitmask"};
+    int (*kernels[2])(const int*) = {validate_unit_pairwise, validate_unit_mask};
+    double times[2];
+    for (int k = 0; k < 2; k++) {
+        volatile int valid_count = 0;  // Keeps the results from being optimized away
+        double start = now_seconds();
+        for (long it = 0; it < iterations; it++) {
+            int count = 0;
+            for (int u = 0; u < NUM_UNITS; u++) {
+                count += kernels[k](units[u]);
+            }
+            valid_count += count;
+        }
+        times[k] = now_seconds() - start;
+        double units_checked = (double) iterations * NUM_UNITS;
+        printf("%-8s : %8.2f ns/unit  %10.1f M units/s  (%d valid)\n", names[k],
+               times[k] / units_checked * 1e9, units_checked / times[k] / 1e6, valid_count / (int) iterations);
+    }
+    printf("Bitmask kernel speedup: %.2fx\n", times[0] / times[1]);
+
+}
+
+
+/**
+ * Generates a random valid 9x9 solution.
+ * 
+ * Parameters
+ * ----------
+ *   grid : Array of 81 cells that receives the solution in row-major order
+ *   seed : Generator state, updated in place
+ */
+void random_solution(uint8_t* grid, uint32_t* seed) {
+    random_solution_box(grid, 3, seed);
+}
+
+
+/**
+ * Shuffles an array of integers in place.
+ * 
+ * Parameters
+ * ----------
+ *   values : Array to shuffle
+ *   count :  Number of values
+ *   seed :   Generator state, updated in place
+ */
+void shuffle(int* values, int count, uint32_t* seed) {
+    for (int i = count - 1; i > 0; i--) {
+        int j = random_next(seed) % (i + 1);
+        int temp = values[i];
+        values[i] = values[j];
+        values[j] = temp;
+    }
+}
+
+
+/**
+ * Generates a random valid solution with n x n boxes by relabelling the
+ * digits and shuffling the rows within each band, the columns within each
+ * stack, the bands and the stacks of a fixed pattern.
+ * 
+ * Parameters
+ * ----------
+ *   grid : Array of n^4 cells that receives the solution in row-major order
+ *   box :  Box size n
+ *   seed : Generator state, updated in place
+ */
+void random_solution_box(uint8_t* grid, int box, uint32_t* seed) {
+
+    int side = box * box;
+    int digits[MAX_SIDE], rows[MAX_SIDE], cols[MAX_SIDE];
+    int order[MAX_BOX], inner[MAX_BOX];
+    for (int i = 0; i < side; i++) {
+        digits[i] = i + 1;
+    }
+    shuffle(digits, side, seed);
+
+    /* Shuffle the groups of n lines, then the lines inside each group */
+    for (int k = 0; k < 2; k++) {
+        int* lines = k == 0 ? rows : cols;
+        for (int i = 0; i < box; i++) {
+            order[i] = i;
+        }
+        shuffle(order, box, seed);
+        for (int group = 0; group < box; group++) {
+            for (int i = 0; i < box; i++) {
+                inner[i] = i;
+            }
+            shuffle(inner, box, seed);
+            for (int i = 0; i < box; i++) {
+                lines[box*group + i] = box*order[group] + inner[i];
+            }
+        }
+    }
+
+    for (int row = 0; row < side; row++) {
+        for (int col = 0; col < side; col++) {
+            int r = rows[row], c = cols[col];
+            grid[side*row + col] = digits[(box*(r % box) + r / box + c) % side];
+        }
+    }
+
+}
+
+
+/**
+ * Times the per-unit bitmask kernel, the scalar whole-grid validator and the
+ * AVX2 whole-grid validator over the same set of random grids, half of which
+ * have one cell changed to a repeated or out of range value, and checks that
+ * all validators agree on every grid.
+ * 
+ * Parameters
+ * ----------
+ *   iterations : Number of passes over the set of grids
+ */
+void run_grid_benchmark(long iterations) {
+
+    enum { NUM_GRIDS = 1024 };
+    static uint8_t grids[NUM_GRIDS][81];
+    uint32_t seed = 12345;
+
+    for (int g = 0; g < NUM_GRIDS; g++) {
+        random_solution(grids[g], &seed);
+        if (g % 2 == 1) {  // Repeat a digit, or use a value that is not a digit
+            int cell = random_next(&seed) % 81;
+            int value = random_next(&seed) % 16;
+            grids[g][cell] = value != grids[g][cell] ? value : 0;
+        }
+    }
+
+    const char* names[3] = {"per-unit", "scalar", "avx2"};
+    int (*validators[3])(const uint8_t*) = {NULL, validate_grid_scalar, NULL};
+#ifdef HAVE_AVX2_VALIDATOR
+    if (__builtin_cpu_supports("avx2")) {
+        validators[2] = validate_grid_avx2;
+    }
+#endif
+
+    /* The per-unit kernel checks the 27 units of each grid one at a time */
+    int expected[NUM_GRIDS];
+    for (int g = 0; g < NUM_GRIDS; g++) {
+        expected[g] = 1;
+        for (int u = 0; u < 27; u++) {
+            expected[g] &= validate_unit_cells(grids[g], u);
+        }
+        for (int v = 1; v < 3; v++) {
+            if (validators[v] != NULL && validators[v](grids[g]) != expected[g]) {
+                printf("Error: %s validator disagrees on grid %d.\n", names[v], g);
+                exit(0);
+            }
+        }
+    }
+
+    double times[3] = {0};
+    for (int v = 0; v < 3; v++) {
+        if (v > 0 && validators[v] == NULL) {
+            printf("%-8s : not supported by this CPU\n", names[v]);
+            continue;
+        }
+        volatile int valid_count = 0;  // Keeps the results from being optimized away
+        double start = now_seconds();
+        for (long it = 0; it < iterations; it++) {
+            int count = 0;
+            for (int g = 0; g < NUM_GRIDS; g++) {
+                if (v == 0) {
+                    int valid = 1;
+                    for (int u = 0; u < 27; u++) {
+                        valid &= validate_unit_cells(grids[g], u);
+                    }
+                    count += valid;
+                }
+                else {
+                    count += validators[v](grids[g]);
+                }
+            }
+            valid_count += count;
+        }
+        times[v] = now_seconds() - start;
+        double checked = (double) iterations * NUM_GRIDS;
+        printf("%-8s : %8.2f ns/grid  %10.2f M grids/s  %8.1f G grids/hour  (%d valid)\n", names[v],
+               times[v] / checked * 1e9, checked / times[v] / 1e6, checked / times[v] * 3600 / 1e9,
+               valid_count / (int) iterations);
+    }
+
+    select_grid_validator();
+    printf("Selected validator: %s\n", grid_validator_name);
+
+}
+
+
+/**
+ * Returns the number of online processor cores, used as the default number
+ * of worker threads.
+ */
+int default_threads(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) {
+        return 1;
+    }
+    return cores < MAX_THREADS ? (int) cores : MAX_THREADS;
+}
+
+
+/**
+ * Maps a file of grids into memory for parsing.
+ * 
+ * Parameters
+ * ----------
+ *   file :     Grid file to initialize
+ *   filename : Name of the file to map
+ */
+void grid_file_open(struct grid_file* file, const char* filename) {
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Error opening %s.\n", filename);
+        exit(0);
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        printf("Error reading %s.\n", filename);
+        exit(0);
+    }
+
+    file->size = info.st_size;
+    file->offset = 0;
+    file->line = 1;
+    file->simd = 1;
+    file->data = NULL;
+    if (file->size > 0) {  // Empty files cannot be mapped
+        file->data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (file->data == MAP_FAILED) {
+            printf("Error mapping %s.\n", filename);
+            exit(0);
+        }
+        madvise((void*) file->data, file->size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    /* Recognize packed binary files by their header or name */
+    file->packed_box = 0;
+    file->packed_count = 0;
+    size_t name_length = strlen(filename), suffix_length = strlen(PACKED_SUFFIX);
+    if (file->size >= PACKED_HEADER_SIZE && memcmp(file->data, PACKED_MAGIC, 4) == 0) {
+        const uint8_t* header = (const uint8_t*) file->data;
+        file->packed_count = header[4] | header[5] << 8 | header[6] << 16 | (long) header[7] << 24;
+        file->packed_box = header[8];
+        file->offset = PACKED_HEADER_SIZE;
+        if (file->packed_box < MIN_BOX || file->packed_box > 3) {
+            printf("Error: %s holds packed grids of unsupported box size %d.\n", filename, file->packed_box);
+            exit(0);
+        }
+    }
+    else if (name_length > suffix_length && strcmp(filename + name_length - suffix_length, PACKED_SUFFIX) == 0) {
+        file->packed_box = 3;
+        file->packed_count = file->size / PACKED_BYTES(81);
+    }
+
+    if (file->packed_box) {
+        int cells = file->packed_box * file->packed_box * file->packed_box * file->packed_box;
+        if (file->size != file->offset + file->packed_count * PACKED_BYTES(cells)) {
+            printf("Error: %s should hold %ld packed grids in %ld bytes, but has %zu bytes.\n", filename,
+                   file->packed_count, (long) file->offset + file->packed_count * PACKED_BYTES(cells), file->size);
+            exit(0);
+        }
+    }
+
+}
+
+
+/**
+ * Unmaps a file of grids.
+ * 
+ * Parameters
+ * ----------
+ *   file : Grid file to close
+ */
+void grid_file_close(struct grid_file* file) {
+    if (file->data != NULL) {
+        munmap((void*) file->data, file->size);
+    }
+}
+
+
+/**
+ * Decodes the next 9x9 grid of a mapped file of grids. Each grid is either 81
+ * whitespace-separated numbers, as in the example files, a single line of
+ * 81 characters where '.' marks a blank cell, or 41 bytes of a packed file.
+ * Values that do not fit in a cell are stored as 255, so they are rejected
+ * by the validators. Malformed input is reported with its line number.
+ * 
+ * Parameters
+ * ----------
+ *   file : Grid file to read from
+ *   grid : Array of 81 cells that receives the grid in row-major order
+ * 
+ * Returns
+ * -------
+ *   status : 1 if a grid was read, 0 at the end of the file
+ */
+int parse_grid(struct grid_file* file, uint8_t* grid) {
+    return parse_cells(file, grid, 81);
+}
+
+
+/**
+ * Decodes the next grid of any size from a mapped file of grids, in the
+ * formats read by parse_grid. Grids of up to 81 cells may also be given as
+ * one line with a character per cell.
+ * 
+ * Parameters
+ * ----------
+ *   file :      Grid file to read from
+ *   grid :      Array that receives the cells in row-major order
+ *   num_cells : Number of cells in a grid
+ * 
+ * Returns
+ * -------
+ *   status : 1 if a grid was read, 0 at the end of the file
+ */
+int parse_cells(struct grid_file* file, uint8_t* grid, int num_cells) {
+
+    const char* data = file->data;
+    size_t size = file->size;
+    size_t offset = file->offset;
+    int cells = 0;  // Number of cells read so far
+
+    /* Packed grids are unpacked in place, without any scanning */
+    if (file->packed_box) {
+        int box = file->packed_box;
+        if (num_cells != box * box * box * box) {
+            printf("Error: the packed file holds %dx%d grids.\n", box * box, box * box);
+            exit(0);
+        }
+        if (offset == size) {
+            return 0;
+        }
+#ifdef __SSE2__
+        if (file->simd && num_cells == 81) {
+            unpack_grid_sse2((const uint8_t*) data + offset, grid);
+            file->offset = offset + PACKED_BYTES(81);
+            return 1;
+        }
+#endif
+        unpack_cells_scalar((const uint8_t*) data + offset, grid, num_cells);
+        file->offset = offset + PACKED_BYTES(num_cells);
+        return 1;
+    }
+
+    while (cells < num_cells) {
+
+        /* Skip whitespace between tokens */
+        while (offset < size && isspace((unsigned char) data[offset])) {
+            if (data[offset] == '\n') {
+                file->line++;
+            }
+            offset++;
+        }
+        if (offset == size) {
+            if (cells == 0) {
+                file->offset = offset;
+                return 0;
+            }
+            printf("Error: grid ending on line %ld has only %d cells.\n", file->line, cells);
+            exit(0);
+        }
+
+#ifdef __SSE2__
+        /* Fast path for a line of 81 characters, which the decoder rejects
+         * if it holds any whitespace, so the token need not be scanned */
+        if (file->simd && num_cells == 81 && cells == 0 && size - offset >= 81 && (size - offset == 81 || isspace((unsigned char) data[offset + 81]))
+                && decode_line_sse2(data + offset, grid)) {
+            offset += 81;
+            break;
+        }
+#endif
+
+        /* Find the end of the token */
+        size_t end = offset;
+        while (end < size && !isspace((unsigned char) data[end])) {
+            end++;
+        }
+
+        if (end - offset == (size_t) num_cells && num_cells <= 81 && cells == 0) {  // One grid per line
+            int bad = decode_line_scalar(data + offset, grid, num_cells);
+            if (bad < num_cells) {
+                printf("Error: unexpected character '%c' on line %ld.\n", data[offset + bad], file->line);
+                exit(0);
+            }
+            cells = num_cells;
+        }
+        else {  // One number per cell
+            size_t i = offset;
+            int negative = i < end && data[i] == '-';
+            i += negative || (i < end && data[i] == '+');
+            long value = 0;
+            if (i == end) {
+                value = -1;  // Sign with no digits
+            }
+            for (; i < end && isdigit((unsigned char) data[i]); i++) {
+                value = value < 256 ? 10*value + data[i] - '0' : value;
+            }
+            if (i != end || value < 0) {
+                printf("Error: unexpected token '%.*s' on line %ld.\n", (int) (end - offset), data + offset, file->line);
+                exit(0);
+            }
+            grid[cells++] = !negative && value <= 255 ? value : 255;
+        }
+        offset = end;
+
+    }
+
+    file->offset = offset;
+    return 1;
+
+}
+
+
+/**
+ * Decodes a line of characters into cells, one character at a time.
+ * 
+ * Parameters
+ * ----------
+ *   text :      One character per cell, digits or '.' for a blank cell
+ *   grid :      Array that receives the cells
+ *   num_cells : Number of cells in the line
+ * 
+ * Returns
+ * -------
+ *   position : Index of the first character that is not a digit or '.', or
+ *              num_cells if every character was decoded
+ */
+int decode_line_scalar(const char* text, uint8_t* grid, int num_cells) {
+    for (int i = 0; i < num_cells; i++) {
+        if (text[i] == '.') {
+            grid[i] = 0;
+        }
+        else if (isdigit((unsigned char) text[i])) {
+            grid[i] = text[i] - '0';
+        }
+        else {
+            return i;
+        }
+    }
+    return num_cells;
+}
+
+
+#ifdef __SSE2__
+/**
+ * Decodes a line of 81 characters into cells, 16 characters at a time, by
+ * subtracting '0' and checking every byte is a digit or '.' with vector
+ * comparisons. Exactly 81 bytes are read and written.
+ * 
+ * Parameters
+ * ----------
+ *   text : The 81 characters, digits or '.' for a blank cell
+ *   grid : Array of 81 cells that receives the grid
+ * 
+ * Returns
+ * -------
+ *   status : 1 if every character was decoded, 0 if any character is not a
+ *            digit or '.'
+ */
+int decode_line_sse2(const char* text, uint8_t* grid) {
+
+    const __m128i zero_char = _mm_set1_epi8('0');
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i dot = _mm_set1_epi8('.');
+    int valid = 0xFFFF;
+
+    for (int i = 0; i < 80; i += 16) {
+        __m128i chars = _mm_loadu_si128((const __m128i*) (text + i));
+        __m128i digits = _mm_sub_epi8(chars, zero_char);
+        __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digits, nine), digits);
+        __m128i is_dot = _mm_cmpeq_epi8(chars, dot);
+        valid &= _mm_movemask_epi8(_mm_or_si128(is_digit, is_dot));
+        _mm_storeu_si128((__m128i*) (grid + i), _mm_andnot_si128(is_dot, digits));
+    }
+
+    /* Final character */
+    unsigned last = (unsigned char) text[80];
+    grid[80] = last == '.' ? 0 : last - '0';
+    return valid == 0xFFFF && (last == '.' || last - '0' <= 9);
+
+}
+#endif
+
+
+/**
+ * Packs cells two to a byte, the first cell of each pair in the low nibble.
+ * Values above 15 are stored as 15, which is not a valid digit for any box
+ * size that can be packed.
+ * 
+ * Parameters
+ * ----------
+ *   grid :      Cells of the grid in row-major order
+ *   packed :    Array of PACKED_BYTES(num_cells) bytes that receives them
+ *   num_cells : Number of cells in the grid
+ */
+void pack_cells(const uint8_t* grid, uint8_t* packed, int num_cells) {
+    for (int i = 0; i < num_cells; i += 2) {
+        unsigned low = grid[i] < 15 ? grid[i] : 15;
+        unsigned high = i + 1 < num_cells ? (grid[i + 1] < 15 ? grid[i + 1] : 15) : 0;
+        packed[i / 2] = low | high << 4;
+    }
+}
+
+
+/**
+ * Unpacks cells stored two to a byte, one cell at a time.
+ * 
+ * Parameters
+ * ----------
+ *   packed :    The PACKED_BYTES(num_cells) bytes of the grid
+ *   grid :      Array that receives the cells
+ *   num_cells : Number of cells in the grid
+ */
+void unpack_cells_scalar(const uint8_t* packed, uint8_t* grid, int num_cells) {
+    for (int i = 0; i < num_cells; i++) {
+        grid[i] = packed[i / 2] >> (4 * (i & 1)) & 15;
+    }
+}
+
+
+#ifdef __SSE2__
+/**
+ * Unpacks the 41 bytes of a 9x9 grid, 16 bytes at a time: the low and high
+ * nibbles of each byte are masked apart and interleaved back into cell
+ * order. Exactly 41 bytes are read and 81 written, so grids at the end of a
+ * mapped file can be unpacked.
+ * 
+ * Parameters
+ * ----------
+ *   packed : The 41 bytes of the grid
+ *   grid :   Array of 81 cells that receives the grid
+ */
+void unpack_grid_sse2(const uint8_t* packed, uint8_t* grid) {
+
+    const __m128i nibble = _mm_set1_epi8(15);
+
+    /* Bytes 0-31 hold cells 0-63 */
+    for (int i = 0; i < 32; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*) (packed + i));
+        __m128i low = _mm_and_si128(bytes, nibble);
+        __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble);
+        _mm_storeu_si128((__m128i*) (grid + 2*i), _mm_unpacklo_epi8(low, high));
+        _mm_storeu_si128((__m128i*) (grid + 2*i + 16), _mm_unpackhi_epi8(low, high));
+    }
+
+    /* Bytes 32-39 hold cells 64-79, and the low nibble of byte 40 cell 80 */
+    __m128i bytes = _mm_loadl_epi64((const __m128i*) (packed + 32));
+    __m128i low = _mm_and_si128(bytes, nibble);
+    __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble);
+    _mm_storeu_si128((__m128i*) (grid + 64), _mm_unpacklo_epi8(low, high));
+    grid[80] = packed[40] & 15;
+
+}
+#endif
+
+
+/**
+ * Converts a text file of grids to the packed binary format. The header is
+ * written last, once the number of grids is known.
+ * 
+ * Parameters
+ * ----------
+ *   text_filename :   File of grids in any text format read by parse_cells
+ *   packed_filename : File to create
+ *   box :             Box size of the grids, 2 or 3
+ *   header :          1 to start the file with a header, 0 for none
+ */
+void run_pack(char* text_filename, char* packed_filename, int box, int header) {
+
+    struct grid_file file;
+    grid_file_open(&file, text_filename);
+    FILE* out = fopen(packed_filename, "wb");
+    if (out == NULL) {
+        printf("Error creating %s.\n", packed_filename);
+        exit(0);
+    }
+
+    int num_cells = box * box * box * box;
+    uint8_t header_bytes[PACKED_HEADER_SIZE] = {0};
+    if (header) {
+        fwrite(header_bytes, 1, PACKED_HEADER_SIZE, out);
+    }
+
+    uint8_t grid[81], packed[PACKED_BYTES(81)];
+    long count = 0;
+    double start = now_seconds();
+    while (parse_cells(&file, grid, num_cells)) {
+        pack_cells(grid, packed, num_cells);
+        fwrite(packed, 1, PACKED_BYTES(num_cells), out);
+        count++;
+    }
+
+    if (header) {
+        if (count > UINT32_MAX) {
+            printf("Error: %ld grids do not fit in the header.\n", count);
+            exit(0);
+        }
+        memcpy(header_bytes, PACKED_MAGIC, 4);
+        for (int i = 0; i < 4; i++) {
+            header_bytes[4 + i] = count >> (8 * i);
+        }
+        header_bytes[8] = box;
+        fseek(out, 0, SEEK_SET);
+        fwrite(header_bytes, 1, PACKED_HEADER_SIZE, out);
+    }
+    if (fclose(out) != 0) {
+        printf("Error writing %s.\n", packed_filename);
+        exit(0);
+    }
+    double elapsed = now_seconds() - start;
+
+    long size = (header ? PACKED_HEADER_SIZE : 0) + count * PACKED_BYTES(num_cells);
+    printf("Packed %ld grids from %s (%zu bytes) into %s (%ld bytes) in %.3f s\n",
+           count, text_filename, file.size, packed_filename, size, elapsed);
+    grid_file_close(&file);
+
+}
+
+
+/**
+ * Validates a range of grids, writing each grid's result into the results
+ * array. Used as a pool task. In fail-fast mode, the lowest index of an
+ * invalid grid is kept, and grids after it are not validated.
+ * 
+ * Parameters
+ * ----------
+ *   data :  Shared grid set
+ *   first : Index of the first grid
+ *   last :  Index one past the last grid
+ */
+void validate_range(void* data, long first, long last) {
+    struct grid_set* set = data;
+    if (!set->fail_fast) {
+        for (long g = first; g < last; g++) {
+            set->results[g] = validate_grid(set->grids[g]);
+        }
+        return;
+    }
+
+    for (long g = first; g < last && g < atomic_load_explicit(&set->first_invalid, memory_order_relaxed); g++) {
+        set->results[g] = validate_grid(set->grids[g]);
+        if (!set->results[g]) {  // Lower the first invalid index to g, unless another thread found a lower one
+            long current = atomic_load(&set->first_invalid);
+            while (g < current && !atomic_compare_exchange_weak(&set->first_invalid, &current, g)) {
+            }
+            return;
+        }
+    }
+}
+
+
+/**
+ * Validates every grid in a file. The file is read in chunks, each chunk is
+ * split into batches for a pool of worker threads created once for the whole
+ * file, and a result is printed for each grid followed by a summary.
+ * 
+ * In fail-fast mode, validation and reading stop at the first invalid grid,
+ * which is the last grid printed.
+ * 
+ * The result lines of a chunk are formatted into one buffer and written at
+ * once, so printing does not limit the throughput. Which lines are printed
+ * depends on the compile-time VERBOSITY.
+ * 
+ * Parameters
+ * ----------
+ *   filename :    File of grids
+ *   num_threads : Number of worker threads
+ *   fail_fast :   1 to stop at the first invalid grid, 0 to validate them all
+ */
+void run_bulk(char* filename, int num_threads, int fail_fast) {
+
+    struct grid_file file;
+    grid_file_open(&file, filename);
+
+    select_grid_validator();
+
+    struct grid_set set;
+    set.grids = malloc(BULK_CHUNK * sizeof(*set.grids));
+    set.results = malloc(BULK_CHUNK);
+    set.fail_fast = fail_fast;
+    char* log = malloc(BULK_CHUNK * GRID_LOG_SIZE);  // Result lines of a chunk
+
+    struct thread_pool* pool = malloc(sizeof(struct thread_pool));
+    thread_pool_start(pool, num_threads);
+
+    long total = 0, num_valid = 0;  // Number of grids read and number found valid
+    double start = now_seconds();
+
+    while (1) {
+
+        /* Read the next chunk */
+        long count = 0;
+        while (count < BULK_CHUNK && parse_grid(&file, set.grids[count])) {
+            count++;
+        }
+        if (count == 0) {
+            break;
+        }
+
+        /* Validate it on the pool */
+        atomic_store(&set.first_invalid, LONG_MAX);
+        for (long first = 0; first < count; first += BULK_BATCH) {
+            thread_pool_submit(pool, validate_range, &set, first, first + BULK_BATCH < count ? first + BULK_BATCH : count);
+        }
+        thread_pool_wait(pool);
+
+        long first_invalid = atomic_load(&set.first_invalid);
+        if (first_invalid < count) {  // Only in fail-fast mode
+            count = first_invalid + 1;
+        }
+        for (long g = 0; g < count; g++) {
+            num_valid += set.results[g];
+        }
+        fwrite(log, 1, format_grid_results(log, total + 1, set.results, count), stdout);
+        total += count;
+        if (first_invalid < LONG_MAX) {
+            printf("Stopped at the first INVALID grid\n");
+            break;
+        }
+
+    }
+
+    thread_pool_stop(pool);
+    double elapsed = now_seconds() - start;
+
+    printf("\n%s contains %ld grids: %ld valid, %ld INVALID\n", filename, total, num_valid, total - num_valid);
+    printf("Validated with %d threads (%s) in %.3f s, %.0f grids/s\n",
+           num_threads, grid_validator_name, elapsed, elapsed > 0 ? total / elapsed : 0.0);
+
+    grid_file_close(&file);
+    free(pool);
+    free(set.grids);
+    free(set.results);
+    free(log);
+
+}
+
+
+/**
+ * Formats the result line of each grid in a chunk, like
+ * printf("Grid %ld is %s\n") but without the cost of parsing the format for
+ * every grid. Only invalid grids are included below VERBOSITY 2, and none
+ * below VERBOSITY 1.
+ * 
+ * Parameters
+ * ----------
+ *   out :     Buffer of at least count * GRID_LOG_SIZE bytes
+ *   number :  Number of the first grid in the file, counting from 1
+ *   results : 1 for each valid grid, 0 for each invalid grid
+ *   count :   Number of grids
+ * 
+ * Returns
+ * -------
+ *   length : Number of bytes written, without a terminator
+ */
+size_t format_grid_results(char* out, long number, const uint8_t* results, long count) {
+
+    char* end = out;
+    for (long g = 0; g < count && VERBOSITY >= 1; g++) {
+        if (VERBOSITY < 2 && results[g]) {
+            continue;
+        }
+
+        /* Write the digits of the grid number backwards, then copy them */
+        char digits[20];
+        int len = 0;
+        for (long n = number + g; n > 0; n /= 10) {
+            digits[len++] = '0' + n % 10;
+        }
+
+        memcpy(end, "Grid ", 5);
+        end += 5;
+        while (len > 0) {
+            *end++ = digits[--len];
+        }
+        if (results[g]) {
+            memcpy(end, " is valid\n", 10);
+            end += 10;
+        }
+        else {
+            memcpy(end, " is INVALID\n", 12);
+            end += 12;
+        }
+    }
+
+    return end - out;
+
+}
+
+
+/**
+ * Starts a pool of worker threads that wait for tasks.
+ * 
+ * Parameters
+ * ----------
+ *   pool :        Pool to start
+ *   num_threads : Number of worker threads
+ */
+void thread_pool_start(struct thread_pool* pool, int num_threads) {
+
+    pool->num_threads = num_threads;
+    pool->head = pool->tail = pool->queued = 0;
+    pool->pending = 0;
+    pool->stopping = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->task_ready, NULL);
+    pthread_cond_init(&pool->space_ready, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+
+    for (int t = 0; t < num_threads; t++) {
+        if (pthread_create(&pool->threads[t], NULL, thread_pool_worker, pool)) {
+            printf("Error creating threads.");
+            exit(0);
+        }
+    }
+
+}
+
+
+/**
+ * Worker thread of a pool. Runs queued tasks until the pool is stopped.
+ * 
+ * Parameters
+ * ----------
+ *   args : Pool the thread belongs to
+ */
+void* thread_pool_worker(void* args) {
+
+    struct thread_pool* pool = args;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+
+        while (pool->queued == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->task_ready, &pool->lock);
+        }
+        if (pool->queued == 0) {  // Stopping, and no work is left
+            break;
+        }
+
+        /* Take the next task */
+        struct pool_task task = pool->tasks[pool->head];
+        pool->head = (pool->head + 1) % POOL_QUEUE;
+        if (pool->queued-- == POOL_QUEUE) {
+            pthread_cond_signal(&pool->space_ready);
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+        task.function(task.data, task.first, task.last);
+        pthread_mutex_lock(&pool->lock);
+
+        if (--pool->pending == 0) {
+            pthread_cond_broadcast(&pool->all_done);
+        }
+
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+
+}
+
+
+/**
+ * Queues a task on a pool, waiting for space if the queue is full.
+ * 
+ * Parameters
+ * ----------
+ *   pool :     Pool to run the task
+ *   function : Function applied to the range of items
+ *   data :     Data passed to the function
+ *   first :    First item of the range
+ *   last :     Item one past the end of the range
+ */
+void thread_pool_submit(struct thread_pool* pool, void (*function)(void*, long, long), void* data, long first, long last) {
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->queued == POOL_QUEUE) {
+        pthread_cond_wait(&pool->space_ready, &pool->lock);
+    }
+
+    struct pool_task* task = &pool->tasks[pool->tail];
+    task->function = function;
+    task->data = data;
+    task->first = first;
+    task->last = last;
+    pool->tail = (pool->tail + 1) % POOL_QUEUE;
+    pool->queued++;
+    pool->pending++;
+
+    pthread_cond_signal(&pool->task_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+}
+
+
+/**
+ * Waits until every task submitted to a pool has finished.
+ * 
+ * Parameters
+ * ----------
+ *   pool : Pool to wait for
+ */
+void thread_pool_wait(struct thread_pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->all_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+/**
+ * Stops a pool once its queued tasks have finished and joins its threads.
+ * 
+ * Parameters
+ * ----------
+ *   pool : Pool to stop
+ */
+void thread_pool_stop(struct thread_pool* pool) {
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->task_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int t = 0; t < pool->num_threads; t++) {
+        pthread_join(pool->threads[t], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->task_ready);
+    pthread_cond_destroy(&pool->space_ready);
+    pthread_cond_destroy(&pool->all_done);
+
+}
+
+
+/**
+ * Initializes an empty ring.
+ * 
+ * Parameters
+ * ----------
+ *   ring :     Ring to initialize
+ *   capacity : Minimum number of batches the ring holds, rounded up to a
+ *              power of two
+ */
+void batch_ring_init(struct batch_ring* ring, int capacity) {
+
+    size_t size = 1;
+    while (size < (size_t) capacity) {
+        size *= 2;
+    }
+
+    ring->mask = size - 1;
+    ring->seq = malloc(size * sizeof(*ring->seq));
+    ring->batches = malloc(size * sizeof(*ring->batches));
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&ring->seq[i], i);
+    }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+
+}
+
+
+/**
+ * Frees the slots of a ring.
+ * 
+ * Parameters
+ * ----------
+ *   ring : Ring to free
+ */
+void batch_ring_free(struct batch_ring* ring) {
+    free(ring->seq);
+    free(ring->batches);
+}
+
+
+/**
+ * Adds a batch to a ring without blocking. A producer claims the slot at the
+ * tail with a compare-and-swap, writes the batch, and then publishes it by
+ * advancing the slot's sequence number.
+ * 
+ * Parameters
+ * ----------
+ *   ring :  Ring to add to
+ *   batch : Batch to add
+ * 
+ * Returns
+ * -------
+ *   added : 1 if the batch was added, 0 if the ring is full
+ */
+int batch_ring_push(struct batch_ring* ring, struct grid_batch* batch) {
+
+    size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (1) {
+        size_t seq = atomic_load_explicit(&ring->seq[pos & ring->mask], memory_order_acquire);
+        long diff = (long) (seq - pos);
+        if (diff == 0) {  // Slot is free: claim it
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (diff < 0) {  // Slot still holds the batch from one lap ago
+            return 0;
+        }
+        else {  // Another producer claimed the slot
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+
+    ring->batches[pos & ring->mask] = batch;
+    atomic_store_explicit(&ring->seq[pos & ring->mask], pos + 1, memory_order_release);
+    return 1;
+
+}
+
+
+/**
+ * Takes a batch from a ring without blocking. The slot is handed back to
+ * producers for the next lap by advancing its sequence number.
+ * 
+ * Parameters
+ * ----------
+ *   ring : Ring to take from
+ * 
+ * Returns
+ * -------
+ *   batch : Oldest batch in the ring, or NULL if the ring is empty
+ */
+struct grid_batch* batch_ring_pop(struct batch_ring* ring) {
+
+    size_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (1) {
+        size_t seq = atomic_load_explicit(&ring->seq[pos & ring->mask], memory_order_acquire);
+        long diff = (long) (seq - (pos + 1));
+        if (diff == 0) {  // Slot holds a batch: claim it
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (diff < 0) {  // Nothing published yet
+            return NULL;
+        }
+        else {  // Another consumer claimed the slot
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+
+    struct grid_batch* batch = ring->batches[pos & ring->mask];
+    atomic_store_explicit(&ring->seq[pos & ring->mask], pos + ring->mask + 1, memory_order_release);
+    return batch;
+
+}
+
+
+/**
+ * Adds a batch to a ring, yielding the processor while the ring is full.
+ * This is the back-pressure of the pipeline: a stage that gets ahead waits
+ * for the next one instead of buffering without bound.
+ * 
+ * Parameters
+ * ----------
+ *   ring :  Ring to add to
+ *   batch : Batch to add
+ */
+void batch_ring_push_wait(struct batch_ring* ring, struct grid_batch* batch) {
+    while (!batch_ring_push(ring, batch)) {
+        sched_yield();
+    }
+}
+
+
+/**
+ * Takes a batch from a ring, yielding the processor while the ring is empty.
+ * 
+ * Parameters
+ * ----------
+ *   ring : Ring to take from
+ * 
+ * Returns
+ * -------
+ *   batch : Oldest batch in the ring
+ */
+struct grid_batch* batch_ring_pop_wait(struct batch_ring* ring) {
+    struct grid_batch* batch;
+    while ((batch = batch_ring_pop(ring)) == NULL) {
+        sched_yield();
+    }
+    return batch;
+}
+
+
+/**
+ * Validator stage of the pipeline. Validates the batches from the full ring
+ * and passes them to the writer, until it takes the empty batch that marks
+ * the end of the file.
+ * 
+ * Parameters
+ * ----------
+ *   args : Pipeline the thread belongs to
+ */
+void* pipeline_validator(void* args) {
+
+    struct pipeline* pipe = args;
+    while (1) {
+        struct grid_batch* batch = batch_ring_pop_wait(&pipe->full);
+        if (batch->count == 0) {
+            return NULL;
+        }
+        for (long g = 0; g < batch->count; g++) {
+            batch->results[g] = validate_grid(batch->grids[g]);
+        }
+        batch_ring_push_wait(&pipe->done, batch);
+    }
+
+}
+
+
+/**
+ * Writer stage of the pipeline. Batches arrive in the order the validators
+ * finish them, so each is held in the slot for its sequence number until the
+ * batches before it are written. Only depth batches are in flight, so their
+ * sequence numbers are unique modulo depth. Written batches go back to the
+ * reader through the free ring.
+ * 
+ * Parameters
+ * ----------
+ *   args : Pipeline the thread belongs to
+ */
+void* pipeline_writer(void* args) {
+
+    struct pipeline* pipe = args;
+    struct grid_batch** waiting = calloc(pipe->depth, sizeof(*waiting));
+    char* log = pipe->print ? malloc((size_t) pipe->batch_size * GRID_LOG_SIZE) : NULL;
+    long next = 0;  // Sequence number of the next batch to write
+
+    while (next < atomic_load(&pipe->num_batches)) {
+
+        struct grid_batch* batch = batch_ring_pop(&pipe->done);
+        if (batch == NULL) {  // Check the number of batches again, as the reader may have finished
+            sched_yield();
+            continue;
+        }
+        waiting[batch->seq % pipe->depth] = batch;
+
+        /* Write every batch that is now in order */
+        while ((batch = waiting[next % pipe->depth]) != NULL && batch->seq == next) {
+            waiting[next % pipe->depth] = NULL;
+            for (long g = 0; g < batch->count; g++) {
+                pipe->num_valid += batch->results[g];
+            }
+            if (pipe->print) {
+                fwrite(log, 1, format_grid_results(log, pipe->total + 1, batch->results, batch->count), stdout);
+            }
+            pipe->total += batch->count;
+            next++;
+            batch_ring_push_wait(&pipe->free, batch);
+        }
+
+    }
+
+    free(waiting);
+    free(log);
+    return NULL;
+
+}
+
+
+/**
+ * Validates every grid in a file with a three-stage pipeline: the calling
+ * thread reads batches of grids, validator threads check them, and a writer
+ * thread counts the results and prints them in file order. The stages are
+ * connected by bounded lock-free rings, and only depth batches exist, so
+ * the reader waits once depth batches are read but not yet written.
+ * 
+ * Parameters
+ * ----------
+ *   filename :    File of grids
+ *   num_threads : Number of validator threads
+ *   batch_size :  Number of grids in each batch
+ *   depth :       Number of batches in flight
+ *   print :       1 to print a result for each grid and a summary, 0 to
+ *                 only measure the time
+ * 
+ * Returns
+ * -------
+ *   rate : Grids validated per second
+ */
+double run_pipeline(char* filename, int num_threads, int batch_size, int depth, int print) {
+
+    struct grid_file file;
+    grid_file_open(&file, filename);
+
+    select_grid_validator();
+
+    struct pipeline pipe;
+    pipe.depth = depth;
+    pipe.batch_size = batch_size;
+    pipe.print = print;
+    pipe.total = pipe.num_valid = 0;
+    atomic_init(&pipe.num_batches, LONG_MAX);
+    batch_ring_init(&pipe.free, depth);
+    batch_ring_init(&pipe.full, depth + num_threads);  // Room for one end marker per validator
+    batch_ring_init(&pipe.done, depth);
+
+    /* Batch number depth is the end marker */
+    pipe.batches = malloc((depth + 1) * sizeof(struct grid_batch));
+    for (int b = 0; b <= depth; b++) {
+        pipe.batches[b].count = batch_size;
+        pipe.batches[b].grids = malloc((size_t) batch_size * sizeof(*pipe.batches[b].grids));
+        pipe.batches[b].results = malloc(batch_size);
+        if (b < depth) {
+            batch_ring_push(&pipe.free, &pipe.batches[b]);
+        }
+    }
+    struct grid_batch* end = &pipe.batches[depth];
+
+    double start = now_seconds();
+
+    pthread_t validators[MAX_THREADS], writer;
+    for (int t = 0; t < num_threads; t++) {
+        if (pthread_create(&validators[t], NULL, pipeline_validator, &pipe)) {
+            printf("Error creating threads.");
+            exit(0);
+        }
+    }
+    if (pthread_create(&writer, NULL, pipeline_writer, &pipe)) {
+        printf("Error creating threads.");
+        exit(0);
+    }
+
+    /* Reader stage */
+    long seq = 0;
+    while (1) {
+        struct grid_batch* batch = batch_ring_pop_wait(&pipe.free);
+        long count = 0;
+        while (count < batch_size && parse_grid(&file, batch->grids[count])) {
+            count++;
+        }
+        if (count == 0) {
+            batch_ring_push_wait(&pipe.free, batch);
+            break;
+        }
+        batch->seq = seq++;
+        batch->count = count;
+        batch_ring_push_wait(&pipe.full, batch);
+        if (count < batch_size) {
+            break;
+        }
+    }
+
+    /* Tell the writer how many batches to expect, and stop the validators */
+    atomic_store(&pipe.num_batches, seq);
+    end->count = 0;
+    for (int t = 0; t < num_threads; t++) {
+        batch_ring_push_wait(&pipe.full, end);
+    }
+
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(validators[t], NULL);
+    }
+    pthread_join(writer, NULL);
+
+    double elapsed = now_seconds() - start;
+    double rate = elapsed > 0 ? pipe.total / elapsed : 0.0;
+
+    if (print) {
+        printf("\n%s contains %ld grids: %ld valid, %ld INVALID\n", filename, pipe.total, pipe.num_valid, pipe.total - pipe.num_valid);
+        printf("Validated with %d threads (%s), batches of %d, depth %d in %.3f s, %.0f grids/s\n",
+               num_threads, grid_validator_name, batch_size, depth, elapsed, rate);
+    }
+
+    grid_file_close(&file);
+    for (int b = 0; b <= depth; b++) {
+        free(pipe.batches[b].grids);
+        free(pipe.batches[b].results);
+    }
+    free(pipe.batches);
+    batch_ring_free(&pipe.free);
+    batch_ring_free(&pipe.full);
+    batch_ring_free(&pipe.done);
+
+    return rate;
+
+}
+
+
+/**
+ * Measures the throughput of the pipeline on a file for each combination of
+ * batch size and queue depth, without printing the results of the grids.
+ * 
+ * Parameters
+ * ----------
+ *   filename :    File of grids
+ *   num_threads : Number of validator threads
+ */
+void run_pipeline_benchmark(char* filename, int num_threads) {
+
+    static const int batch_sizes[] = {16, 256, 1024, 4096};
+    static const int depths[] = {1, 2, 8, 32};
+
+    printf("Pipeline on %s with %d validator threads, grids/s\n\n", filename, num_threads);
+    printf("batch \\ depth");
+    for (int d = 0; d < 4; d++) {
+        printf(" %12d", depths[d]);
+    }
+    printf("\n");
+
+    for (int b = 0; b < 4; b++) {
+        printf("%13d", batch_sizes[b]);
+        for (int d = 0; d < 4; d++) {
+            printf(" %12.0f", run_pipeline(filename, num_threads, batch_sizes[b], depths[d], 0));
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+
+}
+
+
+/**
+ * Thread of the thread-per-unit model. Validates one row, column or subgrid
+ * like thread_validate, without printing the result.
+ * 
+ * Parameters
+ * ----------
+ *   args : Unit task giving the grid, the bitmap of valid units, the flag
+ *          set when a unit is invalid, and the unit to check
+ */
+void* unit_thread(void* args) {
+    struct unit_task* task = args;
+    if (task->fail_fast && atomic_load(task->invalid_found)) {
+        return NULL;
+    }
+    if (validate_unit_cells(task->grid, task->unit)) {
+        atomic_fetch_or(task->valid_units, 1u << task->unit);
+    }
+    else {
+        atomic_store(task->invalid_found, 1);
+    }
+    return NULL;
+}
+
+
+/**
+ * Validates a grid the way the single-grid mode does, creating and joining
+ * one thread for each of the 27 rows, columns and subgrids.
+ * 
+ * Parameters
+ * ----------
+ *   grid :      The 81 cells of the grid in row-major order
+ *   fail_fast : 1 to stop creating threads once a unit is found invalid
+ * 
+ * Returns
+ * -------
+ *   valid : 1 if every row, column and subgrid is valid, 0 if not.
+ */
+int validate_grid_threaded(const uint8_t* grid, int fail_fast) {
+
+    struct unit_task tasks[27];
+    atomic_uint valid_units = 0;
+    atomic_int invalid_found = 0;
+    pthread_t threads[27];
+    int num_created = 0;
+    for (int u = 0; u < 27 && !(fail_fast && atomic_load(&invalid_found)); u++) {
+        tasks[u].grid = grid;
+        tasks[u].valid_units = &valid_units;
+        tasks[u].invalid_found = &invalid_found;
+        tasks[u].fail_fast = fail_fast;
+        tasks[u].unit = u;
+        if (pthread_create(&threads[u], NULL, unit_thread, &tasks[u])) {
+            printf("Error creating threads.");
+            exit(0);
+        }
+        num_created++;
+    }
+
+    for (int u = 0; u < num_created; u++) {
+        pthread_join(threads[u], NULL);
+    }
+    return atomic_load(&valid_units) == ALL_UNITS_VALID;
+
+}
+
+
+/**
+ * Compares the throughput of the thread-per-unit model, with and without
+ * fail-fast cancellation, with a persistent pool given one grid per task and
+ * one batch of grids per task. The thread-per-unit model is timed on at most
+ * 10000 grids, as it is slow.
+ * 
+ * Parameters
+ * ----------
+ *   num_grids :   Number of random grids to validate
+ *   num_threads : Number of pool threads
+ */
+void run_pool_benchmark(long num_grids, int num_threads) {
+
+    struct grid_set set;
+    set.grids = malloc(num_grids * sizeof(*set.grids));
+    set.results = malloc(num_grids);
+    set.fail_fast = 0;
+    uint8_t* expected = malloc(num_grids);
+    uint32_t seed = 12345;
+    for (long g = 0; g < num_grids; g++) {
+        random_solution(set.grids[g], &seed);
+        if (g % 2 == 1) {
+            set.grids[g][random_next(&seed) % 81] = 0;
+        }
+    }
+    select_grid_validator();
+
+    /* Thread per unit, checking every unit and stopping at the first invalid one */
+    long threaded_grids = num_grids < 10000 ? num_grids : 10000;
+    double start = 0, elapsed = 0;
+    for (int fail_fast = 0; fail_fast <= 1; fail_fast++) {
+        start = now_seconds();
+        for (long g = 0; g < threaded_grids; g++) {
+            int valid = validate_grid_threaded(set.grids[g], fail_fast);
+            if (fail_fast && valid != expected[g]) {
+                printf("Error: fail-fast result differs on grid %ld.\n", g);
+                exit(0);
+            }
+            expected[g] = valid;
+        }
+        elapsed = now_seconds() - start;
+        printf("thread per unit%-5s: %12.0f grids/s  (%ld grids)\n", fail_fast ? ", ff" : "", threaded_grids / elapsed, threaded_grids);
+    }
+    for (long g = threaded_grids; g < num_grids; g++) {
+        expected[g] = validate_grid_scalar(set.grids[g]);
+    }
+
+    /* Persistent pool, one grid per task and one batch per task */
+    struct thread_pool* pool = malloc(sizeof(struct thread_pool));
+    thread_pool_start(pool, num_threads);
+    const long batches[2] = {1, BULK_BATCH};
+    for (int b = 0; b < 2; b++) {
+        memset(set.results, 0xFF, num_grids);
+        start = now_seconds();
+        for (long first = 0; first < num_grids; first += batches[b]) {
+            long last = first + batches[b] < num_grids ? first + batches[b] : num_grids;
+            thread_pool_submit(pool, validate_range, &set, first, last);
+        }
+        thread_pool_wait(pool);
+        elapsed = now_seconds() - start;
+        if (memcmp(set.results, expected, num_grids) != 0) {
+            printf("Error: pool results differ from the thread-per-unit results.\n");
+            exit(0);
+        }
+        printf("pool, %4ld per task : %12.0f grids/s  (%ld grids, %d threads, %s)\n",
+               batches[b], num_grids / elapsed, num_grids, num_threads, grid_validator_name);
+    }
+    thread_pool_stop(pool);
+
+    free(pool);
+    free(set.grids);
+    free(set.results);
+    free(expected);
+
+}
+
+
+/**
+ * Times parsing every grid in a file with the scalar and the SIMD line
+ * decoders, or the nibble unpackers for a packed file, against a pass that
+ * only counts the file's newlines as a reference for the memory bandwidth.
+ * 
+ * Parameters
+ * ----------
+ *   filename : File of grids
+ */
+void run_parse_benchmark(char* filename) {
+
+    struct grid_file file;
+    grid_file_open(&file, filename);
+    size_t first_grid = file.offset;  // After the header of a packed file
+    uint8_t grid[81];
+    volatile uint8_t checksum = 0;  // Keeps the decoded cells from being optimized away
+
+    /* Reference pass over the same bytes */
+    double start = now_seconds();
+    long newlines = 0;
+    const char* position = file.data;
+    const char* end = file.data + file.size;
+    while (position != NULL && position < end) {
+        position = memchr(position, '\n', end - position);
+        if (position != NULL) {
+            newlines++;
+            position++;
+        }
+    }
+    double elapsed = now_seconds() - start;
+    printf("%-13s : %8.3f s  %10.1f MB/s  (%ld lines)\n", "memchr", elapsed, file.size / elapsed / 1e6, newlines);
+
+    for (int simd = 0; simd <= 1; simd++) {
+#ifndef __SSE2__
+        if (simd) {
+            printf("%-13s : not available on this CPU\n", "sse2 decode");
+            break;
+        }
+#endif
+        file.offset = first_grid;
+        file.line = 1;
+        file.simd = simd;
+        long count = 0;
+        start = now_seconds();
+        while (parse_grid(&file, grid)) {
+            checksum += grid[count % 81];
+            count++;
+        }
+        elapsed = now_seconds() - start;
+        const char* names[2][2] = {{"scalar decode", "sse2 decode"}, {"scalar unpack", "sse2 unpack"}};
+        printf("%-13s : %8.3f s  %10.1f MB/s  %12.0f grids/s  (%ld grids)\n", names[file.packed_box != 0][simd],
+               elapsed, file.size / elapsed / 1e6, count / elapsed, count);
+    }
+
+    grid_file_close(&file);
+
+}
+
+
+/**
+ * Validates every grid with n x n boxes in a file and prints one result per
+ * grid followed by a summary.
+ * 
+ * Parameters
+ * ----------
+ *   box :      Box size n
+ *   filename : File of grids, as whitespace-separated numbers
+ */
+void run_sized_file(int box, char* filename) {
+
+    int side = box * box;
+    struct grid_file file;
+    uint8_t grid[MAX_CELLS];
+    grid_file_open(&file, filename);
+    select_grid_validator();
+    int (*validator)(const uint8_t*) = validator_for_box(box);
+
+    long total = 0, num_valid = 0;
+    while (parse_cells(&file, grid, side * side)) {
+        int valid = validator(grid);
+        total++;
+        num_valid += valid;
+        printf("Grid %ld is %s\n", total, valid ? "valid" : "INVALID");
+    }
+    grid_file_close(&file);
+
+    printf("\n%s contains %ld %dx%d grids: %ld valid, %ld INVALID\n", filename, total, side, side, num_valid, total - num_valid);
+
+}
+
+
+/**
+ * Times the generic validator and the size-specialized validator for every
+ * grid size over random grids, half of which have one cell changed, and
+ * checks that both agree on every grid.
+ * 
+ * Parameters
+ * ----------
+ *   iterations : Number of passes over the set of grids of each size
+ */
+void run_size_benchmark(long iterations) {
+
+    enum { NUM_GRIDS = 256 };
+    uint8_t* grids = malloc((size_t) NUM_GRIDS * MAX_CELLS);
+    uint32_t seed = 12345;
+    select_grid_validator();
+
+    for (int box = MIN_BOX; box <= MAX_BOX; box++) {
+
+        int side = box * box, num_cells = side * side;
+        for (int g = 0; g < NUM_GRIDS; g++) {
+            uint8_t* grid = grids + (size_t) g * num_cells;
+            random_solution_box(grid, box, &seed);
+            if (g % 2 == 1) {  // Repeat a digit, or use a value that is not a digit
+                int cell = random_next(&seed) % num_cells;
+                int value = random_next(&seed) % (side + 2);
+                grid[cell] = value != grid[cell] ? value : 0;
+            }
+        }
+
+        int (*specialized)(const uint8_t*) = validator_for_box(box);
+        for (int g = 0; g < NUM_GRIDS; g++) {
+            uint8_t* grid = grids + (size_t) g * num_cells;
+            if (specialized(grid) != validate_grid_generic(grid, box)) {
+                printf("Error: validators disagree on %dx%d grid %d.\n", side, side, g);
+                exit(0);
+            }
+        }
+
+        double times[2];
+        for (int k = 0; k < 2; k++) {
+            volatile int valid_count = 0;  // Keeps the results from being optimized away
+            double start = now_seconds();
+            for (long it = 0; it < iterations; it++) {
+                int count = 0;
+                for (int g = 0; g < NUM_GRIDS; g++) {
+                    uint8_t* grid = grids + (size_t) g * num_cells;
+                    count += k == 0 ? validate_grid_generic(grid, box) : specialized(grid);
+                }
+                valid_count += count;
+            }
+            times[k] = (now_seconds() - start) / ((double) iterations * NUM_GRIDS);
+        }
+        printf("%2dx%-2d : generic %9.1f ns/grid  specialized %9.1f ns/grid  %12.0f grids/s  (%.2fx)\n",
+               side, side, times[0] * 1e9, times[1] * 1e9, 1 / times[1], times[0] / times[1]);
+
+    }
+
+    printf("9x9 grids use the %s validator\n", grid_validator_name);
+    free(grids);
+
+}
+
+
+/**
+ * Initializes the solver state from a puzzle.
+ * 
+ * Parameters
+ * ----------
+ *   state :  Solver state to initialize
+ *   puzzle : The 81 cells of the puzzle in row-major order, 0 for blanks
+ * 
+ * Returns
+ * -------
+ *   status : 1 if the given digits are in range and do not conflict, 0 if not
+ */
+int solver_init(struct solver_state* state, const uint8_t* puzzle) {
+
+    memset(state, 0, sizeof(*state));
+    state->empty = 81;
+    state->next_cell = -1;
+
+    for (int cell = 0; cell < 81; cell++) {
+        int digit = puzzle[cell];
+        if (digit == 0) {
+            continue;
+        }
+        if (digit > 9 || !(CANDIDATES(state, cell) & (1u << digit))) {
+            return 0;
+        }
+        solver_place(state, cell, digit);
+    }
+
+    return 1;
+
+}
+
+
+/**
+ * Places a digit in an empty cell. The digit must be a candidate of the cell.
+ * 
+ * Parameters
+ * ----------
+ *   state : Solver state
+ *   cell :  Index of the cell in row-major order
+ *   digit : Digit 1-9 to place
+ */
+void solver_place(struct solver_state* state, int cell, int digit) {
+    uint16_t bit = 1u << digit;
+    state->grid[cell] = digit;
+    state->rows[cell_row[cell]] |= bit;
+    state->cols[cell_col[cell]] |= bit;
+    state->boxes[cell_box[cell]] |= bit;
+    state->empty--;
+}
+
+
+/**
+ * Fills in every cell that is forced, until none are left. A naked single is
+ * an empty cell with one candidate; a hidden single is a digit that has only
+ * one possible cell in a row, column or subgrid. Afterwards, next_cell is
+ * the empty cell with the fewest candidates, or -1 if the grid is full.
+ * 
+ * Parameters
+ * ----------
+ *   state : Solver state, updated in place
+ * 
+ * Returns
+ * -------
+ *   status : 0 if a cell or a digit of a unit has no possibility left, 1 if not
+ */
+int solver_propagate(struct solver_state* state) {
+
+    uint16_t cached[81];  // Candidates of each cell, 0 for filled cells
+    int changed = 1;
+    while (changed) {
+
+        changed = 0;
+        int best_cell = -1, best_count = 10;
+
+        /* Naked singles, and the cell with the fewest candidates */
+        for (int cell = 0; cell < 81; cell++) {
+            cached[cell] = 0;
+            if (state->grid[cell] != 0) {
+                continue;
+            }
+            uint16_t candidates = CANDIDATES(state, cell);
+            cached[cell] = candidates;
+            if (candidates == 0) {
+                return 0;
+            }
+            if ((candidates & (candidates - 1)) == 0) {
+                solver_place(state, cell, __builtin_ctz(candidates));
+                changed = 1;
+                continue;
+            }
+            int count = __builtin_popcount(candidates);
+            if (count < best_count) {
+                best_count = count;
+                best_cell = cell;
+            }
+        }
+        if (changed) {
+            continue;
+        }
+
+        /* Hidden singles. Digits seen in two or more cells' candidates of a
+         * unit are tracked alongside those seen at least once. The cached
+         * candidates are exact until the first hidden single is placed, and
+         * only shrink afterwards, so any single found is still forced */
+        for (int unit = 0; unit < 27; unit++) {
+            const uint8_t* cells = unit_cells[unit];
+            uint16_t once = 0, more = 0;
+            for (int i = 0; i < 9; i++) {
+                uint16_t candidates = cached[cells[i]];
+                more |= once & candidates;
+                once |= candidates;
+            }
+            uint16_t used = unit < 9 ? state->boxes[unit] : unit < 18 ? state->rows[unit - 9] : state->cols[unit - 18];
+            uint16_t needed = FULL_UNIT_MASK & ~used;
+            if ((once & needed) != needed) {  // A missing digit has nowhere to go
+                return 0;
+            }
+            uint16_t singles = once & ~more & needed;
+            while (singles) {
+                int digit = __builtin_ctz(singles);
+                singles &= singles - 1;
+                int placed = 0;
+                for (int i = 0; i < 9 && !placed; i++) {
+                    int cell = cells[i];
+                    if (state->grid[cell] == 0 && (CANDIDATES(state, cell) & (1u << digit))) {
+                        solver_place(state, cell, digit);
+                        placed = 1;
+                    }
+                }
+                if (!placed) {  // Its only cell was taken by another digit
+                    return 0;
+                }
+                changed = 1;
+            }
+        }
+
+        state->next_cell = best_cell;
+
+    }
+
+    if (state->empty == 0) {
+        state->next_cell = -1;
+    }
+    return 1;
+
+}
+
+
+/**
+ * Counts the solutions of a puzzle by propagating forced cells and then
+ * trying each candidate of the cell with the fewest candidates.
+ * 
+ * Parameters
+ * ----------
+ *   state :    Solver state, updated in place
+ *   limit :    Stop once this many solutions are found
+ *   solution : Array of 81 cells that receives the first solution found, or
+ *              NULL
+ *   cancel :   Flag that stops the search early once set, or NULL
+ * 
+ * Returns
+ * -------
+ *   count : Number of solutions found, at most limit
+ */
+long solver_count(struct solver_state* state, long limit, uint8_t* solution, atomic_int* cancel) {
+
+    if (cancel != NULL && atomic_load_explicit(cancel, memory_order_relaxed)) {
+        return 0;
+    }
+    if (!solver_propagate(state)) {
+        return 0;
+    }
+    if (state->empty == 0) {
+        if (solution != NULL) {
+            memcpy(solution, state->grid, 81);
+        }
+        return 1;
+    }
+
+    int cell = state->next_cell;
+    uint16_t candidates = CANDIDATES(state, cell);
+    long found = 0;
+    while (candidates && found < limit) {
+        int digit = __builtin_ctz(candidates);
+        candidates &= candidates - 1;
+        struct solver_state next = *state;
+        solver_place(&next, cell, digit);
+        found += solver_count(&next, limit - found, found == 0 ? solution : NULL, cancel);
+    }
+    return found;
+
+}
+
+
+/**
+ * Checks that a solution is valid and keeps every given digit of its puzzle.
+ * 
+ * Parameters
+ * ----------
+ *   puzzle :   The 81 cells of the puzzle, 0 for blanks
+ *   solution : The 81 cells of the solution
+ * 
+ * Returns
+ * -------
+ *   valid : 1 if the solution solves the puzzle, 0 if not
+ */
+int check_solution(const uint8_t* puzzle, const uint8_t* solution) {
+    for (int cell = 0; cell < 81; cell++) {
+        if (puzzle[cell] != 0 && puzzle[cell] != solution[cell]) {
+            return 0;
+        }
+    }
+    return validate_grid(solution);
+}
+
+
+/**
+ * Solves every puzzle in a file, printing each solution as a line of 81
+ * digits followed by a summary with the solving rate.
+ * 
+ * Parameters
+ * ----------
+ *   filename : File of puzzles, with 0 or '.' for blank cells
+ */
+void run_solve(char* filename) {
+
+    struct grid_file file;
+    grid_file_open(&file, filename);
+    select_grid_validator();
+
+    uint8_t puzzle[81], solution[81];
+    char line[83];
+    long total = 0, solved = 0;
+    double elapsed = 0;
+
+    while (parse_grid(&file, puzzle)) {
+
+        total++;
+        struct solver_state state;
+        double start = now_seconds();
+        int found = solver_init(&state, puzzle) && solver_count(&state, 1, solution, NULL) == 1;
+        elapsed += now_seconds() - start;
+
+        if (!found) {
+            printf("Puzzle %ld has no solution\n", total);
+            continue;
+        }
+        if (!check_solution(puzzle, solution)) {
+            printf("Error: solution of puzzle %ld is not valid.\n", total);
+            exit(0);
+        }
+        for (int cell = 0; cell < 81; cell++) {
+            line[cell] = '0' + solution[cell];
+        }
+        line[81] = '\n';
+        line[82] = '\0';
+        fputs(line, stdout);
+        solved++;
+
+    }
+    grid_file_close(&file);
+
+    printf("\n%s contains %ld puzzles: %ld solved, %ld without a solution\n", filename, total, solved, total - solved);
+    printf("Solved in %.3f s, %.0f puzzles/s\n", elapsed, elapsed > 0 ? total / elapsed : 0.0);
+
+}
+
+
+/**
+ * Allocates a dancing links matrix. Its arrays are allocated once and reused
+ * by every puzzle, so solving does not allocate.
+ * 
+ * Parameters
+ * ----------
+ *   max_columns : Maximum number of columns
+ *   max_nodes :   Maximum number of nodes, including the root and headers
+ * 
+ * Returns
+ * -------
+ *   dlx : The matrix, to be released with dlx_free
+ */
+struct dlx* dlx_create(int max_columns, int max_nodes) {
+
+    struct dlx* dlx = malloc(sizeof(struct dlx));
+    int* arrays = malloc((6 * (size_t) max_nodes + 2 * (size_t) max_columns) * sizeof(int));
+    if (dlx == NULL || arrays == NULL) {
+        printf("Error allocating memory.");
+        exit(0);
+    }
+
+    /* One allocation holds every array */
+    dlx->left = arrays;
+    dlx->right = dlx->left + max_nodes;
+    dlx->up = dlx->right + max_nodes;
+    dlx->down = dlx->up + max_nodes;
+    dlx->column = dlx->down + max_nodes;
+    dlx->row = dlx->column + max_nodes;
+    dlx->partial = dlx->row + max_nodes;
+    dlx->solution = dlx->partial + max_columns;
+    dlx->size = malloc((max_columns + 1) * sizeof(int));
+    dlx->max_columns = max_columns;
+    dlx->max_nodes = max_nodes;
+    dlx_reset(dlx, 0, 0);
+    return dlx;
+
+}
+
+
+/**
+ * Releases a dancing links matrix.
+ * 
+ * Parameters
+ * ----------
+ *   dlx : Matrix to release
+ */
+void dlx_free(struct dlx* dlx) {
+    free(dlx->left);
+    free(dlx->size);
+    free(dlx);
+}
+
+
+/**
+ * Empties a dancing links matrix and sets up its column headers. Primary
+ * columns are linked into the root's list, so the search must cover them;
+ * secondary columns are linked only to themselves.
+ * 
+ * Parameters
+ * ----------
+ *   dlx :           Matrix to reset
+ *   num_primary :   Number of columns that must be covered exactly once
+ *   num_secondary : Number of columns that may be covered at most once
+ */
+void dlx_reset(struct dlx* dlx, int num_primary, int num_secondary) {
+
+    dlx->num_columns = num_primary + num_secondary;
+    dlx->num_nodes = dlx->num_columns + 1;
+    dlx->left[0] = num_primary;
+    dlx->right[0] = num_primary > 0 ? 1 : 0;
+
+    for (int c = 1; c <= dlx->num_columns; c++) {
+        dlx->up[c] = dlx->down[c] = c;
+        dlx->column[c] = c;
+        dlx->size[c] = 0;
+        if (c <= num_primary) {
+            dlx->left[c] = c - 1;
+            dlx->right[c] = c < num_primary ? c + 1 : 0;
+        }
+        else {
+            dlx->left[c] = dlx->right[c] = c;
+        }
+    }
+
+}
+
+
+/**
+ * Adds a row to a dancing links matrix.
+ * 
+ * Parameters
+ * ----------
+ *   dlx :     Matrix to add to
+ *   row_id :  Identifier reported in solutions
+ *   columns : Columns covered by the row, numbered from 0
+ *   count :   Number of columns
+ */
+void dlx_add_row(struct dlx* dlx, int row_id, const int* columns, int count) {
+
+    if (dlx->num_nodes + count > dlx->max_nodes) {
+        printf("Error: exact cover matrix is full.\n");
+        exit(0);
+    }
+
+    int first = dlx->num_nodes;
+    for (int i = 0; i < count; i++) {
+        int node = dlx->num_nodes++;
+        int header = columns[i] + 1;
+
+        /* Insert at the bottom of the column */
+        dlx->column[node] = header;
+        dlx->row[node] = row_id;
+        dlx->up[node] = dlx->up[header];
+        dlx->down[node] = header;
+        dlx->down[dlx->up[header]] = node;
+        dlx->up[header] = node;
+        dlx->size[header]++;
+
+        /* Link into the row's circular list */
+        dlx->left[node] = i == 0 ? node : node - 1;
+        dlx->right[node] = first;
+        dlx->right[dlx->left[node]] = node;
+        dlx->left[first] = node;
+    }
+
+}
+
+
+/**
+ * Removes a column from the header list, and every row that covers it from
+ * the other columns.
+ * 
+ * Parameters
+ * ----------
+ *   dlx : Matrix
+ *   c :   Header index of the column
+ */
+void dlx_cover(struct dlx* dlx, int c) {
+    dlx->right[dlx->left[c]] = dlx->right[c];
+    dlx->left[dlx->right[c]] = dlx->left[c];
+    for (int i = dlx->down[c]; i != c; i = dlx->down[i]) {
+        for (int j = dlx->right[i]; j != i; j = dlx->right[j]) {
+            dlx->down[dlx->up[j]] = dlx->down[j];
+            dlx->up[dlx->down[j]] = dlx->up[j];
+            dlx->size[dlx->column[j]]--;
+        }
+    }
+}
+
+
+/**
+ * Restores a column removed by dlx_cover, in the reverse order.
+ * 
+ * Parameters
+ * ----------
+ *   dlx : Matrix
+ *   c :   Header index of the column
+ */
+void dlx_uncover(struct dlx* dlx, int c) {
+    for (int i = dlx->up[c]; i != c; i = dlx->up[i]) {
+        for (int j = dlx->left[i]; j != i; j = dlx->left[j]) {
+            dlx->size[dlx->column[j]]++;
+            dlx->down[dlx->up[j]] = j;
+            dlx->up[dlx->down[j]] = j;
+        }
+    }
+    dlx->right[dlx->left[c]] = c;
+    dlx->left[dlx->right[c]] = c;
+}
+
+
+/**
+ * Searches for exact covers with Algorithm X, always branching on the
+ * primary column with the fewest remaining rows.
+ * 
+ * Parameters
+ * ----------
+ *   dlx : Matrix, whose found count and first solution are updated
+ */
+void dlx_search(struct dlx* dlx) {
+
+    if (dlx->right[0] == 0) {  // Every primary column is covered
+        if (dlx->found++ == 0) {
+            memcpy(dlx->solution, dlx->partial, dlx->depth * sizeof(int));
+            dlx->solution_length = dlx->depth;
+        }
+        return;
+    }
+
+    /* Column with the fewest rows */
+    int best = dlx->right[0];
+    for (int c = dlx->right[best]; c != 0 && dlx->size[best] > 1; c = dlx->right[c]) {
+        if (dlx->size[c] < dlx->size[best]) {
+            best = c;
+        }
+    }
+    if (dlx->size[best] == 0) {
+        return;
+    }
+
+    dlx_cover(dlx, best);
+    for (int r = dlx->down[best]; r != best && dlx->found < dlx->limit; r = dlx->down[r]) {
+        dlx->partial[dlx->depth++] = dlx->row[r];
+        for (int j = dlx->right[r]; j != r; j = dlx->right[j]) {
+            dlx_cover(dlx, dlx->column[j]);
+        }
+        dlx_search(dlx);
+        for (int j = dlx->left[r]; j != r; j = dlx->left[j]) {
+            dlx_uncover(dlx, dlx->column[j]);
+        }
+        dlx->depth--;
+    }
+    dlx_uncover(dlx, best);
+
+}
+
+
+/**
+ * Finds exact covers of a matrix, up to a limit.
+ * 
+ * Parameters
+ * ----------
+ *   dlx :   Matrix
+ *   limit : Stop once this many solutions are found
+ * 
+ * Returns
+ * -------
+ *   count : Number of solutions found, at most limit
+ */
+long dlx_solve(struct dlx* dlx, long limit) {
+    dlx->found = 0;
+    dlx->limit = limit;
+    dlx->depth = 0;
+    dlx->solution_length = 0;
+    dlx_search(dlx);
+    return dlx->found;
+}
+
+
+/**
+ * Converts the name of a sudoku variant to its number.
+ * 
+ * Parameters
+ * ----------
+ *   name : standard, diagonal or windoku
+ * 
+ * Returns
+ * -------
+ *   variant : Number of the variant
+ */
+int parse_variant(const char* name) {
+    for (int v = 0; v < NUM_VARIANTS; v++) {
+        if (strcmp(name, variant_names[v]) == 0) {
+            return v;
+        }
+    }
+    printf("Unknown variant %s.\n", name);
+    exit(0);
+}
+
+
+/**
+ * Builds the exact cover matrix of a puzzle. Every digit of every blank cell
+ * is a row, and given cells have only the row of their digit, so givens that
+ * conflict leave the matrix without a cover.
+ * 
+ * Parameters
+ * ----------
+ *   dlx :     Matrix to build into
+ *   puzzle :  The 81 cells of the puzzle, 0 for blanks
+ *   variant : Variant whose extra units are added as constraints
+ */
+void dlx_build_sudoku(struct dlx* dlx, const uint8_t* puzzle, int variant) {
+
+    /* Unit of each cell in each extra unit, or -1 */
+    int extra[MAX_EXTRA_UNITS][81];
+    int num_extra = variant_units[variant];
+    for (int k = 0; k < num_extra; k++) {
+        memset(extra[k], -1, sizeof(extra[k]));
+        for (int i = 0; i < 9; i++) {
+            extra[k][variant_cells[variant][k][i]] = k;
+        }
+    }
+
+    dlx_reset(dlx, DLX_CELL_COLUMNS + 9 * num_extra, 0);
+    int columns[4 + MAX_EXTRA_UNITS];
+    for (int cell = 0; cell < 81; cell++) {
+        for (int digit = 1; digit <= 9; digit++) {
+            if (puzzle[cell] != 0 && puzzle[cell] != digit) {
+                continue;
+            }
+            int d = digit - 1, count = 0;
+            columns[count++] = cell;
+            columns[count++] = 81 + 9 * cell_row[cell] + d;
+            columns[count++] = 162 + 9 * cell_col[cell] + d;
+            columns[count++] = 243 + 9 * cell_box[cell] + d;
+            for (int k = 0; k < num_extra; k++) {
+                if (extra[k][cell] >= 0) {
+                    columns[count++] = DLX_CELL_COLUMNS + 9 * k + d;
+                }
+            }
+            dlx_add_row(dlx, 9 * cell + d, columns, count);
+        }
+    }
+
+}
+
+
+/**
+ * Solves a puzzle with dancing links.
+ * 
+ * Parameters
+ * ----------
+ *   dlx :      Matrix to build the puzzle into
+ *   puzzle :   The 81 cells of the puzzle, 0 for blanks
+ *   variant :  Variant whose extra units must also hold every digit
+ *   limit :    Stop once this many solutions are found
+ *   solution : Array of 81 cells that receives the first solution found
+ * 
+ * Returns
+ * -------
+ *   count : Number of solutions found, at most limit
+ */
+long dlx_solve_sudoku(struct dlx* dlx, const uint8_t* puzzle, int variant, long limit, uint8_t* solution) {
+
+    for (int cell = 0; cell < 81; cell++) {
+        if (puzzle[cell] > 9) {
+            return 0;
+        }
+    }
+
+    dlx_build_sudoku(dlx, puzzle, variant);
+    long found = dlx_solve(dlx, limit);
+    for (int i = 0; found > 0 && i < dlx->solution_length; i++) {
+        solution[dlx->solution[i] / 9] = dlx->solution[i] % 9 + 1;
+    }
+    return found;
+
+}
+
+
+/**
+ * Checks that a solution solves a puzzle and fills every extra unit of its
+ * variant with each digit.
+ * 
+ * Parameters
+ * ----------
+ *   puzzle :   The 81 cells of the puzzle, 0 for blanks
+ *   solution : The 81 cells of the solution
+ *   variant :  Variant of the puzzle
+ * 
+ * Returns
+ * -------
+ *   valid : 1 if the solution solves the puzzle, 0 if not
+ */
+int check_variant_solution(const uint8_t* puzzle, const uint8_t* solution, int variant) {
+
+    if (!check_solution(puzzle, solution)) {
+        return 0;
+    }
+    for (int k = 0; k < variant_units[variant]; k++) {
+        unsigned mask = 0;
+        for (int i = 0; i < 9; i++) {
+            mask |= 1u << solution[variant_cells[variant][k][i]];
+        }
+        if (mask != FULL_UNIT_MASK) {
+            return 0;
+        }
+    }
+    return 1;
+
+}
+
+
+/**
+ * Solves every puzzle of a variant in a file with dancing links, printing
+ * each solution as a line of 81 digits followed by a summary.
+ * 
+ * Parameters
+ * ----------
+ *   filename : File of puzzles, with 0 or '.' for blank cells
+ *   variant :  Variant of the puzzles
+ */
+void run_dlx_solve(char* filename, int variant) {
+
+    struct grid_file file;
+    grid_file_open(&file, filename);
+    select_grid_validator();
+    struct dlx* dlx = dlx_create(DLX_MAX_COLUMNS, DLX_MAX_NODES);
+
+    uint8_t puzzle[81], solution[81];
+    char line[83];
+    long total = 0, solved = 0;
+    double elapsed = 0;
+
+    while (parse_grid(&file, puzzle)) {
+
+        total++;
+        double start = now_seconds();
+        long found = dlx_solve_sudoku(dlx, puzzle, variant, 1, solution);
+        elapsed += now_seconds() - start;
+
+        if (found == 0) {
+            printf("Puzzle %ld has no solution\n", total);
+            continue;
+        }
+        if (!check_variant_solution(puzzle, solution, variant)) {
+            printf("Error: solution of puzzle %ld is not valid.\n", total);
+            exit(0);
+        }
+        for (int cell = 0; cell < 81; cell++) {
+            line[cell] = '0' + solution[cell];
+        }
+        line[81] = '\n';
+        line[82] = '\0';
+        fputs(line, stdout);
+        solved++;
+
+    }
+    grid_file_close(&file);
+    dlx_free(dlx);
+
+    printf("\n%s contains %ld %s puzzles: %ld solved, %ld without a solution\n",
+           filename, total, variant_names[variant], solved, total - solved);
+    printf("Solved in %.3f s, %.0f puzzles/s\n", elapsed, elapsed > 0 ? total / elapsed : 0.0);
+
+}
+
+
+/**
+ * Times the bitset and dancing links solvers on every puzzle in a file,
+ * checking uniqueness by searching for a second solution, and reports the
+ * average time of each solver for each range of given counts.
+ * 
+ * Parameters
+ * ----------
+ *   filename : File of standard puzzles, with 0 or '.' for blank cells
+ */
+void run_solver_benchmark(char* filename) {
+
+    enum { NUM_CLASSES = 4 };
+    const char* class_names[NUM_CLASSES] = {"17-22 givens", "23-27 givens", "28-35 givens", "36+ givens"};
+    const int class_limits[NUM_CLASSES] = {22, 27, 35, 81};
+    double times[NUM_CLASSES][2] = {{0}};
+    long counts[NUM_CLASSES] = {0};
+
+    struct grid_file file;
+    grid_file_open(&file, filename);
+    select_grid_validator();
+    struct dlx* dlx = dlx_create(DLX_MAX_COLUMNS, DLX_MAX_NODES);
+    uint8_t puzzle[81], solutions[2][81];
+    long total = 0;
+
+    while (parse_grid(&file, puzzle)) {
+
+        total++;
+        int givens = 0;
+        for (int cell = 0; cell < 81; cell++) {
+            givens += puzzle[cell] != 0;
+        }
+        int class = 0;
+        while (givens > class_limits[class]) {
+            class++;
+        }
+
+        long found[2];
+        double start = now_seconds();
+        struct solver_state state;
+        found[0] = solver_init(&state, puzzle) ? solver_count(&state, 2, solutions[0], NULL) : 0;
+        double middle = now_seconds();
+        found[1] = dlx_solve_sudoku(dlx, puzzle, STANDARD, 2, solutions[1]);
+        double end = now_seconds();
+
+        if (found[0] != found[1] || (found[0] > 0 && !check_solution(puzzle, solutions[0]))
+                || (found[1] > 0 && !check_solution(puzzle, solutions[1]))) {
+            printf("Error: solvers disagree on puzzle %ld.\n", total);
+            exit(0);
+        }
+        times[class][0] += middle - start;
+        times[class][1] += end - middle;
+        counts[class]++;
+
+    }
+    grid_file_close(&file);
+    dlx_free(dlx);
+
+    printf("%ld puzzles, searched for up to two solutions\n", total);
+    for (int class = 0; class < NUM_CLASSES; class++) {
+        if (counts[class] == 0) {
+            continue;
+        }
+        double bitset = times[class][0] / counts[class] * 1e6, links = times[class][1] / counts[class] * 1e6;
+        printf("%-12s : %7ld puzzles  bitset %9.1f us  dancing links %9.1f us  faster: %s (%.2fx)\n",
+               class_names[class], counts[class], bitset, links,
+               bitset <= links ? "bitset" : "dancing links", bitset <= links ? links / bitset : bitset / links);
+    }
+
+}
+
+
+/**
+ * Pushes a task onto the bottom of a deque.
+ * 
+ * Parameters
+ * ----------
+ *   deque : Deque owned by the calling thread
+ *   task :  Task to push
+ * 
+ * Returns
+ * -------
+ *   status : 1 if the task was pushed, 0 if the deque is full
+ */
+int deque_push(struct task_deque* deque, const struct search_task* task) {
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom == DEQUE_TASKS && deque->top > 0) {  // Slide the tasks down to make room
+        memmove(deque->tasks, deque->tasks + deque->top, (deque->bottom - deque->top) * sizeof(struct search_task));
+        deque->bottom -= deque->top;
+        deque->top = 0;
+    }
+    int pushed = deque->bottom < DEQUE_TASKS;
+    if (pushed) {
+        deque->tasks[deque->bottom++] = *task;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return pushed;
+
+}
+
+
+/**
+ * Pops the newest task from the bottom of a deque.
+ * 
+ * Parameters
+ * ----------
+ *   deque : Deque owned by the calling thread
+ *   task :  Receives the task
+ * 
+ * Returns
+ * -------
+ *   status : 1 if a task was popped, 0 if the deque is empty
+ */
+int deque_pop(struct task_deque* deque, struct search_task* task) {
+    pthread_mutex_lock(&deque->lock);
+    int popped = deque->bottom > deque->top;
+    if (popped) {
+        *task = deque->tasks[--deque->bottom];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return popped;
+}
+
+
+/**
+ * Steals the oldest task from the top of another thread's deque, giving up
+ * rather than waiting if the deque is locked.
+ * 
+ * Parameters
+ * ----------
+ *   deque : Deque to steal from
+ *   task :  Receives the task
+ * 
+ * Returns
+ * -------
+ *   status : 1 if a task was stolen, 0 if the deque is empty
+ */
+int deque_steal(struct task_deque* deque, struct search_task* task) {
+    if (pthread_mutex_trylock(&deque->lock) != 0) {  // Busy, so try another thread
+        return 0;
+    }
+    int stolen = deque->bottom > deque->top;
+    if (stolen) {
+        *task = deque->tasks[deque->top++];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return stolen;
+}
+
+
+/**
+ * Adds solutions found by one task to the shared count, keeps the first
+ * solution, and cancels the search once the limit is reached.
+ * 
+ * Parameters
+ * ----------
+ *   search :   Shared search state
+ *   found :    Number of solutions found
+ *   solution : One of the solutions found
+ */
+void record_solutions(struct parallel_search* search, long found, const uint8_t* solution) {
+    long total = atomic_fetch_add(&search->solutions, found) + found;
+    if (!atomic_exchange(&search->have_solution, 1)) {
+        memcpy(search->solution, solution, 81);
+    }
+    if (search->limit > 0 && total >= search->limit) {
+        atomic_store(&search->cancel, 1);
+    }
+}
+
+
+/**
+ * Runs one search task. Above the split depth, the task branches on the
+ * cell with the fewest candidates and pushes one task per candidate; below
+ * it, the subtree is searched sequentially.
+ * 
+ * Parameters
+ * ----------
+ *   search : Shared search state
+ *   id :     Number of the calling thread
+ *   task :   Task to run
+ */
+void process_task(struct parallel_search* search, int id, struct search_task* task) {
+
+    if (atomic_load_explicit(&search->cancel, memory_order_relaxed)) {
+        return;
+    }
+    struct solver_state* state = &task->state;
+    if (!solver_propagate(state)) {
+        return;
+    }
+    if (state->empty == 0) {
+        record_solutions(search, 1, state->grid);
+        return;
+    }
+
+    /* Search small subtrees sequentially */
+    if (task->depth >= SPLIT_DEPTH) {
+        long remaining = search->limit > 0 ? search->limit - atomic_load(&search->solutions) : LONG_MAX;
+        uint8_t solution[81];
+        long found = remaining > 0 ? solver_count(state, remaining, solution, &search->cancel) : 0;
+        if (found > 0) {
+            record_solutions(search, found, solution);
+        }
+        return;
+    }
+
+    /* Split the others into one task per candidate */
+    int cell = state->next_cell;
+    uint16_t candidates = CANDIDATES(state, cell);
+    while (candidates) {
+        int digit = __builtin_ctz(candidates);
+        candidates &= candidates - 1;
+        struct search_task child;
+        child.state = *state;
+        child.depth = task->depth + 1;
+        solver_place(&child.state, cell, digit);
+        atomic_fetch_add(&search->pending, 1);
+        if (!deque_push(&search->deques[id], &child)) {  // Deque is full, so run it now
+            process_task(search, id, &child);
+            atomic_fetch_sub(&search->pending, 1);
+        }
+    }
+
+}
+
+
+/**
+ * Worker thread of a parallel search. Runs tasks from its own deque, steals
+ * from the other threads' deques when it is empty, and exits once no task
+ * is queued or running anywhere.
+ * 
+ * Parameters
+ * ----------
+ *   args : Search worker giving the shared state and the thread number
+ */
+void* search_worker(void* args) {
+
+    struct search_worker* worker = args;
+    struct parallel_search* search = worker->search;
+    struct search_task task;
+
+    while (1) {
+
+        int have_task = deque_pop(&search->deques[worker->id], &task);
+        for (int attempt = 0; !have_task && attempt < search->num_threads; attempt++) {
+            int victim = random_next(&worker->seed) % search->num_threads;
+            if (victim != worker->id && deque_steal(&search->deques[victim], &task)) {
+                have_task = 1;
+                atomic_fetch_add(&search->steals, 1);
+            }
+        }
+
+        if (have_task) {
+            process_task(search, worker->id, &task);
+            atomic_fetch_sub(&search->pending, 1);
+        }
+        else if (atomic_load(&search->pending) == 0) {
+            break;
+        }
+        else {
+            sched_yield();
+        }
+
+    }
+
+    return NULL;
+
+}
+
+
+/**
+ * Counts the solutions of a puzzle with a parallel work-stealing search.
+ * 
+ * Parameters
+ * ----------
+ *   puzzle :      The 81 cells of the puzzle, 0 for blanks
+ *   num_threads : Number of threads
+ *   limit :       Stop once this many solutions are found, or 0 to count all
+ *   solution :    Array of 81 cells that receives a solution, if any
+ *   steals :      Receives the number of tasks stolen between threads
+ * 
+ * Returns
+ * -------
+ *   count : Number of solutions, at most limit if a limit is given
+ */
+long parallel_count(const uint8_t* puzzle, int num_threads, long limit, uint8_t* solution, long* steals) {
+
+    struct search_task root;
+    *steals = 0;
+    if (!solver_init(&root.state, puzzle)) {
+        return 0;
+    }
+    root.depth = 0;
+
+    struct parallel_search search;
+    search.num_threads = num_threads;
+    search.deques = malloc(num_threads * sizeof(struct task_deque));
+    search.limit = limit;
+    atomic_init(&search.pending, 1);
+    atomic_init(&search.solutions, 0);
+    atomic_init(&search.steals, 0);
+    atomic_init(&search.cancel, 0);
+    atomic_init(&search.have_solution, 0);
+    for (int t = 0; t < num_threads; t++) {
+        search.deques[t].top = search.deques[t].bottom = 0;
+        pthread_mutex_init(&search.deques[t].lock, NULL);
+    }
+    deque_push(&search.deques[0], &root);
+
+    pthread_t threads[MAX_THREADS];
+    struct search_worker workers[MAX_THREADS];
+    for (int t = 0; t < num_threads; t++) {
+        workers[t].search = &search;
+        workers[t].id = t;
+        workers[t].seed = 2654435761u * (t + 1);
+        if (pthread_create(&threads[t], NULL, search_worker, &workers[t])) {
+            printf("Error creating threads.");
+            exit(0);
+        }
+    }
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    for (int t = 0; t < num_threads; t++) {
+        pthread_mutex_destroy(&search.deques[t].lock);
+    }
+    free(search.deques);
+
+    long count = atomic_load(&search.solutions);
+    if (count > 0) {
+        memcpy(solution, search.solution, 81);
+    }
+    *steals = atomic_load(&search.steals);
+    return limit > 0 && count > limit ? limit : count;  // Threads may pass the limit together
+
+}
+
+
+/**
+ * Counts the solutions of every puzzle in a file, with the sequential solver
+ * and with the parallel search, and prints both times.
+ * 
+ * Parameters
+ * ----------
+ *   filename :    File of puzzles, with 0 or '.' for blank cells
+ *   num_threads : Number of threads of the parallel search
+ *   limit :       Stop once this many solutions are found, or 0 to count all
+ */
+void run_count(char* filename, int num_threads, long limit) {
+
+    struct grid_file file;
+    grid_file_open(&file, filename);
+    select_grid_validator();
+
+    uint8_t puzzle[81], solution[81];
+    long total = 0;
+    double sequential_time = 0, parallel_time = 0;
+
+    while (parse_grid(&file, puzzle)) {
+
+        total++;
+        struct solver_state state;
+        double start = now_seconds();
+        long expected = solver_init(&state, puzzle) ? solver_count(&state, limit > 0 ? limit : LONG_MAX, solution, NULL) : 0;
+        double middle = now_seconds();
+        long steals;
+        long count = parallel_count(puzzle, num_threads, limit, solution, &steals);
+        double end = now_seconds();
+
+        if (count != expected || (count > 0 && !check_solution(puzzle, solution))) {
+            printf("Error: parallel search found %ld solutions of puzzle %ld instead of %ld.\n", count, total, expected);
+            exit(0);
+        }
+        sequential_time += middle - start;
+        parallel_time += end - middle;
+
+        const char* description = count == 0 ? "no solution" : count == 1 ? "a unique solution" : "solutions";
+        if (count > 1 && count == limit) {
+            printf("Puzzle %ld has at least %ld %s", total, count, description);
+        }
+        else if (count > 1) {
+            printf("Puzzle %ld has %ld %s", total, count, description);
+        }
+        else {
+            printf("Puzzle %ld has %s", total, description);
+        }
+        printf("  (sequential %.4f s, %d threads %.4f s, %ld steals)\n", middle - start, num_threads, end - middle, steals);
+
+    }
+    grid_file_close(&file);
+
+    printf("\n%s contains %ld puzzles: sequential %.3f s, %d threads %.3f s (%.2fx)\n",
+           filename, total, sequential_time, num_threads, parallel_time, sequential_time / parallel_time);
+
+}
+
+
+/**
+ * Starts tracking a grid, counting the digits of every unit once.
+ * 
+ * Parameters
+ * ----------
+ *   tracker : Tracker to initialize
+ *   grid :    The 81 cells of the grid in row-major order, 0 for empty
+ */
+void tracker_init(struct move_tracker* tracker, const uint8_t* grid) {
+    memset(tracker, 0, sizeof(*tracker));
+    for (int cell = 0; cell < 81; cell++) {
+        tracker_add(tracker, cell, grid[cell]);
+    }
+}
+
+
+/**
+ * Places a value in an empty cell and counts it in the cell's row, column
+ * and subgrid. A unit gains a conflict when a digit's count reaches 2.
+ * 
+ * Parameters
+ * ----------
+ *   tracker : Tracker to update
+ *   cell :    Index of the empty cell
+ *   digit :   Value to place, 0 to leave the cell empty
+ */
+void tracker_add(struct move_tracker* tracker, int cell, int digit) {
+
+    tracker->grid[cell] = digit;
+    if (digit == 0) {
+        return;
+    }
+    tracker->filled++;
+    if (digit > 9) {
+        tracker->bad_values++;
+        return;
+    }
+
+    int units[3] = {cell_box[cell], 9 + cell_row[cell], 18 + cell_col[cell]};
+    for (int i = 0; i < 3; i++) {
+        int u = units[i];
+        int count = ++tracker->counts[u][digit];
+        tracker->masks[u] |= 1u << digit;
+        if (count == 2) {
+            tracker->conflicts++;
+            if (tracker->repeats[u]++ == 0) {
+                tracker->conflict_units |= 1u << u;
+            }
+        }
+    }
+
+}
+
+
+/**
+ * Removes the value of a cell from the counts of its row, column and
+ * subgrid, and empties the cell. A unit loses a conflict when a digit's
+ * count drops back to 1.
+ * 
+ * Parameters
+ * ----------
+ *   tracker : Tracker to update
+ *   cell :    Index of the cell
+ *   digit :   Value the cell holds
+ */
+void tracker_remove(struct move_tracker* tracker, int cell, int digit) {
+
+    tracker->grid[cell] = 0;
+    if (digit == 0) {
+        return;
+    }
+    tracker->filled--;
+    if (digit > 9) {
+        tracker->bad_values--;
+        return;
+    }
+
+    int units[3] = {cell_box[cell], 9 + cell_row[cell], 18 + cell_col[cell]};
+    for (int i = 0; i < 3; i++) {
+        int u = units[i];
+        int count = --tracker->counts[u][digit];
+        if (count == 0) {
+            tracker->masks[u] &= ~(1u << digit);
+        }
+        else if (count == 1) {
+            tracker->conflicts--;
+            if (--tracker->repeats[u] == 0) {
+                tracker->conflict_units &= ~(1u << u);
+            }
+        }
+    }
+
+}
+
+
+/**
+ * Sets a cell to a digit, or empties it, in constant time.
+ * 
+ * Parameters
+ * ----------
+ *   tracker : Tracker to update
+ *   cell :    Index of the cell, 0-80
+ *   digit :   Digit 1-9, or 0 to empty the cell
+ * 
+ * Returns
+ * -------
+ *   move : The move, which tracker_undo reverts
+ */
+struct move tracker_apply(struct move_tracker* tracker, int cell, int digit) {
+    struct move move = {cell, digit, tracker->grid[cell]};
+    tracker_remove(tracker, cell, move.previous);
+    tracker_add(tracker, cell, digit);
+    return move;
+}
+
+
+/**
+ * Reverts a move, restoring the value the cell held before it. Moves must be
+ * undone in the reverse order they were applied.
+ * 
+ * Parameters
+ * ----------
+ *   tracker : Tracker to update
+ *   move :    Move returned by tracker_apply
+ */
+void tracker_undo(struct move_tracker* tracker, struct move move) {
+    tracker_remove(tracker, move.cell, move.digit);
+    tracker_add(tracker, move.cell, move.previous);
+}
+
+
+/**
+ * Determines if no row, column or subgrid repeats a digit, ignoring empty
+ * cells.
+ */
+int tracker_consistent(const struct move_tracker* tracker) {
+    return tracker->conflicts == 0 && tracker->bad_values == 0;
+}
+
+
+/**
+ * Determines if the grid is full and consistent, so it is a valid solution.
+ */
+int tracker_solved(const struct move_tracker* tracker) {
+    return tracker->filled == 81 && tracker_consistent(tracker);
+}
+
+
+/**
+ * Determines if two trackers hold the same grid and counts. Fields are
+ * compared one by one, since the padding of the struct is not guaranteed to
+ * survive a copy.
+ */
+int tracker_equal(const struct move_tracker* a, const struct move_tracker* b) {
+    return memcmp(a->grid, b->grid, sizeof(a->grid)) == 0 &&
+           memcmp(a->counts, b->counts, sizeof(a->counts)) == 0 &&
+           memcmp(a->masks, b->masks, sizeof(a->masks)) == 0 &&
+           memcmp(a->repeats, b->repeats, sizeof(a->repeats)) == 0 &&
+           a->conflict_units == b->conflict_units && a->conflicts == b->conflicts &&
+           a->filled == b->filled && a->bad_values == b->bad_values;
+}
+
+
+/**
+ * Counts the digits repeated within a row, column or subgrid by scanning all
+ * 27 units, as a reference for the tracker.
+ * 
+ * Parameters
+ * ----------
+ *   grid : The 81 cells of the grid in row-major order, 0 for empty
+ * 
+ * Returns
+ * -------
+ *   conflicts : Number of (unit, digit) pairs where the digit appears more
+ *               than once, or -1 if a cell holds a value other than 0-9
+ */
+int count_conflicts_scan(const uint8_t* grid) {
+
+    int conflicts = 0;
+    for (int u = 0; u < 27; u++) {
+        unsigned seen = 0, repeated = 0;
+        for (int i = 0; i < 9; i++) {
+            unsigned value = grid[unit_cells[u][i]];
+            if (value > 9) {
+                return -1;
+            }
+            unsigned bit = (1u << value) & ~1u;  // Empty cells do not count
+            repeated |= seen & bit;
+            seen |= bit;
+        }
+        conflicts += __builtin_popcount(repeated);
+    }
+    return conflicts;
+
+}
+
+
+/**
+ * Prints the name of a unit the way the unit threads do, e.g. "row 3".
+ * 
+ * Parameters
+ * ----------
+ *   unit : Index of the unit in the unit tables
+ */
+void print_unit_name(int unit) {
+    static const char* types[3] = {"subgrid", "row", "column"};
+    printf("%s %d", types[unit / 9], unit % 9 + 1);
+}
+
+
+/**
+ * Loads a grid and applies moves read from standard input, reporting after
+ * each whether the grid is still consistent and which units repeat a digit.
+ * 
+ * Parameters
+ * ----------
+ *   filename : File containing the starting grid, with 0 or '.' for blanks
+ */
+void run_edit(char* filename) {
+
+    struct grid_file file;
+    uint8_t grid[81];
+    grid_file_open(&file, filename);
+    if (!parse_grid(&file, grid)) {
+        printf("Error: %s does not contain a grid.\n", filename);
+        exit(0);
+    }
+    grid_file_close(&file);
+
+    struct move_tracker tracker;
+    tracker_init(&tracker, grid);
+    struct move history[1024];  // Moves that can be undone, oldest dropped first
+    long num_moves = 0;         // Number of moves applied and not undone
+    int undoable = 0;           // Number of those still in the history
+
+    char line[256];
+    int first = 1;
+    while (first || fgets(line, sizeof(line), stdin) != NULL) {
+
+        if (!first) {
+            int row, col, digit;
+            char command;
+            if (sscanf(line, " %c", &command) == 1 && command == 'u') {
+                if (undoable == 0) {
+                    printf("Nothing to undo\n");
+                    continue;
+                }
+                undoable--;
+                struct move move = history[--num_moves % 1024];
+                tracker_undo(&tracker, move);
+                printf("Undo r%dc%d: ", cell_row[move.cell] + 1, cell_col[move.cell] + 1);
+            }
+            else if (sscanf(line, "%d %d %d", &row, &col, &digit) == 3 && row >= 1 && row <= 9 && col >= 1 && col <= 9 && digit >= 0 && digit <= 9) {
+                history[num_moves++ % 1024] = tracker_apply(&tracker, 9 * (row - 1) + col - 1, digit);
+                undoable += undoable < 1024;
+                printf("r%dc%d = %d: ", row, col, digit);
+            }
+            else {
+                printf("Moves are \"<row 1-9> <column 1-9> <digit 0-9>\" or \"u\"\n");
+                continue;
+            }
+        }
+        else {
+            printf("%s: ", filename);
+            first = 0;
+        }
+
+        /* Report the state after the move */
+        if (tracker.bad_values > 0) {
+            printf("INCONSISTENT, %d cells hold values other than 0-9\n", tracker.bad_values);
+        }
+        else if (tracker.conflicts == 0) {
+            printf("%s, %d of 81 cells filled\n", tracker_solved(&tracker) ? "solved" : "consistent", tracker.filled);
+        }
+        else {
+            printf("INCONSISTENT, %d repeated digits in ", tracker.conflicts);
+            const char* separator = "";
+            for (int u = 0; u < 27; u++) {
+                if (tracker.conflict_units >> u & 1) {
+                    printf("%s", separator);
+                    print_unit_name(u);
+                    separator = ", ";
+                }
+            }
+            printf("\n");
+        }
+        fflush(stdout);
+
+    }
+
+}
+
+
+/**
+ * Applies random moves to a partly filled grid, checking that the tracker
+ * agrees with a full rescan after every move and that undoing every move
+ * restores the starting state, then times the tracker against the rescan.
+ * 
+ * Parameters
+ * ----------
+ *   iterations : Number of random moves
+ */
+void run_move_benchmark(long iterations) {
+
+    /* Random solution with about half the cells emptied */
+    uint32_t seed = 2024;
+    uint8_t grid[81];
+    random_solution(grid, &seed);
+    for (int cell = 0; cell < 81; cell++) {
+        if (random_next(&seed) & 1) {
+            grid[cell] = 0;
+        }
+    }
+
+    int* cells = malloc(iterations * sizeof(int));
+    int* digits = malloc(iterations * sizeof(int));
+    for (long i = 0; i < iterations; i++) {
+        cells[i] = random_next(&seed) % 81;
+        digits[i] = random_next(&seed) % 10;
+    }
+
+    /* Check the tracker against the rescan after every move */
+    struct move_tracker start_state, tracker;
+    tracker_init(&start_state, grid);
+    tracker = start_state;
+    long checked = iterations < 1000000 ? iterations : 1000000;
+    struct move* moves = malloc(checked * sizeof(struct move));
+    for (long i = 0; i < checked; i++) {
+        moves[i] = tracker_apply(&tracker, cells[i], digits[i]);
+        if (tracker.conflicts != count_conflicts_scan(tracker.grid)) {
+            printf("Error: tracker has %d conflicts after move %ld, rescan finds %d.\n", tracker.conflicts, i, count_conflicts_scan(tracker.grid));
+            exit(0);
+        }
+    }
+    for (long i = checked - 1; i >= 0; i--) {
+        tracker_undo(&tracker, moves[i]);
+    }
+    if (!tracker_equal(&tracker, &start_state)) {
+        printf("Error: undoing every move did not restore the starting state.\n");
+        exit(0);
+    }
+    printf("Tracker agrees with the rescan on %ld moves, and undo restores the grid\n\n", checked);
+
+    /* Time both ways of checking consistency after each move */
+    volatile long consistent = 0;  // Keeps the checks from being optimized away
+    tracker = start_state;
+    double start = now_seconds();
+    for (long i = 0; i < iterations; i++) {
+        tracker_apply(&tracker, cells[i], digits[i]);
+        consistent += tracker_consistent(&tracker);
+    }
+    double incremental_time = now_seconds() - start;
+
+    uint8_t scan_grid[81];
+    memcpy(scan_grid, grid, 81);
+    start = now_seconds();
+    for (long i = 0; i < iterations; i++) {
+        scan_grid[cells[i]] = digits[i];
+        consistent += count_conflicts_scan(scan_grid) == 0;
+    }
+    double scan_time = now_seconds() - start;
+
+    printf("incremental : %12.0f moves/s\n", iterations / incremental_time);
+    printf("rescan      : %12.0f moves/s  (%.1fx slower)\n", iterations / scan_time, scan_time / incremental_time);
+
+    free(cells);
+    free(digits);
+    free(moves);
+
+}
+
+
+/**
+ * Checks every partial grid in a file and prints whether its filled cells
+ * are consistent, followed by the candidates of each empty cell at the
+ * default VERBOSITY.
+ * 
+ * Parameters
+ * ----------
+ *   filename : File of grids, with 0 or '.' for blank cells
+ */
+void run_candidates(char* filename) {
+
+    struct grid_file file;
+    grid_file_open(&file, filename);
+    select_grid_validator();
+
+    uint8_t grid[81];
+    uint16_t candidates[81];
+    long total = 0, num_consistent = 0;
+
+    while (parse_grid(&file, grid)) {
+
+        total++;
+        int consistent = grid_candidates(grid, candidates);
+        num_consistent += consistent;
+        int empty = 0, stuck = 0;  // Empty cells, and those with no candidate left
+        for (int cell = 0; cell < 81; cell++) {
+            empty += grid[cell] == 0;
+            stuck += grid[cell] == 0 && candidates[cell] == 0;
+        }
+        printf("Grid %ld is %s, %d empty cells, %d without candidates\n", total, consistent ? "consistent" : "INCONSISTENT", empty, stuck);
+
+#if VERBOSITY >= 2
+        /* Filled cells show their value, empty cells their candidates */
+        for (int row = 0; row < 9; row++) {
+            for (int col = 0; col < 9; col++) {
+                int cell = 9 * row + col;
+                char text[10];
+                int length = 0;
+                if (grid[cell] != 0) {
+                    length = snprintf(text, sizeof(text), "[%d]", grid[cell]);
+                }
+                for (int digit = 1; digit <= 9; digit++) {
+                    if (candidates[cell] >> digit & 1) {
+                        text[length++] = '0' + digit;
+                    }
+                }
+                text[length] = '\0';
+                printf("%-10s", text);
+            }
+            printf("\n");
+        }
+        printf("\n");
+#endif
+
+    }
+    grid_file_close(&file);
+
+    printf("\n%s contains %ld grids: %ld consistent, %ld INCONSISTENT\n", filename, total, num_consistent, total - num_consistent);
+
+}
+
+
+/**
+ * Checks that the scalar and AVX2 candidate computations agree on random
+ * partial grids, some with a repeated digit or an out of range value, and
+ * times each.
+ * 
+ * Parameters
+ * ----------
+ *   iterations : Number of passes over the set of grids
+ */
+void run_candidates_benchmark(long iterations) {
+
+    const int num_grids = 1024;
+    uint8_t (*grids)[81] = malloc(num_grids * sizeof(*grids));
+    uint32_t seed = 74;
+    for (int g = 0; g < num_grids; g++) {
+        random_solution(grids[g], &seed);
+        int blanks = random_next(&seed) % 82;  // From full grids to empty ones
+        for (int i = 0; i < blanks; i++) {
+            grids[g][random_next(&seed) % 81] = 0;
+        }
+        if (g % 4 == 1) {  // A digit that may repeat
+            grids[g][random_next(&seed) % 81] = 1 + random_next(&seed) % 9;
+        }
+        else if (g % 16 == 3) {
+            grids[g][random_next(&seed) % 81] = 10 + random_next(&seed) % 246;
+        }
+    }
+
+    int (*versions[2])(const uint8_t*, uint16_t*) = {grid_candidates_scalar, NULL};
+    const char* names[2] = {"scalar", "avx2"};
+#ifdef HAVE_AVX2_VALIDATOR
+    if (__builtin_cpu_supports("avx2")) {
+        versions[1] = grid_candidates_avx2;
+    }
+#endif
+
+    /* Both versions must give the same result and candidates */
+    int num_consistent = 0;
+    for (int g = 0; g < num_grids && versions[1] != NULL; g++) {
+        uint16_t expected[81], actual[81];
+        int consistent = versions[0](grids[g], expected);
+        num_consistent += consistent;
+        if (versions[1](grids[g], actual) != consistent || memcmp(expected, actual, sizeof(expected)) != 0) {
+            printf("Error: candidate computations differ on grid %d.\n", g);
+            exit(0);
+        }
+    }
+
+    uint16_t candidates[81];
+    volatile long checksum = 0;  // Keeps the results from being optimized away
+    for (int v = 0; v < 2; v++) {
+        if (versions[v] == NULL) {
+            printf("%-6s : not available on this CPU\n", names[v]);
+            continue;
+        }
+        double start = now_seconds();
+        for (long i = 0; i < iterations; i++) {
+            for (int g = 0; g < num_grids; g++) {
+                checksum += versions[v](grids[g], candidates) + candidates[g % 81];
+            }
+        }
+        double elapsed = now_seconds() - start;
+        double calls = (double) iterations * num_grids;
+        printf("%-6s : %12.0f grids/s  %6.1f ns/grid\n", names[v], calls / elapsed, elapsed / calls * 1e9);
+    }
+    printf("(%d grids, %d consistent)\n", num_grids, num_consistent);
+
+    free(grids);
+
+}
+
+
+/**
+ * Removes clues from a puzzle in random order while it keeps a unique
+ * solution, counting the solutions of each smaller puzzle up to 2. Taking out
+ * more clues can only add solutions, so a clue whose removal breaks
+ * uniqueness must stay, and each clue is tried once. With more than one
+ * thread, each count is made by the parallel work-stealing search, which
+ * gives the same answer as the sequential solver.
+ * 
+ * Parameters
+ * ----------
+ *   puzzle :      Grid with a unique solution, updated in place
+ *   target :      Stop at this many clues, or 0 to stop only when no clue
+ *                 can be removed
+ *   num_threads : Number of threads counting the solutions of each puzzle
+ *   seed :        Random generator state, updated in place
+ * 
+ * Returns
+ * -------
+ *   clues : Number of clues left
+ */
+int remove_clues(uint8_t* puzzle, int target, int num_threads, uint32_t* seed) {
+
+    int order[81], clues = 0;
+    for (int cell = 0; cell < 81; cell++) {
+        if (puzzle[cell] != 0) {
+            order[clues++] = cell;
+        }
+    }
+    shuffle(order, clues, seed);
+
+    int num_clues = clues;
+    for (int i = 0; i < num_clues && clues > target; i++) {
+        int digit = puzzle[order[i]];
+        puzzle[order[i]] = 0;
+        long count;
+        if (num_threads > 1) {
+            uint8_t solution[81];
+            long steals;
+            count = parallel_count(puzzle, num_threads, 2, solution, &steals);
+        }
+        else {
+            struct solver_state state;
+            count = solver_init(&state, puzzle) ? solver_count(&state, 2, NULL, NULL) : 0;
+        }
+        if (count == 1) {
+            clues--;
+        }
+        else {
+            puzzle[order[i]] = digit;
+        }
+    }
+
+    return clues;
+
+}
+
+
+/**
+ * Generates a range of puzzles, each from its own seed, so the puzzles do
+ * not depend on which thread makes them. If removing clues does not reach
+ * the target, another solution is tried. Used as a pool task.
+ * 
+ * Parameters
+ * ----------
+ *   data :  Shared puzzle set
+ *   first : Index of the first puzzle
+ *   last :  Index one past the last puzzle
+ */
+void generate_range(void* data, long first, long last) {
+
+    struct puzzle_set* set = data;
+    for (long p = first; p < last; p++) {
+
+        /* Seed of the puzzle, mixed from the run's seed and its number */
+        uint32_t seed = set->seed ^ (uint32_t) ((set->first + p + 1) * 0x9E3779B9u);
+        seed = seed != 0 ? seed : 1;
+        for (int i = 0; i < 4; i++) {
+            random_next(&seed);
+        }
+
+        set->clues[p] = 0;
+        set->attempts[p] = 0;
+        for (int attempt = 0; attempt < GENERATE_ATTEMPTS; attempt++) {
+            set->attempts[p]++;
+            random_solution(set->puzzles[p], &seed);
+            int clues = remove_clues(set->puzzles[p], set->target, set->search_threads, &seed);
+            if (set->target == 0 || clues == set->target) {
+                set->clues[p] = clues;
+                break;
+            }
+        }
+
+    }
+
+}
+
+
+/**
+ * Generates puzzles with a unique solution and prints each on one line with
+ * '.' for blank cells, followed by the number of puzzles generated per
+ * second. Puzzles are made in batches, one per pool task, and printed in
+ * order. A batch with fewer puzzles than threads shares the spare threads
+ * between its puzzles' uniqueness checks instead, so that a few puzzles are
+ * still generated in parallel.
+ * 
+ * Parameters
+ * ----------
+ *   num_puzzles : Number of puzzles to generate
+ *   target :      Number of clues of each puzzle, or 0 for puzzles from
+ *                 which no clue can be removed
+ *   num_threads : Number of threads generating puzzles
+ *   seed :        Nonzero seed of the random generator, so runs can be
+ *                 repeated with any number of threads
+ */
+void run_generate(long num_puzzles, int target, int num_threads, uint32_t seed) {
+
+    struct thread_pool* pool = malloc(sizeof(struct thread_pool));
+    thread_pool_start(pool, num_threads);
+
+    struct puzzle_set set;
+    set.seed = seed;
+    set.target = target;
+    set.puzzles = malloc(GENERATE_BATCH * sizeof(*set.puzzles));
+    set.clues = malloc(GENERATE_BATCH * sizeof(int));
+    set.attempts = malloc(GENERATE_BATCH * sizeof(long));
+
+    long total_clues = 0, attempts = 0, generated = 0;
+    double start = now_seconds();
+
+    for (set.first = 0; set.first < num_puzzles && generated == set.first; set.first += GENERATE_BATCH) {
+
+        long count = num_puzzles - set.first < GENERATE_BATCH ? num_puzzles - set.first : GENERATE_BATCH;
+        set.search_threads = count < num_threads ? num_threads / count : 1;
+        for (long p = 0; p < count; p++) {
+            thread_pool_submit(pool, generate_range, &set, p, p + 1);
+        }
+        thread_pool_wait(pool);
+
+        for (long p = 0; p < count; p++) {  // Every solution tried, including puzzles not printed
+            attempts += set.attempts[p];
+        }
+        for (long p = 0; p < count; p++) {
+            if (set.clues[p] == 0) {
+                printf("Gave up on puzzle %ld: no solution tried could be reduced to %d clues.\n", set.first + p + 1, target);
+                break;
+            }
+
+            char line[83];
+            for (int cell = 0; cell < 81; cell++) {
+                line[cell] = set.puzzles[p][cell] ? '0' + set.puzzles[p][cell] : '.';
+            }
+            line[81] = '\n';
+            line[82] = '\0';
+            fputs(line, stdout);
+            total_clues += set.clues[p];
+            generated++;
+        }
+
+    }
+
+    thread_pool_stop(pool);
+    double elapsed = now_seconds() - start;
+    free(pool);
+    free(set.puzzles);
+    free(set.clues);
+    free(set.attempts);
+
+    printf("\nGenerated %ld puzzles with %.1f clues on average from %ld solutions, seed %u\n",
+           generated, generated > 0 ? (double) total_clues / generated : 0.0, attempts, seed);
+    printf("Generated with %d threads in %.3f s, %.1f puzzles/s\n", num_threads, elapsed, elapsed > 0 ? generated / elapsed : 0.0);
+
+}